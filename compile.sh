@@ -3,19 +3,81 @@
 # Make sure Emscripten is activated
 source ./emsdk/emsdk_env.sh
 
-# Compile the C++ code to WebAssembly with ODE-specific exports
-emcc -std=c++17 ecm.cpp -o ecm.js \
-    -s WASM=1 \
-    -s EXPORTED_RUNTIME_METHODS='["ccall", "cwrap"]' \
-    -s EXPORTED_FUNCTIONS='["_malloc", "_free", "_initializeGrid", "_simulateStep", 
-                            "_setInputConcentration", "_getECMData", "_getFeedbackData", 
-                            "_freeData", "_readDataValue", "_setAllInputs", 
-                            "_setTimeStep", "_setRateConstants", "_getODEParameters",
-                            "_setCellConcentration", "_setCellInputConcentration",
-                            "_clearCellInputOverrides", "_clearAllInputOverrides"]' \
-    -s ALLOW_MEMORY_GROWTH=1 \
-    -s MODULARIZE=1 \
-    -s EXPORT_NAME="ECMModule" \
-    -O2
+# Compile the C++ code to WebAssembly with ODE-specific exports.
+# Usage: build OUTPUT [EXTRA_FLAGS...]
+# Add -DECM_FLOAT32 to EXTRA_FLAGS for single-precision fields (README.md,
+# "Precision").
+build() {
+    local output=$1
+    shift
+    emcc -std=c++17 ecm.cpp ecm_program.cpp ecm_threads.cpp ecm_tridiagonal.cpp \
+        ecm_fft.cpp -o "$output" \
+        -s WASM=1 \
+        -s EXPORTED_RUNTIME_METHODS='["ccall", "cwrap", "UTF8ToString",
+                                      "addFunction", "removeFunction",
+                                      "HEAPF64", "HEAPF32", "HEAPU8"]' \
+        -s ALLOW_TABLE_GROWTH=1 \
+        -s EXPORTED_FUNCTIONS='["_malloc", "_free", "_initializeGrid", "_simulateStep", 
+                                "_setInputConcentration", "_getECMData", "_getFeedbackData", 
+                                "_freeData", "_readDataValue", "_setAllInputs", 
+                                "_setTimeStep", "_setRateConstants", "_getODEParameters",
+                                "_setCellConcentration", "_setCellInputConcentration",
+                                "_clearCellInputOverrides", "_clearAllInputOverrides",
+                                "_loadNetwork", "_getNetworkError", "_resetNetwork",
+                                "_getNetworkSpec", "_setParameter", "_getParameter",
+                                "_getSimdLanes", "_setThreadCount", "_getThreadCount",
+                                "_setFusedSweep", "_getFusedSweep",
+                                "_getGridRows", "_getGridCols",
+                                "_setIntegrator", "_getIntegrator",
+                                "_setTolerance", "_getTolerance",
+                                "_setDiffusionScheme", "_getDiffusionScheme",
+                                "_setStrangSplitting", "_getStrangSplitting",
+                                "_setReactionSubsteps", "_getReactionSubsteps",
+                                "_setDiffusionIntervals", "_getFeedbackInterval",
+                                "_getECMInterval", "_getJacobianNonzeros",
+                                "_getJacobianPattern", "_getCellJacobian",
+                                "_checkJacobian", "_setActiveSet",
+                                "_getActiveSet", "_getActiveFraction",
+                                "_setCompression", "_getCompression",
+                                "_getClassCount", "_simulateSteps",
+                                "_runUntil", "_setStepCallback",
+                                "_setTimeBudget", "_getTimeBudget",
+                                "_getSimulationTime", "_getFieldView",
+                                "_getECMView", "_getFeedbackView",
+                                "_getFieldStride", "_getFieldBytes",
+                                "_getSpeciesCount", "_getInputCount",
+                                "_getSpeciesIndex", "_getSpeciesName",
+                                "_snapshotFields", "_snapshotFieldsFloat",
+                                "_setRandomSeed", "_benchmarkPhase",
+                                "_setProfiling", "_getProfiling",
+                                "_resetProfile", "_getProfile",
+                                "_getCheckpointSize", "_saveCheckpoint",
+                                "_loadCheckpoint", "_getCheckpointError",
+                                "_setEnsembleSize", "_getEnsembleSize",
+                                "_setMemberParameter",
+                                "_getMemberParameter", "_setMemberInput",
+                                "_setSensitivity", "_getSensitivity",
+                                "_getSensitivityView",
+                                "_getSensitivityStride"]' \
+        -s ALLOW_MEMORY_GROWTH=1 \
+        -s MAXIMUM_MEMORY=4GB \
+        -s MODULARIZE=1 \
+        -s EXPORT_NAME="ECMModule" \
+        -O2 "$@"
+}
+
+# Baseline module, runs in every browser with WebAssembly
+build ecm.js
+
+# Vectorized module (2 cells per instruction with WebAssembly SIMD).
+# index.html loads it when the browser supports SIMD and falls back to
+# ecm.js otherwise.
+build ecm_simd.js -msimd128
+
+# Vectorized and multithreaded module. Needs SharedArrayBuffer, i.e. a page
+# served with cross-origin isolation headers (see server.sh). Workers are
+# started with the module, one per hardware thread.
+build ecm_threads.js -msimd128 -pthread \
+    -s PTHREAD_POOL_SIZE=navigator.hardwareConcurrency
 
 echo "ODE-based simulation with brush selection compilation complete!"
\ No newline at end of file
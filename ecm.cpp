@@ -1,12 +1,31 @@
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
 #include <ctime>
-#include <emscripten.h>
+#include <memory>
+#include <new>
 #include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
-const int GRID_SIZE = 100;
+#include "ecm.h"
+#include "ecm_fft.h"
+#include "ecm_network.h"
+#include "ecm_program.h"
+#include "ecm_simd.h"
+#include "ecm_threads.h"
+#include "ecm_tridiagonal.h"
+
+// Grid used when initializeGrid is called without dimensions
+const int DEFAULT_GRID_SIZE = 100;
+
+// Seed of the random initial ECM values, 0 to seed from the clock
+unsigned random_seed = 0;
 
 // Define rate constants for the ODE system
 struct RateConstants {
@@ -23,1414 +42,2950 @@ struct RateConstants {
 
 RateConstants rates;
 
-struct Cell {
-  std::unordered_map<std::string, double> icm;       // Current values
-  std::unordered_map<std::string, double> icm_rates; // Rate of change (dx/dt)
-  std::unordered_map<std::string, double> ecm;       // ECM components
-  std::unordered_map<std::string, double> ecm_rates; // ECM rate of change
-  std::unordered_map<std::string, double> feedback;  // Feedback mechanisms
-  std::unordered_map<std::string, double>
-      feedback_rates; // Feedback rate of change
-  
-  // Add per-cell input overrides
-  std::unordered_map<std::string, double> input_overrides; // Per-cell input values
-  bool has_input_override = false; // Flag to indicate if this cell has custom inputs
+// Diffusing species (ECM and feedback) form one block of fields
+static_assert(sp::FIRST_FEEDBACK == sp::FIRST_ECM + sp::NUM_ECM,
+              "ECM and feedback fields must be adjacent");
+const int NUM_DIFFUSING = sp::NUM_ECM + sp::NUM_FEEDBACK;
+
+// Precision. Fields are stored as Scalar and the rate kernel computes in
+// RateScalar, both double by default. Building with -DECM_FLOAT32 stores the
+// fields as float, which halves the memory traffic of every pass, and runs
+// the rate kernel and the explicit diffusion stencil in float with twice the
+// SIMD lanes; -DECM_DOUBLE_RATES on top keeps the rate kernel in double.
+// Everything else (the integrator updates, ADI and spectral solves,
+// Jacobians) computes in double and rounds to Scalar on store. README.md
+// lists the accuracy of the float builds.
+typedef ECMScalar Scalar;
+#if defined(ECM_FLOAT32) && !defined(ECM_DOUBLE_RATES)
+typedef float RateScalar;
+#else
+typedef double RateScalar;
+#endif
+
+// Bytes the engine allocated while stepping or reading back, for the
+// profile. Every buffer those paths can grow is a CountedVector and
+// copyField adds its malloc; all of them are resized by the calling thread
+// only, never inside a worker.
+size_t allocated_bytes = 0;
+
+template <typename T> struct CountingAllocator {
+  typedef T value_type;
+  CountingAllocator() = default;
+  template <typename U> CountingAllocator(const CountingAllocator<U> &) {}
+  T *allocate(size_t n) {
+    T *p = std::allocator<T>().allocate(n);
+    allocated_bytes += n * sizeof(T);
+    return p;
+  }
+  void deallocate(T *p, size_t n) { std::allocator<T>().deallocate(p, n); }
+};
+template <typename T, typename U>
+bool operator==(const CountingAllocator<T> &, const CountingAllocator<U> &) {
+  return true;
+}
+template <typename T, typename U>
+bool operator!=(const CountingAllocator<T> &, const CountingAllocator<U> &) {
+  return false;
+}
+template <typename T>
+using CountedVector = std::vector<T, CountingAllocator<T>>;
+
+// Structure-of-arrays grid state. Each species owns one contiguous field of
+// num_cells values, indexed by c = row * cols + col; species s of cell c is
+// fields[s][c].
+//
+// Memory budget: every cell holds num_species + NUM_DIFFUSING Scalars and one
+// override flag per input, i.e. (149 + 22) * 8 + 11 = 1379 bytes with the
+// built-in network (+8 bytes per species a loaded network adds), half that
+// with float storage. A 1000x1000 grid takes 1.4 GB (0.7 GB in float) and
+// 4000x4000 takes 22 GB (11 GB in float). Each thread adds ~600 KB of
+// scratch independent of the grid size. The adaptive integrators add 8 bytes
+// per cell and ~700 KB of scratch per thread, the spectral diffusion scheme
+// 8 bytes per cell and compression 5 bytes per cell.
+struct GridState {
+  int rows = 0;                      // Grid dimensions
+  int cols = 0;
+  int num_cells = 0;                 // rows * cols
+  int num_species = sp::NUM_SPECIES; // Built-in species plus loaded extras
+
+  // Every field in one allocation: the num_species current fields, then a
+  // second buffer for each diffusing species. A diffusion pass writes the
+  // second buffer from the first and swaps them instead of copying the
+  // field. fields[s] points at the current buffer of species s.
+  std::vector<Scalar> storage;
+  std::vector<Scalar *> fields;
+  bool swapped[NUM_DIFFUSING] = {}; // Diffusing field currently in back
+
+  // Per-cell input overrides. An overridden input keeps its brushed value in
+  // conc and is skipped by the grid-wide input setters.
+  std::vector<unsigned char> input_override;
 };
 
-std::vector<std::vector<Cell>> grid(GRID_SIZE, std::vector<Cell>(GRID_SIZE));
-
-extern "C" {
-
-// Initialize all molecules in the grid
-EMSCRIPTEN_KEEPALIVE
-void initializeGrid() {
-  // Seed the random number generator
-  srand(time(NULL));
-
-  for (int i = 0; i < GRID_SIZE; i++) {
-    for (int j = 0; j < GRID_SIZE; j++) {
-      grid[i][j].icm.clear();
-      grid[i][j].icm_rates.clear();
-      grid[i][j].ecm.clear();
-      grid[i][j].ecm_rates.clear();
-      grid[i][j].feedback.clear();
-      grid[i][j].feedback_rates.clear();
-      grid[i][j].input_overrides.clear();
-      grid[i][j].has_input_override = false;
-
-      // Initialize input molecules with default values
-      grid[i][j].icm["AngIIin"] = 0;
-      grid[i][j].icm["TGFBin"] = 0;
-      grid[i][j].icm["tensionin"] = 0;
-      grid[i][j].icm["IL6in"] = 0;
-      grid[i][j].icm["IL1in"] = 0;
-      grid[i][j].icm["TNFain"] = 0;
-      grid[i][j].icm["NEin"] = 0;
-      grid[i][j].icm["PDGFin"] = 0;
-      grid[i][j].icm["ET1in"] = 0;
-      grid[i][j].icm["NPin"] = 0;
-      grid[i][j].icm["E2in"] = 0;
-
-      // Initialize feedback molecules
-      grid[i][j].feedback["TGFBfb"] = 0;
-      grid[i][j].feedback["AngIIfb"] = 0;
-      grid[i][j].feedback["IL6fb"] = 0;
-      grid[i][j].feedback["ET1fb"] = 0;
-      grid[i][j].feedback["tensionfb"] = 0;
-
-      // Initialize ECM molecules with random values (0.0-0.9)
-      grid[i][j].ecm["proCI"] = (rand() % 10) / 10.0;
-      grid[i][j].ecm["proCIII"] = (rand() % 10) / 10.0;
-      grid[i][j].ecm["fibronectin"] = (rand() % 10) / 10.0;
-      grid[i][j].ecm["periostin"] = (rand() % 10) / 10.0;
-      grid[i][j].ecm["TNC"] = (rand() % 10) / 10.0;
-      grid[i][j].ecm["PAI1"] = (rand() % 10) / 10.0;
-      grid[i][j].ecm["CTGF"] = (rand() % 10) / 10.0;
-      grid[i][j].ecm["EDAFN"] = (rand() % 10) / 10.0;
-
-      // Initialize MMPs and TIMPs
-      grid[i][j].ecm["proMMP1"] = (rand() % 10) / 10.0;
-      grid[i][j].ecm["proMMP2"] = (rand() % 10) / 10.0;
-      grid[i][j].ecm["proMMP3"] = (rand() % 10) / 10.0;
-      grid[i][j].ecm["proMMP8"] = (rand() % 10) / 10.0;
-      grid[i][j].ecm["proMMP9"] = (rand() % 10) / 10.0;
-      grid[i][j].ecm["proMMP12"] = (rand() % 10) / 10.0;
-      grid[i][j].ecm["proMMP14"] = (rand() % 10) / 10.0;
-      grid[i][j].ecm["TIMP1"] = (rand() % 10) / 10.0;
-      grid[i][j].ecm["TIMP2"] = (rand() % 10) / 10.0;
-
-      // Initialize all rate arrays with zeros
-      for (const auto &[key, val] : grid[i][j].icm) {
-        grid[i][j].icm_rates[key] = 0.0;
-      }
-
-      for (const auto &[key, val] : grid[i][j].ecm) {
-        grid[i][j].ecm_rates[key] = 0.0;
-      }
-
-      for (const auto &[key, val] : grid[i][j].feedback) {
-        grid[i][j].feedback_rates[key] = 0.0;
-      }
+GridState state;
+
+// Network loaded with loadNetwork(). While use_program is false the compiled
+// kernel from ecm_network.h is used.
+NetworkProgram network;
+bool use_program = false;
+std::string network_spec;
+std::vector<double> network_params; // Values of all program parameters
+std::vector<double> network_coefs;  // Resolved program coefficients
+
+// Ensemble of parameter sets (setEnsembleSize). The M members of a cell sit
+// side by side in every field: rows x cols cells are stored as rows x
+// (cols * M) values with member m of (row, col) at column col * M + m, so
+// state.cols is the wide count and fields, views and per-cell functions
+// address wide columns. Diffusion couples column j with j +- M, the same
+// member in the neighboring cells, and the rate kernel gives every lane its
+// member's rate constants, so consecutive members share SIMD instructions.
+int ensemble_size = 1;                // Members of the next initializeGrid
+int grid_members = 1;                 // Members of the current grid
+std::vector<double> member_overrides;   // Per member and parameter, NaN if
+                                        // the member uses the shared value
+CountedVector<double> member_rates;     // Resolved by prepareRates
+CountedVector<Scalar> member_diffusion; // Rate of each wide column:
+                                        // feedback row, then ECM row
+
+// Forward sensitivities (setSensitivity): d(x_s)/d(k_p) of every cell for
+// the built-in species and rate constants, integrated alongside the state
+// in double whatever the field precision. Each cell holds a block of
+// sensitivity_stride doubles: the NUM_PARAMS sensitivities of every species
+// side by side, so one SIMD vector updates a cell's sensitivities to every
+// rate constant and a cell's reaction update reads one contiguous block,
+// then a spare for each diffusing field. sensitivity_fields[s] points at
+// species s in the first cell's block, d(x_s)/d(k_p) of cell c being at
+// c * sensitivity_stride + p; sensitivity_spares[k] is the buffer a
+// diffusion pass of diffusing field k writes, swapped with the field like
+// the species buffers. Only advanced on plain grids of the built-in network.
+bool sensitivity = false;
+std::vector<double> sensitivity_storage;
+std::vector<double *> sensitivity_fields;
+std::vector<double *> sensitivity_spares;
+size_t sensitivity_stride = 0;
+
+// True if steps advance the sensitivities
+inline bool sensitivityStep() {
+  return sensitivity && !use_program && grid_members == 1 &&
+         !sensitivity_storage.empty();
+}
 
-      // Initialize other variables needed for calculations
-      grid[i][j].icm["AngII"] = 0;
-      grid[i][j].icm_rates["AngII"] = 0;
+// Sparsity pattern of the Jacobian d(rate)/d(x) in CSR form, shared by all
+// cells: row s lists the species the rate of s depends on, plus s itself.
+// jacobian_slots maps each contribution, in the order the network emits
+// them, to its CSR entry. Built on first use for the active network.
+CountedVector<int> jacobian_rows;    // num_species + 1 offsets
+CountedVector<int> jacobian_columns; // Column of each nonzero
+CountedVector<int> jacobian_slots;
+
+// Cells per rate tile. Species fields are num_cells doubles apart and map
+// onto a handful of L1 sets, so for the compiled kernel cells are first
+// copied into a compact species-by-cell tile that the vectorized kernel then
+// reads with unit stride. Rates are only ever held for one tile (~600 KB
+// including the input tile); each thread owns its tiles.
+const int RATE_TILE = 256;
+
+// Cells per tile of the adaptive integrators, which hold the state and every
+// Runge-Kutta stage of a tile at once (~700 KB for Dormand-Prince)
+const int STAGE_TILE = 64;
+const int MAX_STAGES = 7;
+
+// Cells per tile of the sensitivity update, which holds the Jacobian and
+// d(rate)/d(k) contributions of a tile at once (~140 KB)
+const int SENSITIVITY_TILE = 16;
+
+// Cells whose Jacobian products the sensitivity update sums in one pass
+const int SENSITIVITY_BLOCK = 4;
+
+// Per-thread scratch
+struct ThreadScratch {
+  std::vector<RateScalar> tile;       // Input tile, then rate tile
+  std::vector<double> stages;         // Adaptive integrator tiles
+  std::vector<const double *> inputs; // Species rows of a stage input tile
+  std::vector<double> line;           // One grid row
+  std::vector<double> spectral;       // Spectral column, decay and workspace
+  std::vector<RateScalar> cell;       // One cell's species, then its rates
+  std::vector<double> sensitivity;    // Sensitivity tiles, then two rows
+};
+std::vector<ThreadScratch> scratch;
 
-      grid[i][j].icm["TGFB"] = 0;
-      grid[i][j].icm_rates["TGFB"] = 0;
+// Workers for the per-step passes; the caller is thread 0
+ThreadPool pool;
+bool threads_configured = false;
 
-      grid[i][j].icm["tension"] = 0;
-      grid[i][j].icm_rates["tension"] = 0;
+// Run reaction and diffusion as one tiled sweep (see sweepFused)
+bool fused_sweep = false;
 
-      grid[i][j].icm["IL6"] = 0;
-      grid[i][j].icm_rates["IL6"] = 0;
+// Scheme for the diffusion step
+enum DiffusionScheme {
+  EXPLICIT_DIFFUSION = 0, // Explicit 8-neighbor update (default)
+  ADI_DIFFUSION = 1,      // Alternating-direction implicit, see diffuseADI
+  SPECTRAL_DIFFUSION = 2  // Exact Fourier-mode decay, see diffuseSpectral
+};
+int diffusion_scheme = EXPLICIT_DIFFUSION;
 
-      grid[i][j].icm["IL1"] = 0;
-      grid[i][j].icm_rates["IL1"] = 0;
+// Scheme in use: ensemble grids always diffuse explicitly, as the implicit
+// schemes would couple the members of a row, and so do sensitivity runs
+inline int diffusionScheme() {
+  return grid_members > 1 || sensitivityStep() ? EXPLICIT_DIFFUSION
+                                               : diffusion_scheme;
+}
 
-      grid[i][j].icm["TNFa"] = 0;
-      grid[i][j].icm_rates["TNFa"] = 0;
+// Factorizations for the ADI solves along a row and along a column
+CyclicTridiagonal adi_row;
+CyclicTridiagonal adi_column;
+
+// Spectral scheme: transforms along a row and along a column, the 1D
+// stencil symbols 1 + 2 cos(k) for each column and row frequency, and the
+// imaginary part for a field left without a partner
+FFT fft_row;
+FFT fft_column;
+std::vector<double> symbol_row;
+std::vector<double> symbol_column;
+std::vector<Scalar> spectral_field;
+
+// Operator splitting. Each step reacts every cell over delta_t in
+// reaction_substeps Euler substeps. The feedback and ECM fields diffuse once
+// per window of interval steps, over the time the window covered, so slow
+// fields are not diffused at the reaction's time scale. With Strang
+// splitting half of each window's diffusion runs before its first reaction
+// and half after its last.
+bool strang_splitting = false;
+int reaction_substeps = 1;
+
+// Diffusion window of the feedback or ECM fields
+struct DiffusionClock {
+  int interval = 1;     // Steps per window
+  int count = 0;        // Steps taken in the current window
+  double elapsed = 0.0; // Time the current window has covered
+  double lead = 0.0;    // Diffusion applied at the start of the window
+};
+DiffusionClock feedback_clock;
+DiffusionClock ecm_clock;
+
+// Active set. Each grid row is split into blocks of ACTIVE_SPAN cells. A
+// block whose values changed by at most active_tolerance * dt in a step
+// turns dormant: the reaction and diffusion passes skip it until a
+// neighboring block is active, or an input, concentration or parameter
+// change wakes it. Only used with the explicit diffusion scheme.
+const int ACTIVE_SPAN = 64;
+bool active_set = false;
+double active_tolerance = 1e-6;
+int active_blocks_per_row = 0;
+std::vector<unsigned char> block_active; // Processed in the next step
+std::vector<unsigned char> block_moving; // Still changing after this step
+std::vector<double> block_change;        // Largest change in this step
+double active_fraction = 1.0;            // Cells processed in the last step
+
+// Equivalence classes. Only the ECM fields read the ECM fields, so cells
+// that agree bit for bit in every other species also agree in those
+// species' rates. With compression the reaction step computes them once per
+// class, for its first cell, and copies the result to every member; only
+// the ECM fields are updated cell by cell. Classes are regrouped after
+// grid-wide input changes and split lazily when diffusion or a per-cell edit
+// makes members diverge. Once there are more than num_cells / CLASS_LIMIT
+// classes the grid reacts cell by cell again until the next regroup.
+const int CLASS_LIMIT = 8;
+bool compression = false;
+bool regroup_classes = true;             // Regroup before the next step
+CountedVector<int> cell_class;           // Class of each cell, empty if unused
+CountedVector<int> class_first;          // First cell of each class
+CountedVector<unsigned char> class_check; // Compare members in every species
+CountedVector<unsigned char> cell_split; // Cell leaves its class
+CountedVector<double> class_values;      // Class results, species-major
+int class_count = 0;                     // Classes the last step reacted
+NetworkProgram network_ecm;              // ECM terms of the loaded network
+
+// Integrator for the reaction step
+enum Integrator {
+  EULER = 0,            // One explicit Euler step per simulateStep (default)
+  BOGACKI_SHAMPINE = 1, // Adaptive Runge-Kutta 3(2)
+  DORMAND_PRINCE = 2    // Adaptive Runge-Kutta 5(4)
+};
+int integrator = EULER;
+
+// Error tolerance of the adaptive integrators, applied both absolutely and
+// relative to the concentration
+double tolerance = 1e-4;
+
+// Last step size the adaptive integrator proposed for each cell, 0 until the
+// cell has taken a step. Only allocated in the adaptive modes.
+std::vector<double> cell_step;
+
+// Time simulated since initializeGrid
+double simulation_time = 0.0;
+
+// Batched stepping (simulateSteps, runUntil). The callback, if set, runs
+// after every callback_interval steps of a batch and stops the batch by
+// returning nonzero. A batch also stops once it has run for step_budget
+// milliseconds (0: no limit), checked between steps.
+StepCallback step_callback = nullptr;
+int callback_interval = 1;
+double step_budget = 0.0;
+
+// Profiling (setProfiling): time and work of each phase. When it is off a
+// phase only tests the flag.
+enum ProfilePhase {
+  PROFILE_REACTION = 0, // Reaction pass, the whole sweep when fused
+  PROFILE_FEEDBACK = 1, // Feedback diffusion
+  PROFILE_ECM = 2,      // ECM diffusion
+  PROFILE_READBACK = 3, // Field copies (getECMData, snapshotFields, ...)
+  PROFILE_STEP = 4,     // Whole step
+  NUM_PROFILE_PHASES = 5
+};
+struct PhaseProfile {
+  double total_ns = 0.0; // Since the last reset
+  double last_ns = 0.0;  // In the last step, or the last call for readback
+  double calls = 0.0;
+  double allocated_bytes = 0.0; // Engine allocations (see getProfile)
+  double cells = 0.0; // Cells processed (readback: values copied)
+};
+const int PROFILE_VALUES = 5; // Values per phase in getProfile()
+bool profiling = false;
+PhaseProfile profile[NUM_PROFILE_PHASES];
+double profile_values[NUM_PROFILE_PHASES * PROFILE_VALUES];
+
+// Adds the time and the allocated bytes from construction to destruction,
+// and the cells set meanwhile, to a phase if profiling is on
+class PhaseTimer {
+public:
+  explicit PhaseTimer(int phase)
+      : phase_(profiling ? phase : -1), start_bytes_(allocated_bytes) {
+    if (phase_ >= 0)
+      start_ = std::chrono::steady_clock::now();
+  }
+  ~PhaseTimer() {
+    if (phase_ < 0)
+      return;
+    const std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - start_;
+    PhaseProfile &p = profile[phase_];
+    p.total_ns += elapsed.count();
+    p.last_ns = phase_ == PROFILE_READBACK ? elapsed.count()
+                                           : p.last_ns + elapsed.count();
+    p.calls += 1.0;
+    p.allocated_bytes += (double)(allocated_bytes - start_bytes_);
+    p.cells += cells;
+  }
+  PhaseTimer(const PhaseTimer &) = delete;
+  PhaseTimer &operator=(const PhaseTimer &) = delete;
 
-      grid[i][j].icm["NE"] = 0;
-      grid[i][j].icm_rates["NE"] = 0;
+  bool active() const { return phase_ >= 0; }
 
-      grid[i][j].icm["PDGF"] = 0;
-      grid[i][j].icm_rates["PDGF"] = 0;
+  double cells = 0.0;
 
-      grid[i][j].icm["ET1"] = 0;
-      grid[i][j].icm_rates["ET1"] = 0;
+private:
+  int phase_;
+  size_t start_bytes_;
+  std::chrono::steady_clock::time_point start_;
+};
 
-      grid[i][j].icm["NP"] = 0;
-      grid[i][j].icm_rates["NP"] = 0;
+inline Scalar *field(int species) { return state.fields[species]; }
 
-      grid[i][j].icm["E2"] = 0;
-      grid[i][j].icm_rates["E2"] = 0;
+// Storage slot s: the num_species fields followed by the diffusing spares
+inline Scalar *storageField(int slot) {
+  return state.storage.data() + (size_t)slot * state.num_cells;
+}
 
-      // Initialize all receptor variables and their rates
-      grid[i][j].icm["AT1R"] = 0;
-      grid[i][j].icm_rates["AT1R"] = 0;
+// Buffer a diffusion pass writes for diffusing field k (species FIRST_ECM + k)
+inline Scalar *spareField(int k) {
+  return state.swapped[k] ? storageField(sp::FIRST_ECM + k)
+                          : storageField(state.num_species + k);
+}
 
-      grid[i][j].icm["TGFB1R"] = 0;
-      grid[i][j].icm_rates["TGFB1R"] = 0;
+// Point every species at its current buffer. Needed after (re)allocation and
+// after each diffusion pass swaps buffers.
+void bindFields() {
+  state.fields.resize(state.num_species);
+  for (int s = 0; s < state.num_species; s++)
+    state.fields[s] = storageField(s);
+  for (int k = 0; k < NUM_DIFFUSING; k++) {
+    if (state.swapped[k])
+      state.fields[sp::FIRST_ECM + k] = storageField(state.num_species + k);
+  }
+}
 
-      grid[i][j].icm["ETAR"] = 0;
-      grid[i][j].icm_rates["ETAR"] = 0;
+// Build the Jacobian pattern of the active network if needed
+void buildJacobianPattern() {
+  if (!jacobian_rows.empty())
+    return;
+  const int n = state.num_species;
+
+  // (row, col) of every contribution in emission order
+  CountedVector<std::pair<int, int>> emitted;
+  if (use_program) {
+    for (const NetworkPartial &partial : network.partials)
+      emitted.emplace_back(partial.row, partial.col);
+  } else {
+    double x[sp::NUM_SPECIES] = {};
+    double k[net::NUM_PARAMS] = {};
+    net::networkJacobianEntries(x, k, [&](int row, int col, double) {
+      emitted.emplace_back(row, col);
+    });
+  }
 
-      grid[i][j].icm["IL1RI"] = 0;
-      grid[i][j].icm_rates["IL1RI"] = 0;
+  CountedVector<std::pair<int, int>> entries = emitted;
+  for (int s = 0; s < n; s++)
+    entries.emplace_back(s, s);
+  std::sort(entries.begin(), entries.end());
+  entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+
+  jacobian_rows.assign(n + 1, 0);
+  jacobian_columns.resize(entries.size());
+  for (size_t i = 0; i < entries.size(); i++) {
+    jacobian_rows[entries[i].first + 1]++;
+    jacobian_columns[i] = entries[i].second;
+  }
+  for (int s = 0; s < n; s++)
+    jacobian_rows[s + 1] += jacobian_rows[s];
+
+  jacobian_slots.resize(emitted.size());
+  for (size_t i = 0; i < emitted.size(); i++) {
+    const int *columns = jacobian_columns.data();
+    const int *begin = columns + jacobian_rows[emitted[i].first];
+    const int *end = columns + jacobian_rows[emitted[i].first + 1];
+    jacobian_slots[i] =
+        (int)(std::lower_bound(begin, end, emitted[i].second) - columns);
+  }
+}
 
-      grid[i][j].icm["PDGFR"] = 0;
-      grid[i][j].icm_rates["PDGFR"] = 0;
+// Allocate zeroed sensitivity fields for the grid if sensitivities are on
+// and steps advance them (a plain grid of the built-in network), release
+// them otherwise. False, with sensitivities turned off, if they do not fit
+// in memory.
+bool allocateSensitivities() {
+  std::vector<double>().swap(sensitivity_storage);
+  sensitivity_fields.clear();
+  sensitivity_spares.clear();
+  if (!sensitivity || state.num_cells == 0 || grid_members > 1 || use_program)
+    return true;
+  const int num_fields = sp::NUM_SPECIES;
+  const int num_spares = NUM_DIFFUSING;
+  sensitivity_stride = (size_t)(num_fields + num_spares) * net::NUM_PARAMS;
+  try {
+    sensitivity_storage.assign(state.num_cells * sensitivity_stride + 8, 0.0);
+  } catch (const std::bad_alloc &) {
+    sensitivity = false;
+    return false;
+  }
+  // A cell's sensitivities to every rate constant are one 64-byte line
+  double *first = sensitivity_storage.data();
+  first += (64 - (uintptr_t)first % 64) % 64 / sizeof(double);
+  for (int f = 0; f < num_fields + num_spares; f++)
+    (f < num_fields ? sensitivity_fields : sensitivity_spares)
+        .push_back(first + f * net::NUM_PARAMS);
+  return true;
+}
 
-      grid[i][j].icm["TNFaR"] = 0;
-      grid[i][j].icm_rates["TNFaR"] = 0;
+inline int cellIndex(int row, int col) { return row * state.cols + col; }
 
-      grid[i][j].icm["NPRA"] = 0;
-      grid[i][j].icm_rates["NPRA"] = 0;
+inline bool validCell(int row, int col) {
+  return row >= 0 && row < state.rows && col >= 0 && col < state.cols;
+}
 
-      grid[i][j].icm["gp130"] = 0;
-      grid[i][j].icm_rates["gp130"] = 0;
+// Map exported molecule indices to species, falling back to the same
+// defaults the original string lookups used
+inline int ecmSpecies(int index) {
+  if (index < 0 || index >= sp::NUM_ECM)
+    index = 0;
+  return sp::FIRST_ECM + index;
+}
 
-      grid[i][j].icm["BAR"] = 0;
-      grid[i][j].icm_rates["BAR"] = 0;
+inline int feedbackSpecies(int index) {
+  if (index < 0 || index >= sp::NUM_FEEDBACK)
+    index = 0;
+  return sp::FIRST_FEEDBACK + index;
+}
 
-      grid[i][j].icm["AT2R"] = 0;
-      grid[i][j].icm_rates["AT2R"] = 0;
+inline int inputSpecies(int index) {
+  if (index < 0 || index >= sp::NUM_INPUTS)
+    return sp::TGFBin;
+  return sp::FIRST_INPUT + index;
+}
 
-      // Initialize second messengers and their rates
-      grid[i][j].icm["NOX"] = 0;
-      grid[i][j].icm_rates["NOX"] = 0;
+inline bool hasInputOverride(int input_species, int cell) {
+  return state.input_override[(size_t)(input_species - sp::FIRST_INPUT) *
+                                  state.num_cells +
+                              cell] != 0;
+}
 
-      grid[i][j].icm["ROS"] = 0;
-      grid[i][j].icm_rates["ROS"] = 0;
+// Active-set block of a cell
+inline int activeBlock(int cell) {
+  return cell / state.cols * active_blocks_per_row +
+         cell % state.cols / ACTIVE_SPAN;
+}
 
-      grid[i][j].icm["DAG"] = 0;
-      grid[i][j].icm_rates["DAG"] = 0;
+// Process a cell's block in the next step
+inline void wakeCell(int cell) {
+  if (!block_active.empty())
+    block_active[activeBlock(cell)] = 1;
+}
 
-      grid[i][j].icm["AC"] = 0;
-      grid[i][j].icm_rates["AC"] = 0;
+// Process every block in the next step, after a change that affects all
+// cells
+inline void wakeAll() {
+  std::fill(block_active.begin(), block_active.end(), 1);
+}
 
-      grid[i][j].icm["cAMP"] = 0;
-      grid[i][j].icm_rates["cAMP"] = 0;
+// Compare a cell's class in every species before the next step, after the
+// cell was edited
+inline void checkClass(int cell) {
+  if (!cell_class.empty())
+    class_check[cell_class[cell]] = 1;
+}
 
-      grid[i][j].icm["cGMP"] = 0;
-      grid[i][j].icm_rates["cGMP"] = 0;
+// Assign an input to every cell that is not brushed with its own value
+void setGridInput(int input_species, double value) {
+  Scalar *in = field(input_species);
+  for (int c = 0; c < state.num_cells; c++) {
+    if (!hasInputOverride(input_species, c))
+      in[c] = value;
+  }
+  wakeAll();
+  regroup_classes = true;
+}
 
-      grid[i][j].icm["Ca"] = 0;
-      grid[i][j].icm_rates["Ca"] = 0;
+// Reset all inputs of a cell to 0 and drop its overrides
+void clearCellInputs(int cell) {
+  for (int k = 0; k < sp::NUM_INPUTS; k++) {
+    state.input_override[(size_t)k * state.num_cells + cell] = 0;
+    field(sp::FIRST_INPUT + k)[cell] = 0;
+  }
+  wakeCell(cell);
+  checkClass(cell);
+}
 
-      grid[i][j].icm["TRPC"] = 0;
-      grid[i][j].icm_rates["TRPC"] = 0;
+// Field of the rate constant for a built-in parameter
+double &rateConstant(int param) {
+  switch (param) {
+  case net::K_INPUT: return rates.k_input;
+  case net::K_FEEDBACK: return rates.k_feedback;
+  case net::K_DEGRADATION: return rates.k_degradation;
+  case net::K_RECEPTOR: return rates.k_receptor;
+  case net::K_INHIBITION: return rates.k_inhibition;
+  case net::K_ACTIVATION: return rates.k_activation;
+  case net::K_PRODUCTION: return rates.k_production;
+  default: return rates.k_diffusion;
+  }
+}
 
-      // Initialize all kinases, phosphatases, and their rates
-      grid[i][j].icm["PKA"] = 0;
-      grid[i][j].icm_rates["PKA"] = 0;
+// Rate constants as the parameter vector used by the network kernels
+void rateParams(double *k) {
+  for (int p = 0; p < net::NUM_PARAMS; p++)
+    k[p] = rateConstant(p);
+}
 
-      grid[i][j].icm["PKG"] = 0;
-      grid[i][j].icm_rates["PKG"] = 0;
+// Reset species declared by the loaded network to their initial values
+void initializeExtraSpecies() {
+  if (!use_program)
+    return;
+  for (size_t i = 0; i < network.extra_species.size(); i++)
+    std::fill_n(field(sp::NUM_SPECIES + (int)i), state.num_cells,
+                network.extra_initial[i]);
+}
 
-      grid[i][j].icm["PKC"] = 0;
-      grid[i][j].icm_rates["PKC"] = 0;
+// Stencil symbols 1 + 2 cos(2 pi m / n) of the n frequencies along one axis
+void stencilSymbols(int n, std::vector<double> &symbols) {
+  symbols.resize(n);
+  for (int m = 0; m < n; m++)
+    symbols[m] = 1.0 + 2.0 * std::cos(2.0 * M_PI * m / n);
+}
 
-      grid[i][j].icm["calcineurin"] = 0;
-      grid[i][j].icm_rates["calcineurin"] = 0;
+// Sparsity of the sensitivity update for the compiled network. Only the
+// rows of species a rate constant can reach carry nonzero sensitivities:
+// a species with a term of its own, or one whose rate depends on such a
+// species. The others, the inputs among them, stay zero, so J S is
+// evaluated over the live rows and columns only. Row r of the update is
+// species rows[r]: its Jacobian entries are [row_offsets[r],
+// row_offsets[r + 1]) with the live species columns[j] they multiply, and
+// its terms [term_rows[r], term_rows[r + 1]) are term_entries, the index
+// of each term in net::networkParamEntries order, with term_params, its
+// rate constant. slots maps each contribution net::networkJacobianEntries
+// emits to its entry, or to the discarded entry columns.size() if it lies
+// outside the live block.
+struct SensitivityPattern {
+  std::vector<int> rows;
+  std::vector<int> row_offsets;
+  std::vector<int> columns;
+  std::vector<int> slots;
+  std::vector<int> term_rows;
+  std::vector<int> term_entries;
+  std::vector<int> term_params;
+};
 
-      grid[i][j].icm["PP1"] = 0;
-      grid[i][j].icm_rates["PP1"] = 0;
+const SensitivityPattern &sensitivityPattern() {
+  static const SensitivityPattern pattern = [] {
+    const int ns = sp::NUM_SPECIES;
+    SensitivityPattern p;
+    double x[sp::NUM_SPECIES] = {};
+    double k[net::NUM_PARAMS] = {};
+    std::vector<std::pair<int, int>> emitted;
+    net::networkJacobianEntries(x, k, [&](int row, int col, double) {
+      emitted.emplace_back(row, col);
+    });
+
+    // (row, entry) of every term and each entry's constant
+    std::vector<std::pair<int, int>> terms;
+    std::vector<int> params;
+    net::networkParamEntries(x, [&](int row, int param, double) {
+      terms.emplace_back(row, (int)terms.size());
+      params.push_back(param);
+    });
+
+    // Live species: the closure of the term targets under the Jacobian
+    std::vector<char> live(ns, 0);
+    for (const std::pair<int, int> &t : terms)
+      live[t.first] = 1;
+    for (bool grown = true; grown;) {
+      grown = false;
+      for (const std::pair<int, int> &e : emitted) {
+        if (live[e.second] && !live[e.first]) {
+          live[e.first] = 1;
+          grown = true;
+        }
+      }
+    }
+    std::vector<int> row_of(ns, -1);
+    for (int s = 0; s < ns; s++) {
+      if (live[s]) {
+        row_of[s] = (int)p.rows.size();
+        p.rows.push_back(s);
+      }
+    }
+    const int nr = (int)p.rows.size();
 
-      // Initialize transcription factors and their rates
-      grid[i][j].icm["CREB"] = 0;
-      grid[i][j].icm_rates["CREB"] = 0;
+    std::vector<std::pair<int, int>> entries;
+    for (const std::pair<int, int> &e : emitted) {
+      if (live[e.first] && live[e.second])
+        entries.emplace_back(row_of[e.first], e.second);
+    }
+    std::sort(entries.begin(), entries.end());
+    entries.erase(std::unique(entries.begin(), entries.end()), entries.end());
+    p.row_offsets.assign(nr + 1, 0);
+    for (const std::pair<int, int> &e : entries) {
+      p.row_offsets[e.first + 1]++;
+      p.columns.push_back(e.second);
+    }
+    for (int r = 0; r < nr; r++)
+      p.row_offsets[r + 1] += p.row_offsets[r];
+    for (const std::pair<int, int> &e : emitted) {
+      int slot = (int)entries.size();
+      if (live[e.first] && live[e.second]) {
+        const std::pair<int, int> key(row_of[e.first], e.second);
+        slot = (int)(std::lower_bound(entries.begin(), entries.end(), key) -
+                     entries.begin());
+      }
+      p.slots.push_back(slot);
+    }
 
-      grid[i][j].icm["CBP"] = 0;
-      grid[i][j].icm_rates["CBP"] = 0;
+    for (std::pair<int, int> &t : terms)
+      t.first = row_of[t.first];
+    std::sort(terms.begin(), terms.end());
+    p.term_rows.assign(nr + 1, 0);
+    for (const std::pair<int, int> &t : terms) {
+      p.term_rows[t.first + 1]++;
+      p.term_entries.push_back(t.second);
+      p.term_params.push_back(params[t.second]);
+    }
+    for (int r = 0; r < nr; r++)
+      p.term_rows[r + 1] += p.term_rows[r];
+    return p;
+  }();
+  return pattern;
+}
 
-      grid[i][j].icm["NFAT"] = 0;
-      grid[i][j].icm_rates["NFAT"] = 0;
+// Per-thread doubles of the sensitivity scratch: species, Jacobian (one
+// value per live entry plus the discarded one) and d(rate)/d(k) tiles, a
+// block's d(S)/dt over the live rows, then two grid rows
+size_t sensitivityScratch() {
+  const SensitivityPattern &pattern = sensitivityPattern();
+  return (sp::NUM_SPECIES + pattern.columns.size() + 1 +
+          pattern.term_entries.size()) *
+             (size_t)SENSITIVITY_TILE +
+         (size_t)SENSITIVITY_BLOCK * pattern.rows.size() * net::NUM_PARAMS +
+         2 * (size_t)state.cols;
+}
 
-      grid[i][j].icm["AP1"] = 0;
-      grid[i][j].icm_rates["AP1"] = 0;
+// Per-thread scratch: the compiled kernel's input tile followed by the rate
+// tile of every species and, for the adaptive integrators, the state and
+// stage tiles plus per-cell time, step, proposed step and error. The
+// spectral scheme adds its plans, one field and a column per thread, and
+// sensitivities the tiles of advanceSensitivities and two grid rows. False
+// if they do not fit in memory, in which case the grid-sized buffers are
+// released and the caller must not step until a call succeeds.
+bool allocateScratch() {
+  const size_t stage_tile = (size_t)state.num_species * STAGE_TILE;
+  const bool spectral =
+      diffusionScheme() == SPECTRAL_DIFFUSION && state.num_cells > 0;
+  try {
+    size_t spectral_size = 0;
+    if (spectral) {
+      fft_row.prepare(state.cols);
+      fft_column.prepare(state.rows);
+      stencilSymbols(state.cols, symbol_row);
+      stencilSymbols(state.rows, symbol_column);
+      spectral_field.assign(state.num_cells, 0.0);
+      spectral_size = 3 * (size_t)state.rows +
+                      std::max(fft_row.workSize(), fft_column.workSize());
+    } else {
+      std::vector<Scalar>().swap(spectral_field);
+    }
+    // Size the ADI factorizations now so steps only refill them
+    if (diffusionScheme() == ADI_DIFFUSION && state.num_cells > 0) {
+      adi_row.prepare(state.cols, 1.0);
+      adi_column.prepare(state.rows, 1.0);
+    }
 
-      grid[i][j].icm["STAT"] = 0;
-      grid[i][j].icm_rates["STAT"] = 0;
+    scratch.resize(pool.size());
+    for (ThreadScratch &ts : scratch) {
+      ts.tile.assign(
+          (size_t)(sp::NUM_SPECIES + state.num_species) * RATE_TILE, 0.0);
+      if (integrator == EULER)
+        std::vector<double>().swap(ts.stages);
+      else
+        ts.stages.assign((2 + MAX_STAGES) * stage_tile + 4 * STAGE_TILE, 0.0);
+      ts.inputs.assign(state.num_species, nullptr);
+      ts.line.assign(state.cols, 0.0);
+      ts.spectral.assign(spectral_size, 0.0);
+      ts.cell.assign(2 * (size_t)state.num_species, 0.0);
+      if (sensitivity_storage.empty())
+        std::vector<double>().swap(ts.sensitivity);
+      else
+        ts.sensitivity.assign(sensitivityScratch(), 0.0);
+    }
+  } catch (const std::bad_alloc &) {
+    std::vector<Scalar>().swap(spectral_field);
+    for (ThreadScratch &ts : scratch) {
+      std::vector<double>().swap(ts.line);
+      std::vector<double>().swap(ts.spectral);
+      std::vector<double>().swap(ts.sensitivity);
+    }
+    return false;
+  }
+  return true;
+}
 
-      grid[i][j].icm["NFKB"] = 0;
-      grid[i][j].icm_rates["NFKB"] = 0;
+// Release the grid and every per-cell buffer, leaving no grid
+void releaseGrid() {
+  std::vector<Scalar>().swap(state.storage);
+  std::vector<unsigned char>().swap(state.input_override);
+  std::vector<double>().swap(cell_step);
+  std::vector<double>().swap(sensitivity_storage);
+  sensitivity_fields.clear();
+  sensitivity_spares.clear();
+  block_active.clear();
+  block_moving.clear();
+  block_change.clear();
+  cell_class.clear();
+  regroup_classes = true;
+  state.rows = state.cols = state.num_cells = 0;
+  grid_members = 1;
+}
 
-      grid[i][j].icm["SRF"] = 0;
-      grid[i][j].icm_rates["SRF"] = 0;
+// Grow or shrink the state to num_species fields. Fields of the species
+// that remain and the diffusing spares keep their values; the extra species
+// a loaded network declares start at their initial values. If the scratch
+// space for the new species does not fit in memory, the grid is released
+// as if initializeGrid had failed.
+void resizeSpecies(int num_species) {
+  const int old_species = state.num_species;
+  state.num_species = num_species;
+  regroup_classes = true;
+  if (!allocateScratch()) {
+    releaseGrid();
+    allocateScratch();
+  }
+  if (state.storage.empty())
+    return; // Allocated by initializeGrid
+
+  const size_t n = state.num_cells;
+  std::vector<Scalar> storage((size_t)(num_species + NUM_DIFFUSING) * n);
+  const Scalar *old = state.storage.data();
+  std::copy(old, old + (size_t)std::min(old_species, num_species) * n,
+            storage.data());
+  std::copy(old + (size_t)old_species * n,
+            old + (size_t)(old_species + NUM_DIFFUSING) * n,
+            storage.data() + (size_t)num_species * n);
+  state.storage.swap(storage);
+
+  bindFields();
+  initializeExtraSpecies();
+}
 
-      grid[i][j].icm["MRTF"] = 0;
-      grid[i][j].icm_rates["MRTF"] = 0;
+// Compiled ODE rules from ecm_network.h for one cell or one lane of cells:
+// every rate, or only the rates of species [First, First + Count)
+template <int First, int Count, typename T>
+inline void kernelRates(const T *x, const T *k, T *dxdt) {
+  if constexpr (First == 0 && Count == sp::NUM_SPECIES)
+    net::networkRates(x, k, dxdt);
+  else
+    net::networkRatesOf<First, Count>(x, k, dxdt);
+}
 
-      // Initialize MAPK pathway components and their rates
-      grid[i][j].icm["Ras"] = 0;
-      grid[i][j].icm_rates["Ras"] = 0;
+// Compiled ODE rules from ecm_network.h for n cells of a species-by-cell
+// tile: species s of cell i is read from x[s * stride + i] and its rate
+// written to dxdt[s * stride + i], for species [First, First + Count). T is
+// the arithmetic type, double or float. On an ensemble grid cell i of the
+// tile is grid cell first + i and takes its member's rate constants.
+template <int First = 0, int Count = sp::NUM_SPECIES, typename T>
+void kernelTile(const T *x, T *dxdt, size_t stride, int n, int first = 0) {
+  typedef typename simd::LanesOf<T>::type Lanes;
+  const int lanes = simd::LanesOf<T>::width;
+  const int members = grid_members;
+
+  double params[net::NUM_PARAMS];
+  rateParams(params);
+
+  T k[net::NUM_PARAMS];
+  Lanes kv[net::NUM_PARAMS];
+  Lanes xv[sp::NUM_SPECIES];
+  Lanes dxdtv[sp::NUM_SPECIES];
+  for (int p = 0; p < net::NUM_PARAMS; p++) {
+    k[p] = params[p];
+    kv[p] = Lanes(k[p]);
+  }
 
-      grid[i][j].icm["Raf"] = 0;
-      grid[i][j].icm_rates["Raf"] = 0;
+  // Rate constants of the member of tile cell i
+  auto memberRates = [&](int i) {
+    return member_rates.data() +
+           (size_t)((first + i) % members) * net::NUM_PARAMS;
+  };
+
+  T xs[sp::NUM_SPECIES];
+  T dxdts[sp::NUM_SPECIES];
+
+  // lanes cells per kernel call. The lanes' rate constants only depend on
+  // the member of the first lane, so they are gathered again only when it
+  // changes, once per tile when members is a multiple of lanes.
+  int kv_member = -1;
+  int i = 0;
+  for (; i + lanes <= n; i += lanes) {
+    for (int s = 0; s < sp::NUM_SPECIES; s++)
+      xv[s] = Lanes::load(x + s * stride + i);
+    if (members > 1 && (first + i) % members != kv_member) {
+      kv_member = (first + i) % members;
+      const double *lane_rates[lanes];
+      for (int w = 0; w < lanes; w++)
+        lane_rates[w] = memberRates(i + w);
+      for (int p = 0; p < net::NUM_PARAMS; p++) {
+        T lane_k[lanes];
+        for (int w = 0; w < lanes; w++)
+          lane_k[w] = lane_rates[w][p];
+        kv[p] = Lanes::load(lane_k);
+      }
+    }
 
-      grid[i][j].icm["MEK1"] = 0;
-      grid[i][j].icm_rates["MEK1"] = 0;
+    kernelRates<First, Count>(xv, kv, dxdtv);
 
-      grid[i][j].icm["ERK"] = 0;
-      grid[i][j].icm_rates["ERK"] = 0;
+    for (int s = First; s < First + Count; s++)
+      dxdtv[s].store(dxdt + s * stride + i);
+  }
 
-      grid[i][j].icm["p38"] = 0;
-      grid[i][j].icm_rates["p38"] = 0;
+  // Scalar tail for the cells left over
+  for (; i < n; i++) {
+    for (int s = 0; s < sp::NUM_SPECIES; s++)
+      xs[s] = x[s * stride + i];
+    if (members > 1)
+      std::copy(memberRates(i), memberRates(i) + net::NUM_PARAMS, k);
 
-      grid[i][j].icm["JNK"] = 0;
-      grid[i][j].icm_rates["JNK"] = 0;
+    kernelRates<First, Count>(xs, k, dxdts);
 
-      grid[i][j].icm["MKK3"] = 0;
-      grid[i][j].icm_rates["MKK3"] = 0;
+    for (int s = First; s < First + Count; s++)
+      dxdt[s * stride + i] = dxdts[s];
+  }
+}
 
-      grid[i][j].icm["MKK4"] = 0;
-      grid[i][j].icm_rates["MKK4"] = 0;
+// Copy species fields into out, see snapshotFields
+template <typename T>
+int snapshot(const int *species, int count, T *out) {
+  for (int i = 0; i < count; i++) {
+    if (species[i] < 0 || species[i] >= state.num_species)
+      return 0;
+  }
+  const size_t n = state.num_cells;
+  PhaseTimer timer(PROFILE_READBACK);
+  timer.cells = (double)count * n;
+  pool.runRows(count, [&](int begin, int end, int) {
+    for (int i = begin; i < end; i++)
+      std::copy(field(species[i]), field(species[i]) + n, out + i * n);
+  });
+  return (int)(count * n);
+}
 
-      grid[i][j].icm["MEKK1"] = 0;
-      grid[i][j].icm_rates["MEKK1"] = 0;
+// Rates of change of a single cell with species values x, computed in T
+template <typename T> void cellRates(const T *x, T *dxdt) {
+  if (!use_program) {
+    double params[net::NUM_PARAMS];
+    rateParams(params);
+    T k[net::NUM_PARAMS];
+    std::copy(params, params + net::NUM_PARAMS, k);
+    net::networkRates(x, k, dxdt);
+    return;
+  }
+  std::vector<const T *> inputs(state.num_species);
+  for (int s = 0; s < state.num_species; s++)
+    inputs[s] = x + s;
+  runNetworkProgram(network, network_coefs.data(), inputs.data(), dxdt, 1, 0,
+                    1);
+}
 
-      grid[i][j].icm["ASK1"] = 0;
-      grid[i][j].icm_rates["ASK1"] = 0;
+// Species values of one cell
+template <typename T> void gatherCell(int cell, T *x) {
+  for (int s = 0; s < state.num_species; s++)
+    x[s] = field(s)[cell];
+}
 
-      grid[i][j].icm["TRAF"] = 0;
-      grid[i][j].icm_rates["TRAF"] = 0;
+// 8-neighbor Laplacian at column j of the middle of three rows, where l and
+// r are the columns left and right of j
+template <typename T>
+inline T laplacian8(const T *up, const T *mid, const T *down, int l, int j,
+                    int r) {
+  const T center = mid[j];
+  T laplacian = 0.0;
+  laplacian += up[l] - center;
+  laplacian += up[j] - center;
+  laplacian += up[r] - center;
+  laplacian += mid[l] - center;
+  laplacian += mid[r] - center;
+  laplacian += down[l] - center;
+  laplacian += down[j] - center;
+  laplacian += down[r] - center;
+  return laplacian;
+}
 
-      // Initialize PI3K-Akt-mTOR pathway components and their rates
-      grid[i][j].icm["PI3K"] = 0;
-      grid[i][j].icm_rates["PI3K"] = 0;
+// d(S)/dt = J S + df/dk of the B cells of a tile from its cell i on, from
+// the tile's Jacobian and d(rate)/d(k) contributions, into
+// dsdt[(q * rows + r) * NUM_PARAMS + p] for the q-th cell and live row r
+// (see SensitivityPattern). Summing the rows of several cells together
+// keeps as many sums in flight.
+template <int B>
+void sensitivityRates(const double *jac, const double *dfdk, int tile, int i,
+                      double *dsdt) {
+  typedef simd::LanesOf<double>::type Lanes;
+  const int lanes = simd::LanesOf<double>::width;
+  const int np = net::NUM_PARAMS;
+  const int tile_size = SENSITIVITY_TILE;
+  const SensitivityPattern &pattern = sensitivityPattern();
+  const int nr = (int)pattern.rows.size();
+  const int *offsets = pattern.row_offsets.data();
+  const int *columns = pattern.columns.data();
+  double *const *sens = sensitivity_fields.data();
+  const size_t stride = sensitivity_stride;
+  const size_t c = (size_t)(tile + i) * stride;
+
+  for (int r = 0; r < nr; r++) {
+    for (int p = 0; p < np; p += lanes) {
+      Lanes sum[B];
+      for (int q = 0; q < B; q++)
+        sum[q] = Lanes(0.0);
+      for (int j = offsets[r]; j < offsets[r + 1]; j++) {
+        const double *value = jac + (size_t)j * tile_size + i;
+        const double *column = sens[columns[j]] + c + p;
+        for (int q = 0; q < B; q++)
+          sum[q] = sum[q] + Lanes(value[q]) * Lanes::load(column + q * stride);
+      }
+      for (int q = 0; q < B; q++)
+        sum[q].store(dsdt + (size_t)(q * nr + r) * np + p);
+    }
+    for (int t = pattern.term_rows[r]; t < pattern.term_rows[r + 1]; t++) {
+      const double *value =
+          dfdk + (size_t)pattern.term_entries[t] * tile_size + i;
+      for (int q = 0; q < B; q++)
+        dsdt[(size_t)(q * nr + r) * np + pattern.term_params[t]] += value[q];
+    }
+  }
+}
 
-      grid[i][j].icm["Akt"] = 0;
-      grid[i][j].icm_rates["Akt"] = 0;
+// Checkpoint format (saveCheckpoint), version 1. Little-endian, as written
+// by every supported target (x86, ARM, WebAssembly): this header, then
+// blocks at the offsets it lists, each 64-byte aligned so a mapped file can
+// be used in place:
+//   params     num_params doubles: the 8 rate constants in getParameter
+//              order, the time step, then the loaded network's own
+//              parameters
+//   fields     num_species fields of rows * cols values of field_bytes
+//              bytes, species-major, row-major, as getFieldView returns them
+//   overrides  num_inputs bytes per cell, input-major: 1 if the cell's input
+//              is brushed
+//   steps      rows * cols doubles, the adaptive integrators' last step per
+//              cell; only if steps_offset is nonzero
+const char CHECKPOINT_MAGIC[8] = {'E', 'C', 'M', 'S', 'I', 'M', 'C', 'P'};
+const uint32_t CHECKPOINT_VERSION = 1;
+const uint64_t CHECKPOINT_ALIGN = 64;
+
+struct CheckpointHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t field_bytes;
+  int32_t rows;
+  int32_t cols;
+  int32_t num_species;
+  int32_t num_inputs;
+  int32_t num_params;
+  int32_t feedback_count; // Steps into the feedback diffusion window
+  int32_t ecm_count;      // Steps into the ECM diffusion window
+  int32_t reserved;
+  double simulation_time;
+  double feedback_elapsed; // Time covered by the feedback window
+  double feedback_lead;    // Diffusion applied at its start
+  double ecm_elapsed;
+  double ecm_lead;
+  uint64_t params_offset;
+  uint64_t fields_offset;
+  uint64_t overrides_offset;
+  uint64_t steps_offset;
+  uint64_t size; // Bytes of the whole checkpoint
+};
+static_assert(sizeof(CheckpointHeader) == 128,
+              "checkpoint header layout must not change");
 
-      grid[i][j].icm["mTORC1"] = 0;
-      grid[i][j].icm_rates["mTORC1"] = 0;
+// Reason the last saveCheckpoint or loadCheckpoint failed
+std::string checkpoint_error;
 
-      grid[i][j].icm["mTORC2"] = 0;
-      grid[i][j].icm_rates["mTORC2"] = 0;
+inline uint64_t checkpointAlign(uint64_t offset) {
+  return (offset + CHECKPOINT_ALIGN - 1) / CHECKPOINT_ALIGN * CHECKPOINT_ALIGN;
+}
 
-      grid[i][j].icm["p70S6K"] = 0;
-      grid[i][j].icm_rates["p70S6K"] = 0;
+// Parameters a checkpoint stores beyond the rate constants and time step
+inline int extraParams() {
+  return use_program ? (int)network_params.size() - net::NUM_PARAMS : 0;
+}
 
-      grid[i][j].icm["EBP1"] = 0;
-      grid[i][j].icm_rates["EBP1"] = 0;
+// Header of a checkpoint of the current state
+CheckpointHeader checkpointHeader() {
+  CheckpointHeader h = {};
+  memcpy(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic));
+  h.version = CHECKPOINT_VERSION;
+  h.field_bytes = sizeof(Scalar);
+  h.rows = state.rows;
+  h.cols = state.cols;
+  h.num_species = state.num_species;
+  h.num_inputs = sp::NUM_INPUTS;
+  h.num_params = net::NUM_PARAMS + 1 + extraParams();
+  h.feedback_count = feedback_clock.count;
+  h.ecm_count = ecm_clock.count;
+  h.simulation_time = simulation_time;
+  h.feedback_elapsed = feedback_clock.elapsed;
+  h.feedback_lead = feedback_clock.lead;
+  h.ecm_elapsed = ecm_clock.elapsed;
+  h.ecm_lead = ecm_clock.lead;
+
+  const uint64_t cells = (uint64_t)state.num_cells;
+  h.params_offset = checkpointAlign(sizeof(CheckpointHeader));
+  h.fields_offset =
+      checkpointAlign(h.params_offset + (uint64_t)h.num_params * 8);
+  h.overrides_offset = checkpointAlign(
+      h.fields_offset + (uint64_t)h.num_species * cells * h.field_bytes);
+  h.size = h.overrides_offset + (uint64_t)h.num_inputs * cells;
+  if (!cell_step.empty()) {
+    h.steps_offset = checkpointAlign(h.size);
+    h.size = h.steps_offset + cells * sizeof(double);
+  }
+  return h;
+}
 
-      // Initialize Rho/ROCK pathway components and their rates
-      grid[i][j].icm["Rho"] = 0;
-      grid[i][j].icm_rates["Rho"] = 0;
+// Release the grid and allocate a zeroed rows x cols one with every
+// per-cell buffer, cols counting every member of an ensemble of members.
+// False, with no grid, if it does not fit in memory.
+bool allocateGrid(int rows, int cols, int members = 1) {
+  using namespace sp;
+
+  // All molecules start at zero, inputs carry no overrides
+  releaseGrid();
+  if ((long long)rows * cols > INT_MAX)
+    return false;
+  const size_t num_cells = (size_t)rows * cols;
+  try {
+    state.storage.assign((size_t)(state.num_species + NUM_DIFFUSING) *
+                             num_cells,
+                         0.0);
+    state.input_override.assign((size_t)NUM_INPUTS * num_cells, 0);
+    cell_step.assign(integrator == EULER ? 0 : num_cells, 0.0);
+    active_blocks_per_row = (cols + ACTIVE_SPAN - 1) / ACTIVE_SPAN;
+    block_active.assign((size_t)rows * active_blocks_per_row, 1);
+    block_moving.assign(block_active.size(), 0);
+    block_change.assign(block_active.size(), 0.0);
+  } catch (const std::bad_alloc &) {
+    std::vector<Scalar>().swap(state.storage);
+    std::vector<unsigned char>().swap(state.input_override);
+    std::vector<double>().swap(cell_step);
+    return false;
+  }
+  state.rows = rows;
+  state.cols = cols;
+  state.num_cells = (int)num_cells;
+  grid_members = members;
+  member_overrides.assign((size_t)members * net::NUM_PARAMS, NAN);
+  member_rates.assign((size_t)members * net::NUM_PARAMS, 0.0);
+  member_diffusion.assign(2 * (size_t)cols, 0.0);
+  std::fill_n(state.swapped, NUM_DIFFUSING, false);
+  bindFields();
+  feedback_clock = DiffusionClock{feedback_clock.interval};
+  ecm_clock = DiffusionClock{ecm_clock.interval};
+  simulation_time = 0.0;
+
+  // Use every core unless setThreadCount chose otherwise
+  if (!threads_configured)
+    pool.resize(0);
+  allocateSensitivities();
+  if (!allocateScratch()) {
+    releaseGrid();
+    allocateScratch();
+    return false;
+  }
+  return true;
+}
 
-      grid[i][j].icm["ROCK"] = 0;
-      grid[i][j].icm_rates["ROCK"] = 0;
+extern "C" {
 
-      grid[i][j].icm["RhoGEF"] = 0;
-      grid[i][j].icm_rates["RhoGEF"] = 0;
+// Initialize all molecules in a rows x cols grid (100 x 100 if either is not
+// positive), with the members set by setEnsembleSize. Returns 1 on success,
+// 0 if the grid is too large to allocate, in which case the previous grid is
+// released.
+EMSCRIPTEN_KEEPALIVE
+int initializeGrid(int rows = DEFAULT_GRID_SIZE, int cols = DEFAULT_GRID_SIZE) {
+  using namespace sp;
 
-      grid[i][j].icm["RhoGDI"] = 0;
-      grid[i][j].icm_rates["RhoGDI"] = 0;
+  if (rows <= 0 || cols <= 0) {
+    rows = DEFAULT_GRID_SIZE;
+    cols = DEFAULT_GRID_SIZE;
+  }
 
-      // Initialize cytoskeleton and adhesion components and their rates
-      grid[i][j].icm["Factin"] = 0;
-      grid[i][j].icm_rates["Factin"] = 0;
+  // Seed the random number generator
+  srand(random_seed ? random_seed : (unsigned)time(NULL));
+
+  const int members = ensemble_size;
+  if ((long long)cols * members > INT_MAX ||
+      !allocateGrid(rows, cols * members, members))
+    return 0;
+
+  // Start with 100% G-actin
+  std::fill_n(field(Gactin), state.num_cells, 1.0);
+
+  // Initialize ECM molecules with random values (0.0-0.9), drawn in the
+  // historical per-cell order so a given seed reproduces earlier runs. The
+  // members of a cell start alike, as in separate runs with the same seed.
+  static const int random_ecm[] = {
+      proCI_ecm,    proCIII_ecm,  fibronectin_ecm, periostin_ecm,
+      TNC_ecm,      PAI1_ecm,     CTGF_ecm,        EDAFN_ecm,
+      proMMP1_ecm,  proMMP2_ecm,  proMMP3_ecm,     proMMP8_ecm,
+      proMMP9_ecm,  proMMP12_ecm, proMMP14_ecm,    TIMP1_ecm,
+      TIMP2_ecm};
+  for (int c = 0; c < state.num_cells; c += members) {
+    for (int s : random_ecm) {
+      std::fill_n(field(s) + c, members, (rand() % 10) / 10.0);
+    }
+  }
 
-      grid[i][j].icm["Gactin"] = 1.0; // Start with 100% G-actin
-      grid[i][j].icm_rates["Gactin"] = 0;
+  initializeExtraSpecies();
+  return 1;
+}
 
-      grid[i][j].icm["B1int"] = 0;
-      grid[i][j].icm_rates["B1int"] = 0;
+// Seed the next initializeGrid draws the random ECM values from, so runs
+// repeat exactly. 0 (the default) seeds from the clock.
+EMSCRIPTEN_KEEPALIVE
+void setRandomSeed(unsigned seed) { random_seed = seed; }
 
-      grid[i][j].icm["B3int"] = 0;
-      grid[i][j].icm_rates["B3int"] = 0;
+// Grid dimensions set by initializeGrid
+EMSCRIPTEN_KEEPALIVE
+int getGridRows() { return state.rows; }
 
-      grid[i][j].icm["FAK"] = 0;
-      grid[i][j].icm_rates["FAK"] = 0;
+// Columns of the grid; on an ensemble grid every cell counts once per member
+EMSCRIPTEN_KEEPALIVE
+int getGridCols() { return state.cols; }
+
+// Resolve the rate constants of every ensemble member, and the diffusion
+// rate of every wide column from them, into the arrays allocateGrid sized
+void prepareMembers() {
+  const int members = grid_members;
+  for (int m = 0; m < members; m++) {
+    for (int p = 0; p < net::NUM_PARAMS; p++) {
+      const double value = member_overrides[(size_t)m * net::NUM_PARAMS + p];
+      member_rates[(size_t)m * net::NUM_PARAMS + p] =
+          std::isnan(value) ? rateConstant(p) : value;
+    }
+  }
 
-      grid[i][j].icm["Src"] = 0;
-      grid[i][j].icm_rates["Src"] = 0;
+  // ECM molecules diffuse at 20% of the feedback molecule rate
+  const int cols = state.cols;
+  for (int j = 0; j < cols; j++) {
+    const double k_diffusion =
+        member_rates[(size_t)(j % members) * net::NUM_PARAMS +
+                     net::K_DIFFUSION];
+    member_diffusion[j] = k_diffusion;
+    member_diffusion[cols + j] = k_diffusion * 0.2;
+  }
+}
 
-      grid[i][j].icm["Grb2"] = 0;
-      grid[i][j].icm_rates["Grb2"] = 0;
+// Resolve the ensemble members' rate constants and the loaded program's
+// coefficients from the current rate constants. Called once per step,
+// before the threads start on their cells; allocates nothing.
+void prepareRates() {
+  if (grid_members > 1)
+    prepareMembers();
+  if (!use_program)
+    return;
+  rateParams(network_params.data());
+  resolveCoefficients(network, network_params.data(), network_coefs.data());
+}
 
-      grid[i][j].icm["p130Cas"] = 0;
-      grid[i][j].icm_rates["p130Cas"] = 0;
+// Calculate rates of change for cells [begin, end), at most RATE_TILE of
+// them, either with the loaded network program or the compiled ODE rules in
+// ecm_network.h. Returns the calling thread's rate tile: the rate of species
+// s in cell begin + i is at [s * RATE_TILE + i].
+const RateScalar *calculateRates(int begin, int end, int thread) {
+  RateScalar *xt = scratch[thread].tile.data();
+  RateScalar *rt = xt + (size_t)sp::NUM_SPECIES * RATE_TILE;
+
+  if (use_program) {
+    runNetworkProgram(network, network_coefs.data(), state.fields.data(), rt,
+                      RATE_TILE, begin, end);
+    return rt;
+  }
 
-      grid[i][j].icm["Rac1"] = 0;
-      grid[i][j].icm_rates["Rac1"] = 0;
+  // Copy the tile in, one contiguous run per species
+  const int n = end - begin;
+  for (int s = 0; s < sp::NUM_SPECIES; s++)
+    std::copy(field(s) + begin, field(s) + end, xt + s * RATE_TILE);
 
-      grid[i][j].icm["abl"] = 0;
-      grid[i][j].icm_rates["abl"] = 0;
+  kernelTile(xt, rt, RATE_TILE, n, begin);
+  return rt;
+}
 
-      grid[i][j].icm["talin"] = 0;
-      grid[i][j].icm_rates["talin"] = 0;
+// Rates of change for n cells of a STAGE_TILE-wide species-by-cell tile,
+// holding grid cells [first, first + n)
+void stageRates(const double *x, double *dxdt, int n, int first, int thread) {
+  if (!use_program) {
+    kernelTile(x, dxdt, STAGE_TILE, n, first);
+    return;
+  }
+  const double **inputs = scratch[thread].inputs.data();
+  for (int s = 0; s < state.num_species; s++)
+    inputs[s] = x + (size_t)s * STAGE_TILE;
+  runNetworkProgram(network, network_coefs.data(), inputs, dxdt, STAGE_TILE,
+                    0, n);
+}
 
-      grid[i][j].icm["vinculin"] = 0;
-      grid[i][j].icm_rates["vinculin"] = 0;
+// Analytic Jacobian of a single cell with species values x, in the CSR
+// pattern (values holds jacobian_columns.size() entries). The pattern must
+// be built and, for a loaded network, prepareRates() called.
+void cellJacobian(const double *x, double *values) {
+  std::fill_n(values, jacobian_columns.size(), 0.0);
+  const int *slots = jacobian_slots.data();
+  if (use_program) {
+    networkProgramJacobian(network, network_coefs.data(), x, slots, values);
+    return;
+  }
+  double k[net::NUM_PARAMS];
+  rateParams(k);
+  size_t e = 0;
+  net::networkJacobianEntries(x, k, [&](int, int, double value) {
+    values[slots[e++]] += value;
+  });
+}
 
-      grid[i][j].icm["paxillin"] = 0;
-      grid[i][j].icm_rates["paxillin"] = 0;
+// Butcher tableau of an embedded Runge-Kutta pair. b are the weights of the
+// solution that is kept and e the difference to the embedded solution's
+// weights, so h * sum(e[j] * k[j]) estimates the local error.
+struct Tableau {
+  int stages;
+  int order; // Order of the error estimate plus one, for step size control
+  double a[MAX_STAGES][MAX_STAGES];
+  double b[MAX_STAGES];
+  double e[MAX_STAGES];
+};
 
-      grid[i][j].icm["FA"] = 0;
-      grid[i][j].icm_rates["FA"] = 0;
+const Tableau BS32 = {
+    4,
+    3,
+    {{0},
+     {1.0 / 2},
+     {0, 3.0 / 4},
+     {2.0 / 9, 1.0 / 3, 4.0 / 9}},
+    {2.0 / 9, 1.0 / 3, 4.0 / 9, 0},
+    {2.0 / 9 - 7.0 / 24, 1.0 / 3 - 1.0 / 4, 4.0 / 9 - 1.0 / 3, -1.0 / 8}};
+
+const Tableau DP54 = {
+    7,
+    5,
+    {{0},
+     {1.0 / 5},
+     {3.0 / 40, 9.0 / 40},
+     {44.0 / 45, -56.0 / 15, 32.0 / 9},
+     {19372.0 / 6561, -25360.0 / 2187, 64448.0 / 6561, -212.0 / 729},
+     {9017.0 / 3168, -355.0 / 33, 46732.0 / 5247, 49.0 / 176,
+      -5103.0 / 18656},
+     {35.0 / 384, 0, 500.0 / 1113, 125.0 / 192, -2187.0 / 6784, 11.0 / 84}},
+    {35.0 / 384, 0, 500.0 / 1113, 125.0 / 192, -2187.0 / 6784, 11.0 / 84, 0},
+    {35.0 / 384 - 5179.0 / 57600, 0, 500.0 / 1113 - 7571.0 / 16695,
+     125.0 / 192 - 393.0 / 640, -2187.0 / 6784 + 92097.0 / 339200,
+     11.0 / 84 - 187.0 / 2100, -1.0 / 40}};
+
+// Integrate the reactions of cells [begin, end) over delta_t with the
+// adaptive Runge-Kutta pair of the current integrator.
+//
+// Every cell carries its own time and step size, so a cell right after a
+// stimulus takes many small steps while a cell near steady state covers
+// delta_t in one. The cells of a tile advance together in rounds; a round
+// evaluates every stage for the whole tile (cells that already reached
+// delta_t take a zero step), then accepts or rejects each cell's step on its
+// own scaled error. Stage inputs and accepted values are clamped to [0, 1]
+// like the Euler update; without the clamp on stage inputs, species held at a
+// bound overshoot within a step and the error estimate misses it. Clamping
+// also means the first-same-as-last stage of Dormand-Prince is not reused.
+// The step size a cell ends on is its first guess in the next call; cells
+// without one start at rates.time_step. change, if given, is raised to the
+// largest change of a value.
+void integrateCells(int begin, int end, double delta_t, int thread,
+                    bool to_spare, double *change) {
+  const Tableau &tableau = integrator == BOGACKI_SHAMPINE ? BS32 : DP54;
+  const int ns = state.num_species;
+  const size_t tile_size = (size_t)ns * STAGE_TILE;
+
+  double *y = scratch[thread].stages.data(); // State of every cell
+  double *y_new = y + tile_size;             // Stage input, then new state
+  double *stage = y_new + tile_size;         // k[j] at stage + j * tile_size
+  double *t = stage + MAX_STAGES * tile_size; // Time reached
+  double *h = t + STAGE_TILE;                 // Step of this round
+  double *h_next = h + STAGE_TILE;            // Proposed next step
+  double *error = h_next + STAGE_TILE;        // Scaled error norm
+
+  const double first_step =
+      rates.time_step > 0.0 ? std::min(rates.time_step, delta_t) : delta_t;
+  const double min_step = delta_t * 1e-9;
+  const double exponent = -1.0 / tableau.order;
+
+  for (int tile = begin; tile < end; tile += STAGE_TILE) {
+    const int n = std::min(STAGE_TILE, end - tile);
+    for (int s = 0; s < ns; s++)
+      std::copy(field(s) + tile, field(s) + tile + n, y + (size_t)s * STAGE_TILE);
+    for (int i = 0; i < n; i++) {
+      t[i] = 0.0;
+      h_next[i] = cell_step[tile + i] > 0.0 ? cell_step[tile + i] : first_step;
+    }
 
-      grid[i][j].icm["MLC"] = 0;
-      grid[i][j].icm_rates["MLC"] = 0;
+    for (;;) {
+      // Step each unfinished cell, shortened to end exactly at delta_t
+      bool done = true;
+      for (int i = 0; i < n; i++) {
+        const double left = delta_t - t[i];
+        h[i] = left > 0.0 ? std::min(h_next[i], left) : 0.0;
+        done = done && h[i] == 0.0;
+      }
+      if (done)
+        break;
+
+      for (int j = 0; j < tableau.stages; j++) {
+        const double *input = y;
+        if (j > 0) {
+          for (size_t v = 0; v < tile_size; v += STAGE_TILE) {
+            for (int i = 0; i < n; i++) {
+              double sum = 0.0;
+              for (int l = 0; l < j; l++)
+                sum += tableau.a[j][l] * stage[l * tile_size + v + i];
+              y_new[v + i] =
+                  std::max(0.0, std::min(1.0, y[v + i] + h[i] * sum));
+            }
+          }
+          input = y_new;
+        }
+        stageRates(input, stage + j * tile_size, n, tile, thread);
+      }
 
-      grid[i][j].icm["contractility"] = 0;
-      grid[i][j].icm_rates["contractility"] = 0;
+      // New state and the largest error relative to the tolerance
+      std::fill_n(error, n, 0.0);
+      for (size_t v = 0; v < tile_size; v += STAGE_TILE) {
+        for (int i = 0; i < n; i++) {
+          double sum = 0.0;
+          double err = 0.0;
+          for (int l = 0; l < tableau.stages; l++) {
+            sum += tableau.b[l] * stage[l * tile_size + v + i];
+            err += tableau.e[l] * stage[l * tile_size + v + i];
+          }
+          const double old_value = y[v + i];
+          const double value = old_value + h[i] * sum;
+          const double scale =
+              tolerance *
+              (1.0 + std::max(std::fabs(old_value), std::fabs(value)));
+          error[i] = std::max(error[i], std::fabs(h[i] * err) / scale);
+          y_new[v + i] = value;
+        }
+      }
 
-      // Initialize YAP/TAZ signaling components and their rates
-      grid[i][j].icm["YAP"] = 0;
-      grid[i][j].icm_rates["YAP"] = 0;
+      // Accept or reject each cell's step and adapt its step size
+      for (int i = 0; i < n; i++) {
+        if (h[i] == 0.0)
+          continue;
+        const bool accept = error[i] <= 1.0 || h[i] <= min_step;
+        double factor = error[i] > 0.0 ? 0.9 * std::pow(error[i], exponent)
+                                       : 5.0;
+        if (!(factor >= 0.2)) // Also catches a NaN error
+          factor = 0.2;
+        factor = std::min(factor, 5.0);
+        if (accept) {
+          t[i] = h[i] < delta_t - t[i] ? t[i] + h[i] : delta_t;
+          // A step shortened to end at delta_t says little about the next
+          const double proposed = h[i] * factor;
+          h_next[i] = h[i] < h_next[i] ? std::max(proposed, h_next[i])
+                                       : proposed;
+        } else {
+          h_next[i] = std::max(h[i] * factor, min_step);
+          h[i] = 0.0; // Keeps the old state below
+        }
+      }
 
-      // Initialize estrogen signaling components and their rates
-      grid[i][j].icm["ERX"] = 0;
-      grid[i][j].icm_rates["ERX"] = 0;
+      for (size_t v = 0; v < tile_size; v += STAGE_TILE) {
+        for (int i = 0; i < n; i++) {
+          if (h[i] == 0.0)
+            continue;
+          // Ensure values stay within bounds
+          y[v + i] = std::max(0.0, std::min(1.0, y_new[v + i]));
+        }
+      }
+    }
 
-      grid[i][j].icm["ERB"] = 0;
-      grid[i][j].icm_rates["ERB"] = 0;
+    for (int i = 0; i < n; i++)
+      cell_step[tile + i] = h_next[i];
+
+    // Write the tile back, diffusing species to their spares if requested
+    for (int s = 0; s < ns; s++) {
+      const int k = s - sp::FIRST_ECM;
+      const double *value = y + (size_t)s * STAGE_TILE;
+      Scalar *out = to_spare && k >= 0 && k < NUM_DIFFUSING ? spareField(k)
+                                                            : field(s);
+      if (change) {
+        const Scalar *old_value = field(s) + tile;
+        for (int i = 0; i < n; i++)
+          *change = std::max(*change, std::fabs(value[i] - old_value[i]));
+      }
+      std::copy(value, value + n, out + tile);
+    }
+  }
+}
 
-      grid[i][j].icm["GPR30"] = 0;
-      grid[i][j].icm_rates["GPR30"] = 0;
+// Advance the sensitivities of cells [begin, end) over an Euler substep of
+// h, from the fields before the substep and their rates rt as calculateRates
+// returns them: S += h * (J S + df/dk) with the analytic Jacobian J. A value
+// the substep clamps to [0, 1] no longer depends on the rate constants. The
+// Jacobian, over the live entries of SensitivityPattern, and the df/dk
+// terms of a tile are evaluated over SIMD lanes of cells first; then each
+// live row of J S is summed in registers, every rate constant at once (see
+// sensitivityRates). The other rows stay zero.
+void advanceSensitivities(int begin, int end, const RateScalar *rt, double h,
+                          int thread) {
+  typedef simd::LanesOf<double>::type Lanes;
+  const int lanes = simd::LanesOf<double>::width;
+  const int ns = sp::NUM_SPECIES;
+  const int np = net::NUM_PARAMS;
+  const int tile_size = SENSITIVITY_TILE;
+  const int block = SENSITIVITY_BLOCK;
+  const SensitivityPattern &pattern = sensitivityPattern();
+  const int nr = (int)pattern.rows.size();
+  const int nnz = (int)pattern.columns.size() + 1; // With the discarded one
+  const int nt = (int)pattern.term_entries.size();
+  const int *slots = pattern.slots.data();
+  double *const *sens = sensitivity_fields.data();
+
+  double *x = scratch[thread].sensitivity.data();
+  double *jac = x + (size_t)ns * tile_size;
+  double *dfdk = jac + (size_t)nnz * tile_size;
+  double *dsdt = dfdk + (size_t)nt * tile_size;
+
+  double k[np];
+  rateParams(k);
+  Lanes kv[np];
+  for (int p = 0; p < np; p++)
+    kv[p] = Lanes(k[p]);
+
+  Lanes xv[ns];
+  double xs[ns];
+  for (int tile = begin; tile < end; tile += tile_size) {
+    const int n = std::min(tile_size, end - tile);
+    for (int s = 0; s < ns; s++)
+      std::copy(field(s) + tile, field(s) + tile + n, x + s * tile_size);
+    std::fill_n(jac, (size_t)nnz * tile_size, 0.0);
+
+    // Contributions of lanes cells at a time, then of the cells left over
+    int i = 0;
+    for (; i + lanes <= n; i += lanes) {
+      for (int s = 0; s < ns; s++)
+        xv[s] = Lanes::load(x + s * tile_size + i);
+      int e = 0;
+      net::networkJacobianEntries(xv, kv, [&](int, int, Lanes value) {
+        double *slot = jac + (size_t)slots[e++] * tile_size + i;
+        (Lanes::load(slot) + value).store(slot);
+      });
+      e = 0;
+      net::networkParamEntries(xv, [&](int, int, Lanes value) {
+        value.store(dfdk + (size_t)e++ * tile_size + i);
+      });
+    }
+    for (; i < n; i++) {
+      for (int s = 0; s < ns; s++)
+        xs[s] = x[s * tile_size + i];
+      int e = 0;
+      net::networkJacobianEntries(xs, k, [&](int, int, double value) {
+        jac[(size_t)slots[e++] * tile_size + i] += value;
+      });
+      e = 0;
+      net::networkParamEntries(xs, [&](int, int, double value) {
+        dfdk[(size_t)e++ * tile_size + i] = value;
+      });
+    }
 
-      grid[i][j].icm["CyclinB1"] = 0;
-      grid[i][j].icm_rates["CyclinB1"] = 0;
+    // A cell's sensitivities to the rate constants fill whole vectors
+    static_assert(np % lanes == 0, "rate constants must fill SIMD lanes");
+    const Lanes h_v(h);
+    for (i = 0; i < n; i += block) {
+      const int b = std::min(block, n - i);
+      if (b == block)
+        sensitivityRates<SENSITIVITY_BLOCK>(jac, dfdk, tile, i, dsdt);
+      else
+        for (int q = 0; q < b; q++)
+          sensitivityRates<1>(jac, dfdk, tile, i + q, dsdt + q * nr * np);
+
+      for (int q = 0; q < b; q++) {
+        const size_t c = (size_t)(tile + i + q) * sensitivity_stride;
+        for (int r = 0; r < nr; r++) {
+          const int s = pattern.rows[r];
+          // The value updateCells computes before clamping
+          const RateScalar rate =
+              rt[(size_t)s * RATE_TILE + tile - begin + i + q];
+          const double value = x[s * tile_size + i + q] + rate * h;
+          const Lanes keep(value < 0.0 || value > 1.0 ? 0.0 : 1.0);
+          double *sv = sens[s] + c;
+          const double *dv = dsdt + (size_t)(q * nr + r) * np;
+          for (int p = 0; p < np; p += lanes)
+            (keep * (Lanes::load(sv + p) + Lanes::load(dv + p) * h_v))
+                .store(sv + p);
+        }
+      }
+    }
+  }
+}
 
-      grid[i][j].icm["CDK1"] = 0;
-      grid[i][j].icm_rates["CDK1"] = 0;
+// Update cells [begin, end) using Euler integration in reaction_substeps
+// substeps, or the adaptive integrator if one is selected. With to_spare set
+// the diffusing species are written to their spare buffers (for the fused
+// sweep, in a single substep) and the current buffers keep the values from
+// before the update. change, if given, is raised to the largest change of a
+// value. Sensitivity runs always take the Euler substeps, advancing the
+// sensitivities with the state.
+void updateCells(int begin, int end, double delta_t, int thread,
+                 bool to_spare = false, double *change = nullptr) {
+  const bool sensitive = sensitivityStep();
+  if (integrator != EULER && !sensitive) {
+    integrateCells(begin, end, delta_t, thread, to_spare, change);
+    return;
+  }
 
-      // Initialize additional components and their rates
-      grid[i][j].icm["AGT"] = 0;
-      grid[i][j].icm_rates["AGT"] = 0;
+  // Substeps update in place, so they never run with to_spare
+  const int substeps = to_spare ? 1 : reaction_substeps;
+  const double h = delta_t / substeps;
+
+  for (int tile = begin; tile < end; tile += RATE_TILE) {
+    const int tile_end = std::min(tile + RATE_TILE, end);
+
+    for (int sub = 0; sub < substeps; sub++) {
+      // Calculate rates of change
+      const RateScalar *rt = calculateRates(tile, tile_end, thread);
+      if (sensitive)
+        advanceSensitivities(tile, tile_end, rt, h, thread);
+
+      // Update all molecules using Euler method
+      for (int s = 0; s < state.num_species; s++) {
+        const Scalar *conc = field(s);
+        const int k = s - sp::FIRST_ECM;
+        Scalar *out = to_spare && k >= 0 && k < NUM_DIFFUSING ? spareField(k)
+                                                              : field(s);
+        const RateScalar *dxdt = rt + (size_t)s * RATE_TILE;
+        double delta = 0.0;
+        for (int c = tile; c < tile_end; c++) {
+          const double old_value = conc[c];
+          double value = old_value + dxdt[c - tile] * h;
+
+          // Ensure values stay within bounds
+          if (value < 0.0)
+            value = 0.0;
+          if (value > 1.0)
+            value = 1.0;
+          out[c] = value;
+          delta = std::max(delta, std::fabs(out[c] - old_value));
+        }
+        if (change)
+          *change = std::max(*change, delta);
+      }
+    }
+  }
+}
 
-      grid[i][j].icm["ACE"] = 0;
-      grid[i][j].icm_rates["ACE"] = 0;
+// Diffuse rows [row_begin, row_end) of one species field with an 8-neighbor
+// Laplacian, reading the field before the pass from temp and writing the
+// result to values. Only columns [col_begin, col_end) if given. Computes in
+// Scalar; the columns away from the wrap-around edges run simd::LanesOf
+// cells per instruction with the same operations as the scalar edges. On an
+// ensemble grid horizontal neighbors are grid_members columns apart and
+// column j diffuses at column_rates[j] instead of diffusion_rate.
+// Returns the largest change of a value.
+double diffuseField(Scalar *values, const Scalar *temp, double diffusion_rate,
+                    double delta_t, int row_begin, int row_end,
+                    int col_begin = 0, int col_end = INT_MAX,
+                    const Scalar *column_rates = nullptr) {
+  typedef simd::LanesOf<Scalar>::type Lanes;
+  const int lanes = simd::LanesOf<Scalar>::width;
+  const int rows = state.rows;
+  const int cols = state.cols;
+  const int step = grid_members;
+  col_end = std::min(col_end, cols);
+  const int inner_begin = std::max(col_begin, step);
+  const int inner_end = std::max(inner_begin, std::min(col_end, cols - step));
+
+  const Scalar rate = diffusion_rate;
+  const Scalar dt = delta_t;
+  const Lanes rate_v(rate), dt_v(dt), zero_v(0.0), one_v(1.0);
+  Lanes rise_v(0.0), fall_v(0.0);
+  Scalar change = 0.0;
+
+  for (int i = row_begin; i < row_end; i++) {
+    // Rows above and below, with periodic boundary conditions
+    const Scalar *up = temp + (size_t)(i > 0 ? i - 1 : rows - 1) * cols;
+    const Scalar *mid = temp + (size_t)i * cols;
+    const Scalar *down = temp + (size_t)(i < rows - 1 ? i + 1 : 0) * cols;
+    Scalar *out = values + (size_t)i * cols;
+
+    // Update value using diffusion equation: dC/dt = D * ∇²C, where l and
+    // r are the columns left and right of j
+    auto cell = [&](int l, int j, int r) {
+      const Scalar center = mid[j];
+      const Scalar laplacian = laplacian8(up, mid, down, l, j, r);
+      const Scalar r_j = column_rates ? column_rates[j] : rate;
+      Scalar value = center + r_j * laplacian * dt;
+
+      // Ensure values stay within bounds
+      if (value < 0.0)
+        value = 0.0;
+      if (value > 1.0)
+        value = 1.0;
+      out[j] = value;
+      change = std::max(change, std::fabs(value - center));
+    };
+    auto edge = [&](int j) {
+      cell(j >= step ? j - step : j - step + cols, j,
+           j + step < cols ? j + step : j + step - cols);
+    };
+
+    for (int j = col_begin; j < inner_begin && j < col_end; j++)
+      edge(j);
+
+    int j = inner_begin;
+    for (; j + lanes <= inner_end; j += lanes) {
+      const Lanes center = Lanes::load(mid + j);
+      Lanes laplacian = zero_v;
+      laplacian = laplacian + (Lanes::load(up + j - step) - center);
+      laplacian = laplacian + (Lanes::load(up + j) - center);
+      laplacian = laplacian + (Lanes::load(up + j + step) - center);
+      laplacian = laplacian + (Lanes::load(mid + j - step) - center);
+      laplacian = laplacian + (Lanes::load(mid + j + step) - center);
+      laplacian = laplacian + (Lanes::load(down + j - step) - center);
+      laplacian = laplacian + (Lanes::load(down + j) - center);
+      laplacian = laplacian + (Lanes::load(down + j + step) - center);
+      const Lanes r_v =
+          column_rates ? Lanes::load(column_rates + j) : rate_v;
+      Lanes value = center + r_v * laplacian * dt_v;
+      value = simd::min(simd::max(value, zero_v), one_v);
+      value.store(out + j);
+      rise_v = simd::max(rise_v, value - center);
+      fall_v = simd::max(fall_v, center - value);
+    }
+    for (; j < inner_end; j++)
+      cell(j - step, j, j + step);
 
-      grid[i][j].icm["BAMBI"] = 0;
-      grid[i][j].icm_rates["BAMBI"] = 0;
+    for (j = inner_end; j < col_end; j++)
+      edge(j);
+  }
 
-      grid[i][j].icm["smad3"] = 0;
-      grid[i][j].icm_rates["smad3"] = 0;
+  Scalar rise[lanes], fall[lanes];
+  rise_v.store(rise);
+  fall_v.store(fall);
+  for (int w = 0; w < lanes; w++)
+    change = std::max(change, std::max(rise[w], fall[w]));
+  return change;
+}
 
-      grid[i][j].icm["smad7"] = 0;
-      grid[i][j].icm_rates["smad7"] = 0;
+// Columns solved together by the column pass of diffuseADI
+const int ADI_COLUMNS = 64;
+
+// Alternating-direction implicit diffusion of diffusing fields [k0, k0 +
+// count), written to their spare buffers.
+//
+// The 8-neighbor Laplacian factors as L = 3 Tx + 3 Ty + Tx Ty, with Tx and
+// Ty the periodic second differences along a row and a column. Each field
+// takes the step
+//
+//   (I - 3 D dt Tx) (I - 3 D dt Ty) u' = (I + D dt Tx Ty) u,
+//
+// which matches u' = u + D dt L u' up to O(dt^2) and damps every Fourier
+// mode (amplification in (0, 1]) for any D dt, so large steps stay stable
+// where the explicit update would blow up. The right-hand side and the row
+// solves run over blocks of rows, then the column solves over blocks of
+// columns, all columns of a block advancing one row at a time.
+void diffuseADI(int k0, int count, double diffusion_rate, double delta_t) {
+  const int rows = state.rows;
+  const int cols = state.cols;
+  const double cross = diffusion_rate * delta_t;
+  adi_row.prepare(cols, 3.0 * cross);
+  adi_column.prepare(rows, 3.0 * cross);
+
+  pool.runRows(rows, [&](int row_begin, int row_end, int thread) {
+    double *ty = scratch[thread].line.data();
+    for (int k = k0; k < k0 + count; k++) {
+      const Scalar *u = field(sp::FIRST_ECM + k);
+      Scalar *out = spareField(k);
+      for (int i = row_begin; i < row_end; i++) {
+        const Scalar *up = u + (size_t)(i > 0 ? i - 1 : rows - 1) * cols;
+        const Scalar *center = u + (size_t)i * cols;
+        const Scalar *down = u + (size_t)(i < rows - 1 ? i + 1 : 0) * cols;
+        Scalar *row = out + (size_t)i * cols;
+
+        // u + D dt Tx Ty u, then the row solve
+        for (int j = 0; j < cols; j++)
+          ty[j] = up[j] - 2.0 * center[j] + down[j];
+        for (int j = 0; j < cols; j++) {
+          const double left = ty[j > 0 ? j - 1 : cols - 1];
+          const double right = ty[j < cols - 1 ? j + 1 : 0];
+          row[j] = center[j] + cross * (left - 2.0 * ty[j] + right);
+        }
+        adi_row.solve(row, 1, 1);
+      }
+    }
+  });
+
+  pool.runRows(cols, [&](int col_begin, int col_end, int) {
+    for (int k = k0; k < k0 + count; k++) {
+      Scalar *out = spareField(k);
+      for (int j = col_begin; j < col_end; j += ADI_COLUMNS) {
+        const int width = std::min(ADI_COLUMNS, col_end - j);
+        adi_column.solve(out + j, cols, width);
+
+        // Ensure values stay within bounds
+        for (int i = 0; i < rows; i++) {
+          Scalar *value = out + (size_t)i * cols + j;
+          for (int w = 0; w < width; w++)
+            value[w] = std::max<Scalar>(0.0, std::min<Scalar>(1.0, value[w]));
+        }
+      }
+    }
+  });
+}
 
-      grid[i][j].icm["epac"] = 0;
-      grid[i][j].icm_rates["epac"] = 0;
+// Spectral diffusion of diffusing fields [k0, k0 + count), written to their
+// spare buffers.
+//
+// With periodic boundaries the 8-neighbor Laplacian is diagonal in Fourier
+// space: mode (kx, ky) has eigenvalue (1 + 2 cos kx)(1 + 2 cos ky) - 9. Each
+// mode is multiplied by exp(D dt eigenvalue), the exact solution of
+// dC/dt = D L C over dt, so the step is unconditionally stable and has no
+// time discretization error. Two fields are transformed at once as the real
+// and imaginary part of one complex field, which the real, even decay keeps
+// apart. The passes are 2D FFTs split into row transforms (blocks of rows per
+// thread) and column transforms with the decay (blocks of columns).
+void diffuseSpectral(int k0, int count, double diffusion_rate,
+                     double delta_t) {
+  const int rows = state.rows;
+  const int cols = state.cols;
+  const int pairs = (count + 1) / 2;
+  const double decay = diffusion_rate * delta_t;
+  const double norm = 1.0 / ((double)rows * cols);
+
+  auto realPart = [&](int p) { return spareField(k0 + 2 * p); };
+  auto imagPart = [&](int p) {
+    return 2 * p + 1 < count ? spareField(k0 + 2 * p + 1)
+                             : spectral_field.data();
+  };
+
+  // Row transforms of the fields
+  pool.runRows(rows, [&](int row_begin, int row_end, int thread) {
+    double *work = scratch[thread].spectral.data() + 3 * rows;
+    for (int p = 0; p < pairs; p++) {
+      const Scalar *a = field(sp::FIRST_ECM + k0 + 2 * p);
+      const Scalar *b =
+          2 * p + 1 < count ? field(sp::FIRST_ECM + k0 + 2 * p + 1) : nullptr;
+      Scalar *re = realPart(p);
+      Scalar *im = imagPart(p);
+      for (int i = row_begin; i < row_end; i++) {
+        const size_t row = (size_t)i * cols;
+        std::copy(a + row, a + row + cols, re + row);
+        if (b)
+          std::copy(b + row, b + row + cols, im + row);
+        else
+          std::fill_n(im + row, cols, 0.0);
+        fft_row.transform(re + row, im + row, false, work);
+      }
+    }
+  });
+
+  // Column transforms, decay and inverse column transforms
+  pool.runRows(cols, [&](int col_begin, int col_end, int thread) {
+    double *col_re = scratch[thread].spectral.data();
+    double *col_im = col_re + rows;
+    double *factor = col_im + rows;
+    double *work = factor + rows;
+    for (int j = col_begin; j < col_end; j++) {
+      for (int i = 0; i < rows; i++)
+        factor[i] =
+            std::exp(decay * (symbol_row[j] * symbol_column[i] - 9.0)) * norm;
+      for (int p = 0; p < pairs; p++) {
+        Scalar *re = realPart(p) + j;
+        Scalar *im = imagPart(p) + j;
+        for (int i = 0; i < rows; i++) {
+          col_re[i] = re[(size_t)i * cols];
+          col_im[i] = im[(size_t)i * cols];
+        }
+        fft_column.transform(col_re, col_im, false, work);
+        for (int i = 0; i < rows; i++) {
+          col_re[i] *= factor[i];
+          col_im[i] *= factor[i];
+        }
+        fft_column.transform(col_re, col_im, true, work);
+        for (int i = 0; i < rows; i++) {
+          re[(size_t)i * cols] = col_re[i];
+          im[(size_t)i * cols] = col_im[i];
+        }
+      }
+    }
+  });
+
+  // Inverse row transforms
+  pool.runRows(rows, [&](int row_begin, int row_end, int thread) {
+    double *work = scratch[thread].spectral.data() + 3 * rows;
+    for (int p = 0; p < pairs; p++) {
+      Scalar *re = realPart(p);
+      Scalar *im = imagPart(p);
+      for (int i = row_begin; i < row_end; i++) {
+        const size_t row = (size_t)i * cols;
+        fft_row.transform(re + row, im + row, true, work);
+
+        // Ensure values stay within bounds (the decay keeps them there up
+        // to rounding)
+        for (int j = 0; j < cols; j++) {
+          re[row + j] = std::max<Scalar>(0.0, std::min<Scalar>(1.0, re[row + j]));
+          im[row + j] = std::max<Scalar>(0.0, std::min<Scalar>(1.0, im[row + j]));
+        }
+      }
+    }
+  });
+}
 
-      grid[i][j].icm["cmyc"] = 0;
-      grid[i][j].icm_rates["cmyc"] = 0;
+// True if dormant blocks are skipped this step
+inline bool skippingCells() {
+  return active_set && !compression && !sensitivityStep() &&
+         diffusionScheme() == EXPLICIT_DIFFUSION;
+}
 
-      grid[i][j].icm["proliferation"] = 0;
-      grid[i][j].icm_rates["proliferation"] = 0;
+// Per-column diffusion rates of diffusing field k on an ensemble grid, null
+// when the whole grid diffuses at one rate
+inline const Scalar *columnRates(int k) {
+  if (grid_members == 1)
+    return nullptr;
+  return member_diffusion.data() + (k < sp::NUM_ECM ? state.cols : 0);
+}
 
-      grid[i][j].icm["latentTGFB"] = 0;
-      grid[i][j].icm_rates["latentTGFB"] = 0;
+// d(diffusion rate of field k)/d(k_diffusion): ECM molecules diffuse at 20%
+// of the feedback molecule rate
+inline double diffusionShare(int k) { return k < sp::NUM_ECM ? 0.2 : 1.0; }
+
+// Diffuse rows [row_begin, row_end) of the sensitivities of count adjacent
+// diffusing fields from k0 into their spares, differentiating diffuseField:
+// every sensitivity diffuses like the field, and the one to k_diffusion
+// also gains the field's own Laplacian times d(rate)/d(k_diffusion). Values
+// diffuseField clamps to [0, 1] lose their sensitivity. Reads the fields
+// before the pass. The fields are diffused row by row, so the cell blocks
+// of three rows stay in cache across them.
+void diffuseSensitivityRows(int k0, int count, double diffusion_rate,
+                            double delta_t, int row_begin, int row_end,
+                            int thread) {
+  typedef simd::LanesOf<double>::type Lanes;
+  const int lanes = simd::LanesOf<double>::width;
+  const int np = net::NUM_PARAMS;
+  const int rows = state.rows;
+  const int cols = state.cols;
+  const size_t stride = sensitivity_stride;
+  const Scalar rate = diffusion_rate;
+  const Scalar dt = delta_t;
+  const Lanes rate_v(diffusion_rate), dt_v(delta_t), zero_v(0.0);
+
+  // 1 for the rate constant the source applies to
+  double from_rate[np] = {};
+  from_rate[net::K_DIFFUSION] = 1.0;
+
+  // Per column of a row: 0 where diffuseField clamps, 1 elsewhere, and the
+  // k_diffusion source
+  double *keep = scratch[thread].sensitivity.data() +
+                 scratch[thread].sensitivity.size() - 2 * (size_t)cols;
+  double *source = keep + cols;
+
+  for (int i = row_begin; i < row_end; i++) {
+    const size_t up = (size_t)(i > 0 ? i - 1 : rows - 1) * cols;
+    const size_t mid = (size_t)i * cols;
+    const size_t down = (size_t)(i < rows - 1 ? i + 1 : 0) * cols;
+    for (int k = k0; k < k0 + count; k++) {
+      const Scalar *temp = field(sp::FIRST_ECM + k);
+      const double share = diffusionShare(k);
+      for (int j = 0; j < cols; j++) {
+        const int l = j > 0 ? j - 1 : cols - 1;
+        const int r = j < cols - 1 ? j + 1 : 0;
+
+        // The value diffuseField computes before clamping
+        const Scalar laplacian =
+            laplacian8(temp + up, temp + mid, temp + down, l, j, r);
+        const Scalar value = temp[mid + j] + rate * laplacian * dt;
+        keep[j] = value < 0.0 || value > 1.0 ? 0.0 : 1.0;
+        source[j] = share * laplacian * delta_t;
+      }
 
-      grid[i][j].icm["thrombospondin4"] = 0;
-      grid[i][j].icm_rates["thrombospondin4"] = 0;
+      // A cell's sensitivities to the rate constants fill whole vectors
+      const double *sens = sensitivity_fields[sp::FIRST_ECM + k];
+      const double *s_up = sens + up * stride;
+      const double *s_mid = sens + mid * stride;
+      const double *s_down = sens + down * stride;
+      double *s_out = sensitivity_spares[k] + mid * stride;
+      auto cell = [&](int l, int j, int r) {
+        const Lanes keep_v(keep[j]);
+        const Lanes source_v(source[j]);
+        for (int p = 0; p < np; p += lanes) {
+          auto at = [&](const double *row, int col) {
+            return Lanes::load(row + col * stride + p);
+          };
+          const Lanes center = at(s_mid, j);
+          Lanes laplacian = zero_v;
+          laplacian = laplacian + (at(s_up, l) - center);
+          laplacian = laplacian + (at(s_up, j) - center);
+          laplacian = laplacian + (at(s_up, r) - center);
+          laplacian = laplacian + (at(s_mid, l) - center);
+          laplacian = laplacian + (at(s_mid, r) - center);
+          laplacian = laplacian + (at(s_down, l) - center);
+          laplacian = laplacian + (at(s_down, j) - center);
+          laplacian = laplacian + (at(s_down, r) - center);
+          const Lanes ds = center + rate_v * laplacian * dt_v +
+                           Lanes::load(from_rate + p) * source_v;
+          (keep_v * ds).store(s_out + j * stride + p);
+        }
+      };
+      cell(cols - 1, 0, cols > 1 ? 1 : 0);
+      for (int j = 1; j < cols - 1; j++)
+        cell(j - 1, j, j + 1);
+      if (cols > 1)
+        cell(cols - 2, cols - 1, 0);
+    }
+  }
+}
 
-      grid[i][j].icm["osteopontin"] = 0;
-      grid[i][j].icm_rates["osteopontin"] = 0;
+// Explicitly diffuse rows [row_begin, row_end) of diffusing field k into its
+// spare buffer. Dormant blocks are copied unchanged when skipping.
+void diffuseRows(int k, double diffusion_rate, double delta_t, int row_begin,
+                 int row_end) {
+  Scalar *values = spareField(k);
+  const Scalar *temp = field(sp::FIRST_ECM + k);
+  if (!skippingCells()) {
+    diffuseField(values, temp, diffusion_rate, delta_t, row_begin, row_end, 0,
+                 INT_MAX, columnRates(k));
+    return;
+  }
 
-      grid[i][j].icm["syndecan4"] = 0;
-      grid[i][j].icm_rates["syndecan4"] = 0;
+  const int cols = state.cols;
+  for (int i = row_begin; i < row_end; i++) {
+    for (int b = 0; b < active_blocks_per_row; b++) {
+      const int block = i * active_blocks_per_row + b;
+      const int col_begin = b * ACTIVE_SPAN;
+      const int col_end = std::min(col_begin + ACTIVE_SPAN, cols);
+      if (block_active[block]) {
+        const double change = diffuseField(values, temp, diffusion_rate,
+                                           delta_t, i, i + 1, col_begin,
+                                           col_end);
+        block_change[block] = std::max(block_change[block], change);
+      } else {
+        const size_t c = (size_t)i * cols + col_begin;
+        memcpy(values + c, temp + c, (col_end - col_begin) * sizeof(Scalar));
+      }
+    }
+  }
+}
 
-      grid[i][j].icm["aSMA"] = 0;
-      grid[i][j].icm_rates["aSMA"] = 0;
+// React rows [row_begin, row_end), only the active blocks when skipping
+void reactRows(int row_begin, int row_end, double delta_t, int thread) {
+  const int cols = state.cols;
+  if (!skippingCells()) {
+    updateCells(row_begin * cols, row_end * cols, delta_t, thread);
+    return;
+  }
 
-      grid[i][j].icm["LOX"] = 0;
-      grid[i][j].icm_rates["LOX"] = 0;
+  for (int i = row_begin; i < row_end; i++) {
+    for (int b = 0; b < active_blocks_per_row; b++) {
+      const int block = i * active_blocks_per_row + b;
+      if (!block_active[block])
+        continue;
+      const int begin = i * cols + b * ACTIVE_SPAN;
+      const int end = i * cols + std::min((b + 1) * ACTIVE_SPAN, cols);
+      updateCells(begin, end, delta_t, thread, false, &block_change[block]);
     }
   }
 }
 
-// Helper function to get input value for a cell (considering overrides)
-double getInputValue(const Cell &cell, const std::string &molecule) {
-  if (cell.has_input_override && cell.input_overrides.count(molecule) > 0) {
-    return cell.input_overrides.at(molecule);
+// Cells in active blocks
+long long activeCells() {
+  long long cells = 0;
+  for (size_t b = 0; b < block_active.size(); b++) {
+    if (block_active[b]) {
+      const int col_begin = (int)(b % active_blocks_per_row) * ACTIVE_SPAN;
+      cells += std::min(ACTIVE_SPAN, state.cols - col_begin);
+    }
   }
-  return cell.icm.at(molecule);
+  return cells;
 }
 
-// Calculate rates of change based on ODE rules
-void calculateRates(Cell &cell) {
-  // Input signals to ligands - ODE form (using helper function for overrides)
-  cell.icm_rates["AngII"] = rates.k_input * getInputValue(cell, "AngIIin") +
-                            rates.k_feedback * cell.feedback["AngIIfb"] -
-                            rates.k_degradation * cell.icm["AngII"];
+// Cells a reaction or explicit diffusion pass processes
+double processedCells() {
+  return skippingCells() ? (double)activeCells() : (double)state.num_cells;
+}
 
-  cell.icm_rates["TGFB"] = rates.k_input * getInputValue(cell, "TGFBin") +
-                           rates.k_feedback * cell.feedback["TGFBfb"] -
-                           rates.k_degradation * cell.icm["TGFB"];
+// After a step: record the fraction of cells processed, then keep active
+// the blocks that are still changing and their neighbors (the grid wraps
+// around, so the neighborhood does too)
+void updateActiveSet(double delta_t) {
+  const int rows = state.rows;
+  const int per_row = active_blocks_per_row;
+  const double threshold = active_tolerance * delta_t;
+
+  const long long cells = activeCells();
+  for (size_t b = 0; b < block_active.size(); b++) {
+    block_moving[b] = block_active[b] && block_change[b] > threshold;
+    block_change[b] = 0.0;
+  }
+  active_fraction = state.num_cells > 0 ? (double)cells / state.num_cells : 1.0;
+
+  for (int i = 0; i < rows; i++) {
+    for (int b = 0; b < per_row; b++) {
+      bool active = false;
+      for (int di = -1; di <= 1 && !active; di++) {
+        const int ni = (i + di + rows) % rows;
+        for (int db = -1; db <= 1 && !active; db++) {
+          const int nb = (b + db + per_row) % per_row;
+          active = block_moving[ni * per_row + nb] != 0;
+        }
+      }
+      block_active[i * per_row + b] = active;
+    }
+  }
+}
 
-  cell.icm_rates["tension"] = rates.k_input * getInputValue(cell, "tensionin") +
-                              rates.k_feedback * cell.feedback["tensionfb"] -
-                              rates.k_degradation * cell.icm["tension"];
+inline bool ecmField(int species) {
+  return species >= sp::FIRST_ECM && species < sp::FIRST_ECM + sp::NUM_ECM;
+}
 
-  cell.icm_rates["IL6"] = rates.k_input * getInputValue(cell, "IL6in") +
-                          rates.k_feedback * cell.feedback["IL6fb"] -
-                          rates.k_degradation * cell.icm["IL6"];
+inline bool sameBits(double a, double b) {
+  return memcmp(&a, &b, sizeof(double)) == 0;
+}
 
-  cell.icm_rates["IL1"] =
-      rates.k_input * getInputValue(cell, "IL1in") - rates.k_degradation * cell.icm["IL1"];
+// True if cells a and b agree bit for bit in every species but the ECM
+// fields
+bool sameClass(int a, int b) {
+  for (int s = 0; s < state.num_species; s++) {
+    if (!ecmField(s) && !sameBits(field(s)[a], field(s)[b]))
+      return false;
+  }
+  return true;
+}
 
-  cell.icm_rates["TNFa"] = rates.k_input * getInputValue(cell, "TNFain") -
-                           rates.k_degradation * cell.icm["TNFa"];
+// True if no species but the ECM fields depends on an ECM field, so the
+// classes can ignore them
+bool compressibleNetwork() {
+  buildJacobianPattern();
+  for (int row = 0; row < state.num_species; row++) {
+    if (ecmField(row))
+      continue;
+    for (int j = jacobian_rows[row]; j < jacobian_rows[row + 1]; j++) {
+      if (ecmField(jacobian_columns[j]))
+        return false;
+    }
+  }
+  return true;
+}
 
-  cell.icm_rates["NE"] =
-      rates.k_input * getInputValue(cell, "NEin") - rates.k_degradation * cell.icm["NE"];
+// Put cells into new classes, one per distinct set of values. Cells are
+// hashed one species at a time so the fields are read in order.
+void groupCells(const CountedVector<int> &cells) {
+  CountedVector<uint64_t> hashes(cells.size(), 14695981039346656037ull);
+  for (int s = 0; s < state.num_species; s++) {
+    if (ecmField(s))
+      continue;
+    const Scalar *values = field(s);
+    for (size_t i = 0; i < cells.size(); i++) {
+      const double value = values[cells[i]];
+      uint64_t bits;
+      memcpy(&bits, &value, sizeof(bits));
+      hashes[i] = (hashes[i] ^ bits) * 1099511628211ull;
+    }
+  }
 
-  cell.icm_rates["PDGF"] = rates.k_input * getInputValue(cell, "PDGFin") -
-                           rates.k_degradation * cell.icm["PDGF"];
+  std::unordered_multimap<uint64_t, int, std::hash<uint64_t>,
+                          std::equal_to<uint64_t>,
+                          CountingAllocator<std::pair<const uint64_t, int>>>
+      classes; // Hash to class
+  for (size_t i = 0; i < cells.size(); i++) {
+    int found = -1;
+    auto range = classes.equal_range(hashes[i]);
+    for (auto it = range.first; it != range.second && found < 0; ++it) {
+      if (sameClass(cells[i], class_first[it->second]))
+        found = it->second;
+    }
+    if (found < 0) {
+      found = (int)class_first.size();
+      class_first.push_back(cells[i]);
+      classes.emplace(hashes[i], found);
+    }
+    cell_class[cells[i]] = found;
+  }
+  class_check.resize(class_first.size(), 0);
+}
 
-  cell.icm_rates["ET1"] = rates.k_input * getInputValue(cell, "ET1in") +
-                          rates.k_feedback * cell.feedback["ET1fb"] -
-                          rates.k_degradation * cell.icm["ET1"];
+// Stop compressing if the classes no longer save work
+void limitClasses() {
+  if ((int)class_first.size() > std::max(1, state.num_cells / CLASS_LIMIT)) {
+    cell_class.clear();
+    class_first.clear();
+  }
+}
 
-  cell.icm_rates["NP"] =
-      rates.k_input * getInputValue(cell, "NPin") - rates.k_degradation * cell.icm["NP"];
+// Group every cell from scratch
+void regroupCells() {
+  regroup_classes = false;
+  cell_class.clear();
+  class_first.clear();
+  class_check.clear();
+  if (!compressibleNetwork())
+    return;
+
+  CountedVector<int> cells(state.num_cells);
+  for (int c = 0; c < state.num_cells; c++)
+    cells[c] = c;
+  cell_class.assign(state.num_cells, 0);
+  cell_split.assign(state.num_cells, 0);
+  groupCells(cells);
+  limitClasses();
+}
 
-  cell.icm_rates["E2"] =
-      rates.k_input * getInputValue(cell, "E2in") - rates.k_degradation * cell.icm["E2"];
+// Move the cells that no longer match the first cell of their class into
+// new classes. Reactions keep members identical, so only the diffusing
+// fields are compared, unless a member was edited.
+void splitClasses() {
+  const int n = state.num_cells;
+  for (int k = sp::NUM_ECM; k < NUM_DIFFUSING; k++) {
+    const Scalar *values = field(sp::FIRST_ECM + k);
+    for (int c = 0; c < n; c++) {
+      if (!sameBits(values[c], values[class_first[cell_class[c]]]))
+        cell_split[c] = 1;
+    }
+  }
 
-  // Receptor activation - ODE form with inhibition
-  cell.icm_rates["AT1R"] =
-      rates.k_receptor * cell.icm["AngII"] -
-      rates.k_inhibition * cell.icm["AT1R"] * cell.icm["ERB"] -
-      rates.k_degradation * cell.icm["AT1R"];
+  CountedVector<int> cells;
+  for (int c = 0; c < n; c++) {
+    const int k = cell_class[c];
+    if (class_check[k] && !cell_split[c] && !sameClass(c, class_first[k]))
+      cell_split[c] = 1;
+    if (cell_split[c]) {
+      cells.push_back(c);
+      cell_split[c] = 0;
+    }
+  }
+  std::fill(class_check.begin(), class_check.end(), 0);
+  if (cells.empty())
+    return;
+  groupCells(cells);
+  limitClasses();
+}
 
-  cell.icm_rates["TGFB1R"] =
-      rates.k_receptor * cell.icm["TGFB"] -
-      rates.k_inhibition * cell.icm["TGFB1R"] * cell.icm["BAMBI"] -
-      rates.k_degradation * cell.icm["TGFB1R"];
+// Bring the classes up to date for a step. True if the step reacts by class.
+bool compressedStep() {
+  if (!compression || integrator != EULER || state.num_cells == 0 ||
+      grid_members > 1 || sensitivityStep())
+    return false;
+  if (regroup_classes)
+    regroupCells();
+  else if (!cell_class.empty())
+    splitClasses();
+  return !cell_class.empty();
+}
 
-  cell.icm_rates["ETAR"] = rates.k_receptor * cell.icm["ET1"] -
-                           rates.k_degradation * cell.icm["ETAR"];
+// Rates of the ECM fields of cells [begin, end), at most RATE_TILE of them,
+// in the calling thread's rate tile as calculateRates returns it
+const RateScalar *ecmRates(int begin, int end, int thread) {
+  RateScalar *xt = scratch[thread].tile.data();
+  RateScalar *rt = xt + (size_t)sp::NUM_SPECIES * RATE_TILE;
 
-  cell.icm_rates["IL1RI"] = rates.k_receptor * cell.icm["IL1"] -
-                            rates.k_degradation * cell.icm["IL1RI"];
+  if (use_program) {
+    runNetworkProgram(network_ecm, network_coefs.data(), state.fields.data(),
+                      rt, RATE_TILE, begin, end);
+    return rt;
+  }
 
-  cell.icm_rates["PDGFR"] = rates.k_receptor * cell.icm["PDGF"] -
-                            rates.k_degradation * cell.icm["PDGFR"];
+  const int n = end - begin;
+  for (int s = 0; s < sp::NUM_SPECIES; s++)
+    std::copy(field(s) + begin, field(s) + end, xt + s * RATE_TILE);
 
-  cell.icm_rates["TNFaR"] = rates.k_receptor * cell.icm["TNFa"] -
-                            rates.k_degradation * cell.icm["TNFaR"];
+  kernelTile<sp::FIRST_ECM, sp::NUM_ECM>(xt, rt, RATE_TILE, n);
+  return rt;
+}
 
-  cell.icm_rates["NPRA"] = rates.k_receptor * cell.icm["NP"] -
-                           rates.k_degradation * cell.icm["NPRA"];
+// Euler reaction step by class: every substep first updates the species
+// shared by each class from its first cell, then the ECM fields of every
+// cell, and copies the class values to the members. Gives the same result
+// as updateCells.
+void reactClasses(double delta_t) {
+  const int classes = (int)class_first.size();
+  const int num_species = state.num_species;
+  const double h = delta_t / reaction_substeps;
+  const int first_shared = sp::FIRST_INPUT + sp::NUM_INPUTS;
+  class_values.resize((size_t)num_species * classes);
+
+  for (int sub = 0; sub < reaction_substeps; sub++) {
+    pool.runRows(classes, [&](int begin, int end, int thread) {
+      RateScalar *x = scratch[thread].cell.data();
+      RateScalar *dxdt = x + num_species;
+      for (int k = begin; k < end; k++) {
+        gatherCell(class_first[k], x);
+        cellRates(x, dxdt);
+        for (int s = first_shared; s < num_species; s++) {
+          double value = x[s] + dxdt[s] * h;
+          if (value < 0.0)
+            value = 0.0;
+          if (value > 1.0)
+            value = 1.0;
+          class_values[(size_t)s * classes + k] = value;
+        }
+      }
+    });
+
+    pool.runRows(state.rows, [&](int row_begin, int row_end, int thread) {
+      const int end = row_end * state.cols;
+      for (int tile = row_begin * state.cols; tile < end; tile += RATE_TILE) {
+        const int tile_end = std::min(tile + RATE_TILE, end);
+        const RateScalar *rt = ecmRates(tile, tile_end, thread);
+        for (int s = sp::FIRST_ECM; s < sp::FIRST_ECM + sp::NUM_ECM; s++) {
+          Scalar *values = field(s);
+          const RateScalar *dxdt = rt + (size_t)s * RATE_TILE;
+          for (int c = tile; c < tile_end; c++) {
+            double value = values[c] + dxdt[c - tile] * h;
+            if (value < 0.0)
+              value = 0.0;
+            if (value > 1.0)
+              value = 1.0;
+            values[c] = value;
+          }
+        }
 
-  cell.icm_rates["gp130"] = rates.k_receptor * cell.icm["IL6"] -
-                            rates.k_degradation * cell.icm["gp130"];
+        for (int s = first_shared; s < num_species; s++) {
+          if (ecmField(s))
+            continue;
+          Scalar *values = field(s);
+          const double *shared = class_values.data() + (size_t)s * classes;
+          for (int c = tile; c < tile_end; c++)
+            values[c] = shared[cell_class[c]];
+        }
+      }
+    });
+  }
+}
+
+// Diffuse count adjacent species fields starting at first, one block of rows
+// per thread. Each field is written to its spare buffer, then the buffers
+// are swapped.
+void diffuseSpecies(int first, int count, double diffusion_rate,
+                    double delta_t) {
+  const int k0 = first - sp::FIRST_ECM;
+
+  if (diffusionScheme() == ADI_DIFFUSION) {
+    diffuseADI(k0, count, diffusion_rate, delta_t);
+  } else if (diffusionScheme() == SPECTRAL_DIFFUSION) {
+    diffuseSpectral(k0, count, diffusion_rate, delta_t);
+  } else {
+    const bool sensitive = sensitivityStep();
+    pool.runRows(state.rows, [&](int row_begin, int row_end, int thread) {
+      for (int k = k0; k < k0 + count; k++)
+        diffuseRows(k, diffusion_rate, delta_t, row_begin, row_end);
+      if (sensitive)
+        diffuseSensitivityRows(k0, count, diffusion_rate, delta_t, row_begin,
+                               row_end, thread);
+    });
+    for (int k = k0; sensitive && k < k0 + count; k++)
+      std::swap(sensitivity_fields[sp::FIRST_ECM + k], sensitivity_spares[k]);
+  }
 
-  cell.icm_rates["BAR"] =
-      rates.k_receptor * cell.icm["NE"] - rates.k_degradation * cell.icm["BAR"];
+  for (int k = k0; k < k0 + count; k++)
+    state.swapped[k] = !state.swapped[k];
+  bindFields();
+}
 
-  cell.icm_rates["AT2R"] = rates.k_receptor * cell.icm["AngII"] -
-                           rates.k_degradation * cell.icm["AT2R"];
+// Diffusion rate of diffusing field k
+inline double diffusionRate(int k) {
+  return rates.k_diffusion * diffusionShare(k);
+}
 
-  // Second messengers - ODE form
-  cell.icm_rates["NOX"] =
-      rates.k_activation * (cell.icm["AT1R"] + cell.icm["TGFB1R"]) -
-      rates.k_degradation * cell.icm["NOX"];
+// Fused sweep: reaction and diffusion in a single pass over the grid.
+//
+// Each thread streams through its block of rows in small chunks. A chunk is
+// reacted (Euler update; diffusing species go to their spare buffers), then
+// every row whose neighbors are all reacted is diffused from the spare
+// buffers back into the current ones. A row's fields are therefore still in
+// cache when they are diffused, instead of being reloaded by two separate
+// diffusion passes. The first and last row of every block are reacted
+// beforehand, so blocks can diffuse their edge rows against their neighbors.
+// Every cell sees the same operations as in the three-pass step (reaction,
+// then feedback and ECM diffusion of the reacted values), so results are
+// identical.
+void sweepFused(double delta_t) {
+  PhaseTimer timer(PROFILE_REACTION);
+  timer.cells = state.num_cells;
+  auto react = [&](int row, int thread) {
+    updateCells(row * state.cols, (row + 1) * state.cols, delta_t, thread,
+                true);
+  };
+  auto diffuse = [&](int row) {
+    for (int k = 0; k < NUM_DIFFUSING; k++)
+      diffuseField(field(sp::FIRST_ECM + k), spareField(k), diffusionRate(k),
+                   delta_t, row, row + 1, 0, INT_MAX, columnRates(k));
+  };
+
+  pool.runRows(state.rows, [&](int row_begin, int row_end, int thread) {
+    react(row_begin, thread);
+    if (row_end - 1 > row_begin)
+      react(row_end - 1, thread);
+  });
+
+  // Rows reacted at a time: enough to fill a rate tile
+  const int chunk = std::max(1, RATE_TILE / state.cols);
+
+  pool.runRows(state.rows, [&](int row_begin, int row_end, int thread) {
+    int next = row_begin; // Next row to diffuse
+    for (int r = row_begin + 1; r < row_end - 1; r += chunk) {
+      const int r_end = std::min(r + chunk, row_end - 1);
+      updateCells(r * state.cols, r_end * state.cols, delta_t, thread, true);
+      for (; next < r_end - 1; next++)
+        diffuse(next);
+    }
+    for (; next < row_end; next++)
+      diffuse(next);
+  });
+}
 
-  cell.icm_rates["ROS"] =
-      rates.k_activation * (cell.icm["NOX"] + cell.icm["ETAR"]) -
-      rates.k_degradation * cell.icm["ROS"];
+// Fixed diffusion function to handle boundary effects properly
+void diffuseFeedbackMolecules(double delta_t) {
+  PhaseTimer timer(PROFILE_FEEDBACK);
+  if (timer.active())
+    timer.cells = processedCells();
+  diffuseSpecies(sp::FIRST_FEEDBACK, sp::NUM_FEEDBACK, rates.k_diffusion,
+                 delta_t);
+}
 
-  cell.icm_rates["DAG"] =
-      rates.k_activation * (cell.icm["ETAR"] + cell.icm["AT1R"]) -
-      rates.k_degradation * cell.icm["DAG"];
+// Fixed diffusion function for ECM molecules
+void diffuseECMMolecules(double delta_t) {
+  PhaseTimer timer(PROFILE_ECM);
+  if (timer.active())
+    timer.cells = processedCells();
+  // Use a lower diffusion rate for ECM molecules: 20% of the feedback
+  // molecule diffusion rate
+  diffuseSpecies(sp::FIRST_ECM, sp::NUM_ECM, rates.k_diffusion * 0.2,
+                 delta_t);
+}
 
-  cell.icm_rates["AC"] =
-      rates.k_activation * cell.icm["BAR"] -
-      rates.k_inhibition * cell.icm["AC"] * cell.icm["AT1R"] -
-      rates.k_degradation * cell.icm["AC"];
-
-  cell.icm_rates["cAMP"] =
-      rates.k_activation * (cell.icm["AC"] + cell.icm["ERB"]) -
-      rates.k_degradation * cell.icm["cAMP"];
+// Diffusion time due before the reaction of a step: half the window with
+// Strang splitting, at the start of a window
+double diffusionBefore(DiffusionClock &clock, double delta_t) {
+  if (!strang_splitting || clock.count > 0)
+    return 0.0;
+  clock.lead = 0.5 * clock.interval * delta_t;
+  return clock.lead;
+}
 
-  cell.icm_rates["cGMP"] = rates.k_activation * cell.icm["NPRA"] -
-                           rates.k_degradation * cell.icm["cGMP"];
-
-  cell.icm_rates["Ca"] = rates.k_activation * cell.icm["TRPC"] -
-                         rates.k_degradation * cell.icm["Ca"];
-
-  // Kinases and phosphatases - ODE form
-  cell.icm_rates["PKA"] =
-      rates.k_activation * (cell.icm["cAMP"] + cell.icm["ERB"]) -
-      rates.k_degradation * cell.icm["PKA"];
-
-  cell.icm_rates["PKG"] = rates.k_activation * cell.icm["cGMP"] -
-                          rates.k_degradation * cell.icm["PKG"];
-
-  cell.icm_rates["PKC"] =
-      rates.k_activation *
-          (cell.icm["DAG"] * cell.icm["mTORC2"] + cell.icm["syndecan4"]) -
-      rates.k_degradation * cell.icm["PKC"];
-
-  cell.icm_rates["calcineurin"] = rates.k_activation * cell.icm["Ca"] -
-                                  rates.k_degradation * cell.icm["calcineurin"];
-
-  cell.icm_rates["PP1"] = rates.k_activation * cell.icm["p38"] -
-                          rates.k_degradation * cell.icm["PP1"];
-
-  // Transcription factors - ODE form
-  cell.icm_rates["CREB"] = rates.k_activation * cell.icm["PKA"] -
-                           rates.k_degradation * cell.icm["CREB"];
-
-  cell.icm_rates["CBP"] = rates.k_activation * (1.0 - cell.icm["smad3"]) +
-                          rates.k_activation * (1.0 - cell.icm["CREB"]) -
-                          rates.k_degradation * cell.icm["CBP"];
-
-  cell.icm_rates["NFAT"] = rates.k_activation * cell.icm["calcineurin"] -
-                           rates.k_degradation * cell.icm["NFAT"];
-
-  cell.icm_rates["AP1"] =
-      rates.k_activation * (cell.icm["ERK"] + cell.icm["JNK"]) -
-      rates.k_degradation * cell.icm["AP1"];
-
-  cell.icm_rates["STAT"] = rates.k_activation * cell.icm["gp130"] -
-                           rates.k_degradation * cell.icm["STAT"];
-
-  cell.icm_rates["NFKB"] =
-      rates.k_activation * cell.icm["IL1RI"] -
-      rates.k_inhibition * cell.icm["NFKB"] * cell.icm["ERX"] +
-      rates.k_activation * cell.icm["ERK"] -
-      rates.k_inhibition * cell.icm["NFKB"] * cell.icm["ERX"] +
-      rates.k_activation * cell.icm["p38"] -
-      rates.k_inhibition * cell.icm["NFKB"] * cell.icm["ERX"] +
-      rates.k_activation * cell.icm["Akt"] -
-      rates.k_inhibition * cell.icm["NFKB"] * cell.icm["ERX"] -
-      rates.k_degradation * cell.icm["NFKB"];
-
-  cell.icm_rates["SRF"] = rates.k_activation * cell.icm["MRTF"] -
-                          rates.k_degradation * cell.icm["SRF"];
-
-  cell.icm_rates["MRTF"] =
-      rates.k_activation * cell.icm["NFAT"] -
-      rates.k_inhibition * cell.icm["MRTF"] * cell.icm["Gactin"] -
-      rates.k_degradation * cell.icm["MRTF"];
-
-  // MAPK pathways - ODE form
-  cell.icm_rates["Ras"] =
-      rates.k_activation * (cell.icm["AT1R"] + cell.icm["Grb2"]) -
-      rates.k_degradation * cell.icm["Ras"];
-
-  cell.icm_rates["Raf"] = rates.k_activation * cell.icm["Ras"] -
-                          rates.k_degradation * cell.icm["Raf"];
-
-  cell.icm_rates["MEK1"] =
-      rates.k_activation * cell.icm["Raf"] -
-      rates.k_inhibition * cell.icm["MEK1"] * cell.icm["ERK"] -
-      rates.k_degradation * cell.icm["MEK1"];
-
-  cell.icm_rates["ERK"] =
-      rates.k_activation * cell.icm["MEK1"] -
-      rates.k_inhibition * cell.icm["ERK"] * cell.icm["PP1"] +
-      rates.k_activation * cell.icm["ROS"] -
-      rates.k_inhibition * cell.icm["ERK"] * cell.icm["AT2R"] -
-      rates.k_degradation * cell.icm["ERK"];
-
-  cell.icm_rates["p38"] =
-      rates.k_activation * cell.icm["ROS"] +
-      rates.k_activation * cell.icm["MKK3"] +
-      rates.k_activation * cell.icm["Ras"] +
-      rates.k_activation * cell.icm["Rho"] -
-      rates.k_inhibition * cell.icm["p38"] * cell.icm["Rac1"] -
-      rates.k_degradation * cell.icm["p38"];
-
-  cell.icm_rates["JNK"] =
-      rates.k_activation * cell.icm["ROS"] +
-      rates.k_activation * cell.icm["MKK4"] -
-      rates.k_inhibition * cell.icm["JNK"] * cell.icm["NFKB"] -
-      rates.k_inhibition * cell.icm["JNK"] * cell.icm["Rho"] -
-      rates.k_degradation * cell.icm["JNK"];
-
-  cell.icm_rates["MKK3"] = rates.k_activation * cell.icm["ASK1"] -
-                           rates.k_degradation * cell.icm["MKK3"];
-
-  cell.icm_rates["MKK4"] =
-      rates.k_activation * (cell.icm["MEKK1"] + cell.icm["ASK1"]) -
-      rates.k_degradation * cell.icm["MKK4"];
-
-  cell.icm_rates["MEKK1"] =
-      rates.k_activation * (cell.icm["FAK"] + cell.icm["Rac1"]) -
-      rates.k_degradation * cell.icm["MEKK1"];
-
-  cell.icm_rates["ASK1"] =
-      rates.k_activation * (cell.icm["TRAF"] + cell.icm["IL1RI"]) -
-      rates.k_degradation * cell.icm["ASK1"];
-
-  cell.icm_rates["TRAF"] =
-      rates.k_activation * (cell.icm["TGFB1R"] + cell.icm["TNFaR"]) -
-      rates.k_degradation * cell.icm["TRAF"];
-
-  // PI3K-Akt-mTOR pathway - ODE form
-  cell.icm_rates["PI3K"] =
-      rates.k_activation * (cell.icm["TNFaR"] + cell.icm["TGFB1R"] +
-                            cell.icm["PDGFR"] + cell.icm["FAK"]) -
-      rates.k_degradation * cell.icm["PI3K"];
-
-  cell.icm_rates["Akt"] =
-      rates.k_activation * (cell.icm["PI3K"] * cell.icm["mTORC2"]) +
-      rates.k_activation * cell.icm["ERX"] +
-      rates.k_activation * cell.icm["GPR30"] -
-      rates.k_degradation * cell.icm["Akt"];
-
-  cell.icm_rates["mTORC1"] = rates.k_activation * cell.icm["Akt"] -
-                             rates.k_degradation * cell.icm["mTORC1"];
-
-  cell.icm_rates["mTORC2"] =
-      rates.k_activation -
-      rates.k_inhibition * cell.icm["mTORC2"] * cell.icm["p70S6K"] -
-      rates.k_degradation * cell.icm["mTORC2"];
-
-  cell.icm_rates["p70S6K"] = rates.k_activation * cell.icm["mTORC1"] -
-                             rates.k_degradation * cell.icm["p70S6K"];
-
-  cell.icm_rates["EBP1"] =
-      rates.k_activation -
-      rates.k_inhibition * cell.icm["EBP1"] * cell.icm["mTORC1"] -
-      rates.k_degradation * cell.icm["EBP1"];
-
-  // Rho/ROCK pathway - ODE form
-  cell.icm_rates["Rho"] =
-      rates.k_activation * cell.icm["TGFB1R"] +
-      rates.k_activation * cell.icm["RhoGEF"] -
-      rates.k_inhibition * cell.icm["Rho"] * cell.icm["RhoGDI"] -
-      rates.k_inhibition * cell.icm["Rho"] * cell.icm["PKG"] -
-      rates.k_degradation * cell.icm["Rho"];
-
-  cell.icm_rates["ROCK"] = rates.k_activation * cell.icm["Rho"] -
-                           rates.k_degradation * cell.icm["ROCK"];
-
-  cell.icm_rates["RhoGEF"] =
-      rates.k_activation * (cell.icm["FAK"] * cell.icm["Src"]) -
-      rates.k_degradation * cell.icm["RhoGEF"];
-
-  cell.icm_rates["RhoGDI"] =
-      rates.k_activation -
-      rates.k_inhibition * cell.icm["RhoGDI"] * cell.icm["Src"] +
-      rates.k_activation * cell.icm["PKA"] + rates.k_activation -
-      rates.k_inhibition * cell.icm["RhoGDI"] * cell.icm["PKC"] -
-      rates.k_degradation * cell.icm["RhoGDI"];
-
-  // Cytoskeleton and adhesion - ODE form
-  cell.icm_rates["Factin"] =
-      rates.k_activation * (cell.icm["ROCK"] * cell.icm["Gactin"]) -
-      rates.k_degradation * cell.icm["Factin"];
-
-  cell.icm_rates["Gactin"] =
-      rates.k_activation -
-      rates.k_inhibition * cell.icm["Gactin"] * cell.icm["Factin"] -
-      rates.k_degradation * cell.icm["Gactin"];
-
-  cell.icm_rates["B1int"] =
-      rates.k_activation * cell.icm["tension"] +
-      rates.k_activation * (cell.icm["PKC"] * cell.icm["tension"]) -
-      rates.k_degradation * cell.icm["B1int"];
-
-  cell.icm_rates["B3int"] =
-      rates.k_activation * cell.icm["tension"] -
-      rates.k_inhibition * cell.icm["B3int"] * cell.icm["thrombospondin4"] +
-      rates.k_activation * cell.icm["osteopontin"] -
-      rates.k_degradation * cell.icm["B3int"];
-
-  cell.icm_rates["FAK"] = rates.k_activation * cell.icm["B1int"] -
-                          rates.k_degradation * cell.icm["FAK"];
-
-  cell.icm_rates["Src"] =
-      rates.k_activation * (cell.icm["PDGFR"] + cell.icm["B3int"]) -
-      rates.k_degradation * cell.icm["Src"];
-
-  cell.icm_rates["Grb2"] =
-      rates.k_activation * (cell.icm["FAK"] * cell.icm["Src"]) -
-      rates.k_degradation * cell.icm["Grb2"];
-
-  cell.icm_rates["p130Cas"] =
-      rates.k_activation * (cell.icm["tension"] * cell.icm["Src"] +
-                            cell.icm["FAK"] * cell.icm["Src"]) -
-      rates.k_degradation * cell.icm["p130Cas"];
-
-  cell.icm_rates["Rac1"] =
-      rates.k_activation * cell.icm["abl"] +
-      rates.k_activation * (cell.icm["p130Cas"] * cell.icm["abl"]) -
-      rates.k_degradation * cell.icm["Rac1"];
-
-  cell.icm_rates["abl"] = rates.k_activation * cell.icm["PDGFR"] -
-                          rates.k_degradation * cell.icm["abl"];
-
-  cell.icm_rates["talin"] =
-      rates.k_activation * (cell.icm["B1int"] + cell.icm["B3int"]) -
-      rates.k_degradation * cell.icm["talin"];
-
-  cell.icm_rates["vinculin"] =
-      rates.k_activation * (cell.icm["contractility"] * cell.icm["talin"]) -
-      rates.k_degradation * cell.icm["vinculin"];
-
-  cell.icm_rates["paxillin"] =
-      rates.k_activation *
-          (cell.icm["FAK"] * cell.icm["Src"] * cell.icm["MLC"]) -
-      rates.k_degradation * cell.icm["paxillin"];
-
-  cell.icm_rates["FA"] =
-      rates.k_activation * (cell.icm["vinculin"] * cell.icm["CDK1"]) -
-      rates.k_inhibition * cell.icm["FA"] * cell.icm["paxillin"] -
-      rates.k_degradation * cell.icm["FA"];
-
-  cell.icm_rates["MLC"] = rates.k_activation * cell.icm["ROCK"] -
-                          rates.k_degradation * cell.icm["MLC"];
-
-  cell.icm_rates["contractility"] =
-      rates.k_activation * (cell.icm["Factin"] * cell.icm["MLC"] +
-                            cell.icm["aSMA"] * cell.icm["MLC"]) -
-      rates.k_degradation * cell.icm["contractility"];
-
-  // YAP/TAZ signaling - ODE form
-  cell.icm_rates["YAP"] =
-      rates.k_activation * (cell.icm["AT1R"] + cell.icm["Factin"]) -
-      rates.k_degradation * cell.icm["YAP"];
-
-  // Estrogen signaling - ODE form
-  cell.icm_rates["ERX"] = rates.k_activation * cell.icm["E2"] -
-                          rates.k_degradation * cell.icm["ERX"];
-
-  cell.icm_rates["ERB"] = rates.k_activation * cell.icm["E2"] -
-                          rates.k_degradation * cell.icm["ERB"];
-
-  cell.icm_rates["GPR30"] = rates.k_activation * cell.icm["E2"] -
-                            rates.k_degradation * cell.icm["GPR30"];
-
-  cell.icm_rates["CyclinB1"] =
-      rates.k_activation -
-      rates.k_inhibition * cell.icm["CyclinB1"] * cell.icm["GPR30"] -
-      rates.k_degradation * cell.icm["CyclinB1"];
-
-  cell.icm_rates["CDK1"] =
-      rates.k_activation * (cell.icm["CyclinB1"] * cell.icm["AngII"]) -
-      rates.k_degradation * cell.icm["CDK1"];
-
-  // Additional components needed for calculations
-  cell.icm_rates["AGT"] = rates.k_activation * (1.0 - cell.icm["AT1R"]) *
-                              (1.0 - cell.icm["JNK"]) * cell.icm["p38"] -
-                          rates.k_degradation * cell.icm["AGT"];
-
-  cell.icm_rates["ACE"] = rates.k_activation * cell.icm["TGFB1R"] -
-                          rates.k_degradation * cell.icm["ACE"];
-
-  cell.icm_rates["BAMBI"] =
-      rates.k_activation * (cell.icm["TGFB"] * cell.icm["IL1RI"]) -
-      rates.k_degradation * cell.icm["BAMBI"];
-
-  cell.icm_rates["smad3"] =
-      rates.k_activation * cell.icm["TGFB1R"] -
-      rates.k_inhibition * cell.icm["smad3"] * cell.icm["smad7"] -
-      rates.k_inhibition * cell.icm["smad3"] * cell.icm["PKG"] -
-      rates.k_inhibition * cell.icm["smad3"] * cell.icm["ERB"] +
-      rates.k_activation * cell.icm["Akt"] -
-      rates.k_degradation * cell.icm["smad3"];
-
-  cell.icm_rates["smad7"] =
-      rates.k_activation * cell.icm["STAT"] +
-      rates.k_activation * cell.icm["AP1"] -
-      rates.k_inhibition * cell.icm["smad7"] * cell.icm["YAP"] -
-      rates.k_degradation * cell.icm["smad7"];
-
-  cell.icm_rates["epac"] = rates.k_activation * cell.icm["cAMP"] -
-                           rates.k_degradation * cell.icm["epac"];
-
-  cell.icm_rates["cmyc"] = rates.k_activation * cell.icm["JNK"] -
-                           rates.k_degradation * cell.icm["cmyc"];
-
-  cell.icm_rates["proliferation"] =
-      rates.k_activation *
-          (cell.icm["CDK1"] + cell.icm["AP1"] + cell.icm["CREB"] +
-            cell.icm["CTGF"] + cell.icm["PKC"] + cell.icm["p70S6K"]) -
-      rates.k_inhibition * cell.icm["proliferation"] * cell.icm["EBP1"] +
-      rates.k_activation * cell.icm["cmyc"] -
-      rates.k_degradation * cell.icm["proliferation"];
-
-  cell.icm_rates["latentTGFB"] = rates.k_activation * cell.icm["AP1"] -
-                                 rates.k_degradation * cell.icm["latentTGFB"];
-
-  cell.icm_rates["thrombospondin4"] =
-      rates.k_activation * cell.icm["smad3"] -
-      rates.k_degradation * cell.icm["thrombospondin4"];
-
-  cell.icm_rates["osteopontin"] = rates.k_activation * cell.icm["AP1"] -
-                                  rates.k_degradation * cell.icm["osteopontin"];
-
-  cell.icm_rates["syndecan4"] =
-      rates.k_activation * cell.icm["tension"] -
-      rates.k_inhibition * cell.icm["syndecan4"] * cell.icm["TNC"] -
-      rates.k_degradation * cell.icm["syndecan4"];
-
-  cell.icm_rates["aSMA"] =
-      rates.k_activation *
-          (cell.icm["YAP"] + cell.icm["smad3"] * cell.icm["CBP"] +
-            cell.icm["SRF"]) -
-      rates.k_degradation * cell.icm["aSMA"];
-
-  cell.icm_rates["LOX"] = rates.k_activation * cell.icm["Akt"] -
-                          rates.k_degradation * cell.icm["LOX"];
-
-  // ECM production rates based on intracellular signaling - ODE form
-  cell.icm_rates["proCI"] =
-      rates.k_activation * cell.icm["SRF"] +
-      rates.k_activation * (cell.icm["smad3"] * cell.icm["CBP"]) -
-      rates.k_inhibition * cell.icm["proCI"] * cell.icm["epac"] -
-      rates.k_degradation * cell.icm["proCI"];
-
-  cell.icm_rates["proCIII"] =
-      rates.k_activation * cell.icm["SRF"] +
-      rates.k_activation * (cell.icm["smad3"] * cell.icm["CBP"]) -
-      rates.k_inhibition * cell.icm["proCIII"] * cell.icm["epac"] -
-      rates.k_degradation * cell.icm["proCIII"];
-
-  cell.icm_rates["fibronectin"] =
-      rates.k_activation * (cell.icm["smad3"] * cell.icm["CBP"]) +
-      rates.k_activation * cell.icm["NFKB"] -
-      rates.k_degradation * cell.icm["fibronectin"];
-
-  cell.icm_rates["periostin"] =
-      rates.k_activation * (cell.icm["smad3"] * cell.icm["CBP"]) +
-      rates.k_activation * (cell.icm["CREB"] * cell.icm["CBP"]) -
-      rates.k_degradation * cell.icm["periostin"];
-
-  cell.icm_rates["TNC"] =
-      rates.k_activation * (cell.icm["NFKB"] + cell.icm["MRTF"]) -
-      rates.k_degradation * cell.icm["TNC"];
-
-  cell.icm_rates["PAI1"] =
-      rates.k_activation * (cell.icm["smad3"] + cell.icm["YAP"]) -
-      rates.k_degradation * cell.icm["PAI1"];
-
-  cell.icm_rates["CTGF"] =
-      rates.k_activation *
-          (cell.icm["smad3"] * cell.icm["CBP"] * cell.icm["ERK"]) +
-      rates.k_activation * cell.icm["YAP"] -
-      rates.k_degradation * cell.icm["CTGF"];
-
-  cell.icm_rates["EDAFN"] = rates.k_activation * cell.icm["NFAT"] -
-                            rates.k_degradation * cell.icm["EDAFN"];
-
-  // MMPs and TIMPs - ODE form
-  cell.icm_rates["proMMP1"] =
-      rates.k_activation * (cell.icm["NFKB"] * cell.icm["AP1"]) -
-      rates.k_inhibition * cell.icm["proMMP1"] * cell.icm["smad3"] -
-      rates.k_degradation * cell.icm["proMMP1"];
-
-  cell.icm_rates["proMMP2"] =
-      rates.k_activation * (cell.icm["AP1"] + cell.icm["STAT"]) -
-      rates.k_degradation * cell.icm["proMMP2"];
-
-  cell.icm_rates["proMMP3"] =
-      rates.k_activation * (cell.icm["NFKB"] * cell.icm["AP1"]) -
-      rates.k_inhibition * cell.icm["proMMP3"] * cell.icm["smad3"] -
-      rates.k_degradation * cell.icm["proMMP3"];
-
-  cell.icm_rates["proMMP8"] =
-      rates.k_activation * (cell.icm["NFKB"] * cell.icm["AP1"]) -
-      rates.k_inhibition * cell.icm["proMMP8"] * cell.icm["smad3"] -
-      rates.k_degradation * cell.icm["proMMP8"];
+// Diffusion time due after the reaction of a step: the rest of the window
+// once it is complete
+double diffusionAfter(DiffusionClock &clock, double delta_t) {
+  clock.elapsed += delta_t;
+  if (++clock.count < clock.interval)
+    return 0.0;
+  const double due = clock.elapsed - clock.lead;
+  clock = DiffusionClock{clock.interval};
+  return due;
+}
 
-  cell.icm_rates["proMMP9"] =
-      rates.k_activation *
-          (cell.icm["STAT"] + cell.icm["NFKB"] * cell.icm["AP1"]) -
-      rates.k_degradation * cell.icm["proMMP9"];
+// True if a step is a single reaction followed by both diffusions, which
+// the fused sweep covers
+inline bool fusableStep() {
+  return fused_sweep && diffusionScheme() == EXPLICIT_DIFFUSION &&
+         !active_set && !compression && !strang_splitting &&
+         !sensitivityStep() &&
+         reaction_substeps == 1 &&
+         feedback_clock.interval == 1 && ecm_clock.interval == 1;
+}
 
-  cell.icm_rates["proMMP12"] = rates.k_activation * cell.icm["CREB"] -
-                               rates.k_degradation * cell.icm["proMMP12"];
+// Reaction pass of a step: every cell, one block of rows per thread, or
+// once per equivalence class
+void reactCells(double delta_t) {
+  PhaseTimer timer(PROFILE_REACTION);
+  if (compressedStep()) {
+    reactClasses(delta_t);
+    class_count = (int)class_first.size();
+    timer.cells = class_count;
+  } else {
+    if (timer.active())
+      timer.cells = processedCells();
+    pool.runRows(state.rows, [&](int row_begin, int row_end, int thread) {
+      reactRows(row_begin, row_end, delta_t, thread);
+    });
+    class_count = 0;
+  }
+}
 
-  cell.icm_rates["proMMP14"] =
-      rates.k_activation * (cell.icm["AP1"] + cell.icm["NFKB"]) -
-      rates.k_degradation * cell.icm["proMMP14"];
-
-  cell.icm_rates["TIMP1"] = rates.k_activation * cell.icm["AP1"] -
-                            rates.k_degradation * cell.icm["TIMP1"];
+// One step of delta_t > 0 with the rates already prepared
+void advance(double delta_t) {
+    if (profiling) {
+        for (int p = 0; p < NUM_PROFILE_PHASES; p++) {
+            if (p != PROFILE_READBACK)
+                profile[p].last_ns = 0.0;
+        }
+    }
+    PhaseTimer timer(PROFILE_STEP);
+    timer.cells = state.num_cells;
+
+    simulation_time += delta_t;
+    if (fusableStep()) {
+        sweepFused(delta_t);
+        active_fraction = 1.0;
+        class_count = 0;
+        return;
+    }
 
-  cell.icm_rates["TIMP2"] = rates.k_activation * cell.icm["AP1"] -
-                            rates.k_degradation * cell.icm["TIMP2"];
+    // First half of the diffusion windows starting here (Strang splitting)
+    double h = diffusionBefore(ecm_clock, delta_t);
+    if (h > 0.0)
+        diffuseECMMolecules(h);
+    h = diffusionBefore(feedback_clock, delta_t);
+    if (h > 0.0)
+        diffuseFeedbackMolecules(h);
 
-  // Feedback mechanisms - ODE form
-  cell.feedback_rates["TGFBfb"] =
-      rates.k_activation * (cell.icm["proMMP9"] * cell.icm["latentTGFB"] +
-                            cell.icm["proMMP2"] * cell.icm["latentTGFB"] +
-                            cell.icm["tension"] * cell.icm["latentTGFB"]) -
-      rates.k_degradation * cell.feedback["TGFBfb"];
+    // Update all cells with ODE integration
+    reactCells(delta_t);
 
-  cell.feedback_rates["AngIIfb"] =
-      rates.k_activation * (cell.icm["ACE"] * cell.icm["AGT"]) -
-      rates.k_degradation * cell.feedback["AngIIfb"];
+    // Diffuse feedback molecules between cells
+    h = diffusionAfter(feedback_clock, delta_t);
+    if (h > 0.0)
+        diffuseFeedbackMolecules(h);
 
-  cell.feedback_rates["IL6fb"] =
-      rates.k_activation * (cell.icm["CREB"] * cell.icm["CBP"] +
-                            cell.icm["NFKB"] + cell.icm["AP1"]) -
-      rates.k_degradation * cell.feedback["IL6fb"];
+    // Diffuse ECM molecules between cells
+    h = diffusionAfter(ecm_clock, delta_t);
+    if (h > 0.0)
+        diffuseECMMolecules(h);
+
+    if (skippingCells())
+        updateActiveSet(delta_t);
+    else
+        active_fraction = 1.0;
+}
 
-  cell.feedback_rates["ET1fb"] = rates.k_activation * cell.icm["AP1"] -
-                                 rates.k_degradation * cell.feedback["ET1fb"];
+// Simulation step with variable time step (fixed version). delta_t <= 0
+// advances by the time step set with setTimeStep.
+EMSCRIPTEN_KEEPALIVE
+void simulateStep(double delta_t = 0.0) {
+    if (!(delta_t > 0.0))
+        delta_t = rates.time_step;
+    prepareRates();
+    advance(delta_t);
+}
 
-  cell.feedback_rates["tensionfb"] =
-      rates.k_activation * (cell.icm["FA"] * cell.icm["contractility"]) -
-      rates.k_degradation * cell.feedback["tensionfb"];
+// After the taken-th step of a batch started at start: run the callback if
+// it is due and check the time budget. False if the batch stops here.
+bool continueBatch(int taken, std::chrono::steady_clock::time_point start) {
+  if (step_callback && taken % callback_interval == 0) {
+    if (step_callback(taken, simulation_time) != 0)
+      return false;
+    prepareRates(); // The callback may have changed parameters
+  }
+  if (step_budget > 0.0) {
+    const std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+    if (elapsed.count() >= step_budget)
+      return false;
+  }
+  return true;
+}
 
-  // ECM production rates - ODE form
-  cell.ecm_rates["proCI"] = rates.k_production * cell.icm["proCI"] -
-                            rates.k_degradation * 0.01 * cell.ecm["proCI"];
+// Take up to steps steps of delta_t (the time step set with setTimeStep if
+// delta_t <= 0) in one call. Stops early when the step callback asks to or
+// the time budget runs out, but always takes at least one step. Returns the
+// number of steps taken.
+EMSCRIPTEN_KEEPALIVE
+int simulateSteps(int steps, double delta_t) {
+  if (!(delta_t > 0.0))
+    delta_t = rates.time_step;
+  const auto start = std::chrono::steady_clock::now();
+  prepareRates();
+  int taken = 0;
+  while (taken < steps) {
+    advance(delta_t);
+    if (!continueBatch(++taken, start))
+      break;
+  }
+  return taken;
+}
 
-  cell.ecm_rates["proCIII"] = rates.k_production * cell.icm["proCIII"] -
-                              rates.k_degradation * 0.01 * cell.ecm["proCIII"];
+// Advance to end_time in steps set with setTimeStep, the last one shortened
+// to end there. Stops early like simulateSteps. Returns the number of steps
+// taken.
+EMSCRIPTEN_KEEPALIVE
+int runUntil(double end_time) {
+  if (!(rates.time_step > 0.0))
+    return 0;
+  const auto start = std::chrono::steady_clock::now();
+  prepareRates();
+  int taken = 0;
+  // Round-off in the accumulated time must not cost an extra sliver step
+  while (end_time - simulation_time > 1e-9 * rates.time_step) {
+    advance(std::min(rates.time_step, end_time - simulation_time));
+    if (!continueBatch(++taken, start))
+      break;
+  }
+  return taken;
+}
 
-  cell.ecm_rates["proMMP1"] = rates.k_production * cell.icm["proMMP1"] -
-                              rates.k_degradation * 0.01 * cell.ecm["proMMP1"];
+// Call callback(steps, time) after every interval steps of simulateSteps
+// and runUntil, with the steps taken so far in the call and the simulation
+// time. A nonzero return value ends the call. A null callback removes it.
+// From JavaScript, create the callback with addFunction(fn, 'iid').
+EMSCRIPTEN_KEEPALIVE
+void setStepCallback(StepCallback callback, int interval) {
+  step_callback = callback;
+  callback_interval = std::max(1, interval);
+}
 
-  cell.ecm_rates["proMMP2"] = rates.k_production * cell.icm["proMMP2"] -
-                              rates.k_degradation * 0.01 * cell.ecm["proMMP2"];
+// Wall-clock budget in milliseconds for one simulateSteps or runUntil call,
+// e.g. the share of a 60 fps frame the UI can spend. ms <= 0 removes it.
+EMSCRIPTEN_KEEPALIVE
+void setTimeBudget(double ms) { step_budget = ms > 0.0 ? ms : 0.0; }
 
-  cell.ecm_rates["proMMP3"] = rates.k_production * cell.icm["proMMP3"] -
-                              rates.k_degradation * 0.01 * cell.ecm["proMMP3"];
+EMSCRIPTEN_KEEPALIVE
+double getTimeBudget() { return step_budget; }
 
-  cell.ecm_rates["proMMP8"] = rates.k_production * cell.icm["proMMP8"] -
-                              rates.k_degradation * 0.01 * cell.ecm["proMMP8"];
+// Time simulated since initializeGrid
+EMSCRIPTEN_KEEPALIVE
+double getSimulationTime() { return simulation_time; }
+
+// Phases benchmarkPhase times
+enum BenchmarkPhase {
+  BENCH_RATES = 0,     // calculateRates over the grid, state unchanged
+  BENCH_REACTION = 1,  // Reaction pass (updateCells) of a step
+  BENCH_FEEDBACK = 2,  // diffuseFeedbackMolecules
+  BENCH_ECM = 3,       // diffuseECMMolecules
+  BENCH_STEP = 4       // simulateStep
+};
 
-  cell.ecm_rates["proMMP9"] = rates.k_production * cell.icm["proMMP9"] -
-                              rates.k_degradation * 0.01 * cell.ecm["proMMP9"];
+// Run one phase of a step repeats times with time step delta_t (the
+// setTimeStep step if delta_t <= 0) using the current options and thread
+// count, and return the mean wall-clock time of a run in nanoseconds, or -1
+// for an unknown phase or before initializeGrid. Every phase but
+// BENCH_RATES advances the state, and the phases run on their own do not
+// advance the simulation time, so reinitialize the grid before simulating.
+EMSCRIPTEN_KEEPALIVE
+double benchmarkPhase(int phase, int repeats, double delta_t) {
+  if (phase < BENCH_RATES || phase > BENCH_STEP || state.num_cells == 0)
+    return -1.0;
+  if (!(delta_t > 0.0))
+    delta_t = rates.time_step;
+  repeats = std::max(1, repeats);
+  prepareRates();
+
+  const auto start = std::chrono::steady_clock::now();
+  for (int r = 0; r < repeats; r++) {
+    switch (phase) {
+    case BENCH_RATES:
+      pool.runRows(state.rows, [&](int row_begin, int row_end, int thread) {
+        const int end = row_end * state.cols;
+        for (int tile = row_begin * state.cols; tile < end; tile += RATE_TILE)
+          calculateRates(tile, std::min(tile + RATE_TILE, end), thread);
+      });
+      break;
+    case BENCH_REACTION:
+      reactCells(delta_t);
+      break;
+    case BENCH_FEEDBACK:
+      diffuseFeedbackMolecules(delta_t);
+      break;
+    case BENCH_ECM:
+      diffuseECMMolecules(delta_t);
+      break;
+    case BENCH_STEP:
+      advance(delta_t);
+      break;
+    }
+  }
+  const std::chrono::duration<double, std::nano> elapsed =
+      std::chrono::steady_clock::now() - start;
+  return elapsed.count() / repeats;
+}
 
-  cell.ecm_rates["proMMP12"] =
-      rates.k_production * cell.icm["proMMP12"] -
-      rates.k_degradation * 0.01 * cell.ecm["proMMP12"];
+// Turn the phase profile on or off. Off (the default), the phases only test
+// the flag; turning it on or off keeps the counters.
+EMSCRIPTEN_KEEPALIVE
+void setProfiling(int enabled) { profiling = enabled != 0; }
 
-  cell.ecm_rates["proMMP14"] =
-      rates.k_production * cell.icm["proMMP14"] -
-      rates.k_degradation * 0.01 * cell.ecm["proMMP14"];
+EMSCRIPTEN_KEEPALIVE
+int getProfiling() { return profiling ? 1 : 0; }
 
-  cell.ecm_rates["TIMP1"] = rates.k_production * cell.icm["TIMP1"] -
-                            rates.k_degradation * 0.01 * cell.ecm["TIMP1"];
+// Zero the counters of every phase
+EMSCRIPTEN_KEEPALIVE
+void resetProfile() {
+  for (PhaseProfile &p : profile)
+    p = PhaseProfile();
+}
 
-  cell.ecm_rates["TIMP2"] = rates.k_production * cell.icm["TIMP2"] -
-                            rates.k_degradation * 0.01 * cell.ecm["TIMP2"];
+// Counters of the profiled phases as a flat array of 5 x 5 doubles, one row
+// per phase (reaction, feedback diffusion, ECM diffusion, readback, whole
+// step): cumulative nanoseconds, nanoseconds in the last step (readback:
+// the last call), calls, bytes allocated and cells processed (readback:
+// values copied). The bytes are every allocation the engine makes while
+// stepping or reading back: the compression classes, the ensemble rates and
+// the Jacobian pattern when a step first needs them, and the arrays
+// getECMData and getFeedbackData return. Setters allocate up front and are
+// not counted. Steps per second are calls / cumulative seconds of the step
+// row. The array is owned by the engine and rewritten by the next call.
+EMSCRIPTEN_KEEPALIVE
+double *getProfile() {
+  for (int p = 0; p < NUM_PROFILE_PHASES; p++) {
+    double *row = profile_values + p * PROFILE_VALUES;
+    row[0] = profile[p].total_ns;
+    row[1] = profile[p].last_ns;
+    row[2] = profile[p].calls;
+    row[3] = profile[p].allocated_bytes;
+    row[4] = profile[p].cells;
+  }
+  return profile_values;
+}
 
-  cell.ecm_rates["fibronectin"] =
-      rates.k_production * cell.icm["fibronectin"] -
-      rates.k_degradation * 0.01 * cell.ecm["fibronectin"];
+// Copy a species field into a freshly allocated array (freed with freeData)
+double *copyField(int species) {
+  PhaseTimer timer(PROFILE_READBACK);
+  timer.cells = state.num_cells;
+  double *result = (double *)malloc((size_t)state.num_cells * sizeof(double));
+  allocated_bytes += (size_t)state.num_cells * sizeof(double);
+  std::copy(field(species), field(species) + state.num_cells, result);
+  return result;
+}
 
-  cell.ecm_rates["periostin"] =
-      rates.k_production * cell.icm["periostin"] -
-      rates.k_degradation * 0.01 * cell.ecm["periostin"];
+// Functions for getting ECM data - returns array of values for a specific molecule
+EMSCRIPTEN_KEEPALIVE
+double *getECMData(int molecule_index) {
+  return copyField(ecmSpecies(molecule_index));
+}
 
-  cell.ecm_rates["TNC"] = rates.k_production * cell.icm["TNC"] -
-                          rates.k_degradation * 0.01 * cell.ecm["TNC"];
+// Function for getting feedback data
+EMSCRIPTEN_KEEPALIVE
+double *getFeedbackData(int molecule_index) {
+  return copyField(feedbackSpecies(molecule_index));
+}
 
-  cell.ecm_rates["PAI1"] = rates.k_production * cell.icm["PAI1"] -
-                           rates.k_degradation * 0.01 * cell.ecm["PAI1"];
+// Function to free allocated memory
+EMSCRIPTEN_KEEPALIVE
+void freeData(double *ptr) { free(ptr); }
 
-  cell.ecm_rates["CTGF"] = rates.k_production * cell.icm["CTGF"] -
-                           rates.k_degradation * 0.01 * cell.ecm["CTGF"];
+// Function to read a specific cell value from a data array
+EMSCRIPTEN_KEEPALIVE
+double readDataValue(double *data, int i, int j) {
+  return data[(size_t)i * state.cols + j];
+}
 
-  cell.ecm_rates["EDAFN"] = rates.k_production * cell.icm["EDAFN"] -
-                            rates.k_degradation * 0.01 * cell.ecm["EDAFN"];
+// Zero-copy views. A view is the engine's own field of a species: rows
+// rows of getFieldStride() values, row-major, so JavaScript can wrap it
+// as new Float64Array(HEAPF64.buffer, view, rows * stride) without a copy
+// (Float32Array over HEAPF32 when getFieldBytes() is 4). Diffusion swaps
+// field buffers, so a view is valid until the next step or until the grid
+// or network changes; fetch it again each frame and never free it. Returns
+// null for an unknown species.
+EMSCRIPTEN_KEEPALIVE
+const Scalar *getFieldView(int species) {
+  if (species < 0 || species >= state.num_species || state.num_cells == 0)
+    return nullptr;
+  return field(species);
 }
 
-// Update cell state using Euler integration
-void updateCell(Cell &cell, double delta_t) {
-  // Calculate rates of change
-  calculateRates(cell);
+EMSCRIPTEN_KEEPALIVE
+const Scalar *getECMView(int molecule_index) {
+  return getFieldView(ecmSpecies(molecule_index));
+}
 
-  // Update intracellular molecules using Euler method
-  for (auto &[key, rate] : cell.icm_rates) {
-    cell.icm[key] += rate * delta_t;
+EMSCRIPTEN_KEEPALIVE
+const Scalar *getFeedbackView(int molecule_index) {
+  return getFieldView(feedbackSpecies(molecule_index));
+}
 
-    // Ensure values stay within bounds
-    if (cell.icm[key] < 0.0)
-      cell.icm[key] = 0.0;
-    if (cell.icm[key] > 1.0)
-      cell.icm[key] = 1.0;
-  }
+// Values from one grid row of a view to the next
+EMSCRIPTEN_KEEPALIVE
+int getFieldStride() { return state.cols; }
 
-  // Update ECM molecules using Euler method
-  for (auto &[key, rate] : cell.ecm_rates) {
-    cell.ecm[key] += rate * delta_t;
+// Bytes per value of a view: 8, or 4 in a float32 build
+EMSCRIPTEN_KEEPALIVE
+int getFieldBytes() { return (int)sizeof(Scalar); }
 
-    // Ensure values stay within bounds
-    if (cell.ecm[key] < 0.0)
-      cell.ecm[key] = 0.0;
-    if (cell.ecm[key] > 1.0)
-      cell.ecm[key] = 1.0;
-  }
+// Species of the active network, including those a loaded network adds
+EMSCRIPTEN_KEEPALIVE
+int getSpeciesCount() { return state.num_species; }
 
-  // Update feedback molecules using Euler method
-  for (auto &[key, rate] : cell.feedback_rates) {
-    cell.feedback[key] += rate * delta_t;
+// Input molecules: species 0 .. getInputCount() - 1, which are also their
+// molecule indices in setInputConcentration
+static_assert(sp::FIRST_INPUT == 0, "the inputs must be the first species");
+EMSCRIPTEN_KEEPALIVE
+int getInputCount() { return sp::NUM_INPUTS; }
 
-    // Ensure values stay within bounds
-    if (cell.feedback[key] < 0.0)
-      cell.feedback[key] = 0.0;
-    if (cell.feedback[key] > 1.0)
-      cell.feedback[key] = 1.0;
-  }
+// Species index of a molecule name, -1 if unknown
+EMSCRIPTEN_KEEPALIVE
+int getSpeciesIndex(const char *name) {
+  return networkSpeciesIndex(network, name);
 }
 
-// Fixed diffusion function to handle boundary effects properly
-void diffuseFeedbackMolecules(double delta_t) {
-    // Create a temporary copy of the grid for diffusion calculations
-    auto temp_grid = grid;
-
-    // Diffuse feedback molecules using a simple diffusion equation
-    for (int i = 0; i < GRID_SIZE; i++) {
-        for (int j = 0; j < GRID_SIZE; j++) {
-            for (auto &[key, val] : grid[i][j].feedback) {
-                double laplacian = 0.0;
-                int neighbor_count = 0;
-
-                // Calculate Laplacian with proper boundary handling
-                for (int di = -1; di <= 1; di++) {
-                    for (int dj = -1; dj <= 1; dj++) {
-                        if (di == 0 && dj == 0) continue; // Skip the center cell
-                        
-                        int ni = i + di;
-                        int nj = j + dj;
-                        
-                        // Handle boundaries with periodic boundary conditions
-                        if (ni < 0) ni = GRID_SIZE - 1;
-                        if (ni >= GRID_SIZE) ni = 0;
-                        if (nj < 0) nj = GRID_SIZE - 1;
-                        if (nj >= GRID_SIZE) nj = 0;
-                        
-                        laplacian += temp_grid[ni][nj].feedback[key] - temp_grid[i][j].feedback[key];
-                        neighbor_count++;
-                    }
-                }
-
-                // Update value using diffusion equation: dC/dt = D * ∇²C
-                grid[i][j].feedback[key] += rates.k_diffusion * laplacian * delta_t;
-                
-                // Ensure values stay within bounds
-                if (grid[i][j].feedback[key] < 0.0)
-                    grid[i][j].feedback[key] = 0.0;
-                if (grid[i][j].feedback[key] > 1.0)
-                    grid[i][j].feedback[key] = 1.0;
-            }
-        }
-    }
+// Name of a species, null if out of range
+EMSCRIPTEN_KEEPALIVE
+const char *getSpeciesName(int species) {
+  if (species < 0 || species >= state.num_species)
+    return nullptr;
+  if (species < sp::NUM_SPECIES)
+    return SPECIES_NAMES[species];
+  return network.extra_species[species - sp::NUM_SPECIES].c_str();
 }
 
-// Fixed diffusion function for ECM molecules
-void diffuseECMMolecules(double delta_t) {
-    // Create a temporary copy of the grid for diffusion calculations
-    auto temp_grid = grid;
-
-    // Diffuse ECM molecules using a simple diffusion equation
-    for (int i = 0; i < GRID_SIZE; i++) {
-        for (int j = 0; j < GRID_SIZE; j++) {
-            for (auto &[key, val] : grid[i][j].ecm) {
-                double laplacian = 0.0;
-                int neighbor_count = 0;
-
-                // Calculate Laplacian with proper boundary handling
-                for (int di = -1; di <= 1; di++) {
-                    for (int dj = -1; dj <= 1; dj++) {
-                        if (di == 0 && dj == 0) continue; // Skip the center cell
-                        
-                        int ni = i + di;
-                        int nj = j + dj;
-                        
-                        // Handle boundaries with periodic boundary conditions
-                        if (ni < 0) ni = GRID_SIZE - 1;
-                        if (ni >= GRID_SIZE) ni = 0;
-                        if (nj < 0) nj = GRID_SIZE - 1;
-                        if (nj >= GRID_SIZE) nj = 0;
-                        
-                        laplacian += temp_grid[ni][nj].ecm[key] - temp_grid[i][j].ecm[key];
-                        neighbor_count++;
-                    }
-                }
-
-                // Update value using diffusion equation: dC/dt = D * ∇²C
-                // Use a lower diffusion rate for ECM molecules
-                grid[i][j].ecm[key] += (rates.k_diffusion * 0.2) * laplacian * delta_t; // Diffusion value of ECM molecules 20% of the fb molecule diffusion rate
-                
-                // Ensure values stay within bounds
-                if (grid[i][j].ecm[key] < 0.0)
-                    grid[i][j].ecm[key] = 0.0;
-                if (grid[i][j].ecm[key] > 1.0)
-                    grid[i][j].ecm[key] = 1.0;
-            }
-        }
-    }
+// Copy the fields of count species, in the order listed, into the caller's
+// buffer out of count * rows * cols values: field i is at
+// out[i * rows * cols], row-major. Returns the number of values written, 0
+// if a species is unknown.
+EMSCRIPTEN_KEEPALIVE
+int snapshotFields(const int *species, int count, double *out) {
+  return snapshot(species, count, out);
 }
 
-// Simulation step with variable time step (fixed version)
+// snapshotFields converting to single precision, e.g. for WebGL textures
 EMSCRIPTEN_KEEPALIVE
-void simulateStep(double delta_t = 0.1) {
-    // Update all cells with ODE integration
-    for (auto &row : grid) {
-        for (auto &cell : row) {
-            updateCell(cell, delta_t);
-        }
-    }
+int snapshotFieldsFloat(const int *species, int count, float *out) {
+  return snapshot(species, count, out);
+}
 
-    // Diffuse feedback molecules between cells
-    diffuseFeedbackMolecules(delta_t);
-    
-    // Diffuse ECM molecules between cells
-    diffuseECMMolecules(delta_t);
+// Bytes saveCheckpoint writes for the current state, 0 without a grid or on
+// an ensemble grid
+EMSCRIPTEN_KEEPALIVE
+double getCheckpointSize() {
+  return state.num_cells > 0 && grid_members == 1
+             ? (double)checkpointHeader().size
+             : 0.0;
 }
 
-// Functions for getting ECM data - returns array of values for a specific molecule
+// Write a checkpoint of the simulation (grid, rate constants and network
+// parameters, every species field, input overrides, simulation time and
+// diffusion windows) to out, which holds capacity bytes. The format is
+// described at CheckpointHeader. Returns the bytes written, 0 if there is
+// no grid, the grid is an ensemble or out is too small, with the reason in
+// getCheckpointError().
 EMSCRIPTEN_KEEPALIVE
-double *getECMData(int molecule_index) {
-  double *result = (double *)malloc(GRID_SIZE * GRID_SIZE * sizeof(double));
-
-  // Map molecule index to string key
-  std::string molecule;
-  switch (molecule_index) {
-  case 0:
-    molecule = "proCI";
-    break;
-  case 1:
-    molecule = "proCIII";
-    break;
-  case 2:
-    molecule = "fibronectin";
-    break;
-  case 3:
-    molecule = "periostin";
-    break;
-  case 4:
-    molecule = "TNC";
-    break;
-  case 5:
-    molecule = "PAI1";
-    break;
-  case 6:
-    molecule = "CTGF";
-    break;
-  case 7:
-    molecule = "EDAFN";
-    break;
-  case 8:
-    molecule = "TIMP1";
-    break;
-  case 9:
-    molecule = "TIMP2";
-    break;
-  case 10:
-    molecule = "proMMP1";
-    break;
-  case 11:
-    molecule = "proMMP2";
-    break;
-  case 12:
-    molecule = "proMMP3";
-    break;
-  case 13:
-    molecule = "proMMP8";
-    break;
-  case 14:
-    molecule = "proMMP9";
-    break;
-  case 15:
-    molecule = "proMMP12";
-    break;
-  case 16:
-    molecule = "proMMP14";
-    break;
-  default:
-    molecule = "proCI";
-    break;
-  }
-
-  // Copy data to result array
-  for (int i = 0; i < GRID_SIZE; i++) {
-    for (int j = 0; j < GRID_SIZE; j++) {
-      result[i * GRID_SIZE + j] = grid[i][j].ecm[molecule];
-    }
+double saveCheckpoint(void *out, double capacity) {
+  if (state.num_cells == 0) {
+    checkpoint_error = "no grid";
+    return 0.0;
+  }
+  if (grid_members > 1) {
+    checkpoint_error = "ensemble grids cannot be checkpointed";
+    return 0.0;
+  }
+  const CheckpointHeader h = checkpointHeader();
+  if (capacity < (double)h.size) {
+    checkpoint_error =
+        "buffer too small: need " + std::to_string(h.size) + " bytes";
+    return 0.0;
   }
 
-  return result;
+  unsigned char *bytes = static_cast<unsigned char *>(out);
+  memcpy(bytes, &h, sizeof(h));
+  // Zero the padding before each block so equal states give equal files
+  auto block = [&](uint64_t from, uint64_t offset) {
+    memset(bytes + from, 0, offset - from);
+    return bytes + offset;
+  };
+
+  std::vector<double> params(h.num_params);
+  rateParams(params.data());
+  params[net::NUM_PARAMS] = rates.time_step;
+  std::copy(network_params.end() - extraParams(), network_params.end(),
+            params.begin() + net::NUM_PARAMS + 1);
+  memcpy(block(sizeof(h), h.params_offset), params.data(),
+         params.size() * sizeof(double));
+
+  const size_t field_size = (size_t)state.num_cells * sizeof(Scalar);
+  unsigned char *fields = block(h.params_offset + params.size() * 8,
+                                h.fields_offset);
+  for (int s = 0; s < state.num_species; s++)
+    memcpy(fields + s * field_size, field(s), field_size);
+
+  memcpy(block(h.fields_offset + state.num_species * field_size,
+               h.overrides_offset),
+         state.input_override.data(), state.input_override.size());
+
+  if (h.steps_offset) {
+    memcpy(block(h.overrides_offset + state.input_override.size(),
+                 h.steps_offset),
+           cell_step.data(), cell_step.size() * sizeof(double));
+  }
+  return (double)h.size;
 }
 
-// Function for getting feedback data
+// Restore a checkpoint of size bytes written by saveCheckpoint, replacing
+// the grid (reallocated if its dimensions differ or it is an ensemble),
+// rate constants, fields, overrides and simulation time. The checkpoint
+// must come from a run with the same network; a float32 and a double build
+// read each other's checkpoints. The active set restarts with every block
+// awake. Returns 1 on success, 0 with the reason in getCheckpointError()
+// otherwise, in which case the state is unchanged unless the new grid could
+// not be allocated.
 EMSCRIPTEN_KEEPALIVE
-double *getFeedbackData(int molecule_index) {
-  double *result = (double *)malloc(GRID_SIZE * GRID_SIZE * sizeof(double));
-
-  // Map molecule index to string key
-  std::string molecule;
-  switch (molecule_index) {
-  case 0:
-    molecule = "TGFBfb";
-    break;
-  case 1:
-    molecule = "AngIIfb";
-    break;
-  case 2:
-    molecule = "IL6fb";
-    break;
-  case 3:
-    molecule = "ET1fb";
-    break;
-  case 4:
-    molecule = "tensionfb";
-    break;
-  default:
-    molecule = "TGFBfb";
-    break;
-  }
-
-  // Copy data to result array
-  for (int i = 0; i < GRID_SIZE; i++) {
-    for (int j = 0; j < GRID_SIZE; j++) {
-      result[i * GRID_SIZE + j] = grid[i][j].feedback[molecule];
-    }
+int loadCheckpoint(const void *data, double size) {
+  const unsigned char *bytes = static_cast<const unsigned char *>(data);
+  auto fail = [](const std::string &message) {
+    checkpoint_error = message;
+    return 0;
+  };
+
+  CheckpointHeader h;
+  if (size < (double)sizeof(h))
+    return fail("truncated checkpoint");
+  memcpy(&h, bytes, sizeof(h));
+  if (memcmp(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic)) != 0)
+    return fail("not a checkpoint");
+  if (h.version != CHECKPOINT_VERSION)
+    return fail("unsupported checkpoint version " + std::to_string(h.version));
+  if (h.num_species != state.num_species ||
+      h.num_params != net::NUM_PARAMS + 1 + extraParams())
+    return fail("checkpoint of a different network (" +
+                std::to_string(h.num_species) + " species, " +
+                std::to_string(state.num_species) + " loaded)");
+  const uint64_t cells = (uint64_t)h.rows * (uint64_t)h.cols;
+  if (h.rows <= 0 || h.cols <= 0 || cells > INT_MAX ||
+      (h.field_bytes != 4 && h.field_bytes != 8) ||
+      h.num_inputs != sp::NUM_INPUTS || (double)h.size > size)
+    return fail("corrupt checkpoint header");
+
+  // The blocks must follow the header and each other in order and end
+  // within the checkpoint. Offsets come from the file, so lengths are
+  // compared against the bytes left rather than added to them.
+  uint64_t end = sizeof(h);
+  auto inOrder = [&](uint64_t offset, uint64_t length) {
+    if (offset < end || offset > h.size || length > h.size - offset)
+      return false;
+    end = offset + length;
+    return true;
+  };
+  if (!inOrder(h.params_offset, (uint64_t)h.num_params * sizeof(double)) ||
+      !inOrder(h.fields_offset,
+               (uint64_t)h.num_species * cells * h.field_bytes) ||
+      !inOrder(h.overrides_offset, (uint64_t)h.num_inputs * cells) ||
+      (h.steps_offset && !inOrder(h.steps_offset, cells * sizeof(double))))
+    return fail("corrupt checkpoint header");
+
+  if (h.rows != state.rows || h.cols != state.cols || grid_members > 1) {
+    if (!allocateGrid(h.rows, h.cols))
+      return fail("cannot allocate the checkpoint's grid");
+  } else {
+    std::fill_n(state.swapped, NUM_DIFFUSING, false);
+    bindFields();
+    std::fill(cell_step.begin(), cell_step.end(), 0.0);
+    allocateSensitivities();
   }
 
-  return result;
+  // Fields: the current buffers are the first num_species in storage
+  const unsigned char *fields = bytes + h.fields_offset;
+  const size_t values = (size_t)state.num_species * state.num_cells;
+  if (h.field_bytes == sizeof(Scalar)) {
+    memcpy(state.storage.data(), fields, values * sizeof(Scalar));
+  } else if (h.field_bytes == sizeof(float)) {
+    const float *in = reinterpret_cast<const float *>(fields);
+    std::copy(in, in + values, state.storage.begin());
+  } else {
+    const double *in = reinterpret_cast<const double *>(fields);
+    std::copy(in, in + values, state.storage.begin());
+  }
+  memcpy(state.input_override.data(), bytes + h.overrides_offset,
+         state.input_override.size());
+  if (h.steps_offset && !cell_step.empty())
+    memcpy(cell_step.data(), bytes + h.steps_offset,
+           cell_step.size() * sizeof(double));
+
+  std::vector<double> params(h.num_params);
+  memcpy(params.data(), bytes + h.params_offset,
+         params.size() * sizeof(double));
+  for (int p = 0; p < net::NUM_PARAMS; p++)
+    rateConstant(p) = params[p];
+  rates.time_step = params[net::NUM_PARAMS];
+  std::copy(params.begin() + net::NUM_PARAMS + 1, params.end(),
+            network_params.end() - extraParams());
+
+  simulation_time = h.simulation_time;
+  feedback_clock.count = h.feedback_count;
+  feedback_clock.elapsed = h.feedback_elapsed;
+  feedback_clock.lead = h.feedback_lead;
+  ecm_clock.count = h.ecm_count;
+  ecm_clock.elapsed = h.ecm_elapsed;
+  ecm_clock.lead = h.ecm_lead;
+  wakeAll();
+  regroup_classes = true;
+  return 1;
 }
 
-// Function to free allocated memory
+// Reason the last saveCheckpoint or loadCheckpoint call failed
 EMSCRIPTEN_KEEPALIVE
-void freeData(double *ptr) { free(ptr); }
-
-// Function to read a specific cell value from a data array
-EMSCRIPTEN_KEEPALIVE
-double readDataValue(double *data, int i, int j) {
-  return data[i * GRID_SIZE + j];
-}
+const char *getCheckpointError() { return checkpoint_error.c_str(); }
 
 // Set input concentration for a specific molecule in all cells
 EMSCRIPTEN_KEEPALIVE
 void setInputConcentration(int molecule_index, double value) {
-  // Map molecule index to string key
-  std::string molecule;
-  switch (molecule_index) {
-  case 0:
-    molecule = "AngIIin";
-    break;
-  case 1:
-    molecule = "TGFBin";
-    break;
-  case 2:
-    molecule = "tensionin";
-    break;
-  case 3:
-    molecule = "IL6in";
-    break;
-  case 4:
-    molecule = "IL1in";
-    break;
-  case 5:
-    molecule = "TNFain";
-    break;
-  case 6:
-    molecule = "NEin";
-    break;
-  case 7:
-    molecule = "PDGFin";
-    break;
-  case 8:
-    molecule = "ET1in";
-    break;
-  case 9:
-    molecule = "NPin";
-    break;
-  case 10:
-    molecule = "E2in";
-    break;
-  default:
-    molecule = "TGFBin";
-    break;
-  }
-
-  for (auto &row : grid) {
-    for (auto &cell : row) {
-      cell.icm[molecule] = value;
-    }
-  }
+  setGridInput(inputSpecies(molecule_index), value);
 }
 
 // NEW FUNCTION: Set input concentration for a specific cell
 EMSCRIPTEN_KEEPALIVE
 void setCellInputConcentration(int molecule_index, int row, int col, double value) {
   // Boundary check
-  if (row < 0 || row >= GRID_SIZE || col < 0 || col >= GRID_SIZE) return;
-  
-  // Map molecule index to string key
-  std::string molecule;
-  switch (molecule_index) {
-  case 0:
-    molecule = "AngIIin";
-    break;
-  case 1:
-    molecule = "TGFBin";
-    break;
-  case 2:
-    molecule = "tensionin";
-    break;
-  case 3:
-    molecule = "IL6in";
-    break;
-  case 4:
-    molecule = "IL1in";
-    break;
-  case 5:
-    molecule = "TNFain";
-    break;
-  case 6:
-    molecule = "NEin";
-    break;
-  case 7:
-    molecule = "PDGFin";
-    break;
-  case 8:
-    molecule = "ET1in";
-    break;
-  case 9:
-    molecule = "NPin";
-    break;
-  case 10:
-    molecule = "E2in";
-    break;
-  default:
-    molecule = "TGFBin";
-    break;
-  }
+  if (!validCell(row, col)) return;
+
+  int input = inputSpecies(molecule_index);
+  int cell = cellIndex(row, col);
 
   // Set the override value for this specific cell
-  grid[row][col].input_overrides[molecule] = std::max(0.0, std::min(1.0, value));
-  grid[row][col].has_input_override = true;
-  
-  // Also update the regular icm value for immediate effect
-  grid[row][col].icm[molecule] = std::max(0.0, std::min(1.0, value));
+  state.input_override[(size_t)(input - sp::FIRST_INPUT) * state.num_cells +
+                       cell] = 1;
+  field(input)[cell] = std::max(0.0, std::min(1.0, value));
+  wakeCell(cell);
+  checkClass(cell);
 }
 
 // NEW FUNCTION: Clear input overrides for a specific cell
 EMSCRIPTEN_KEEPALIVE
 void clearCellInputOverrides(int row, int col) {
   // Boundary check
-  if (row < 0 || row >= GRID_SIZE || col < 0 || col >= GRID_SIZE) return;
-  
-  grid[row][col].input_overrides.clear();
-  grid[row][col].has_input_override = false;
-  
+  if (!validCell(row, col)) return;
+
   // Reset all input molecules to 0 for this cell
-  grid[row][col].icm["AngIIin"] = 0;
-  grid[row][col].icm["TGFBin"] = 0;
-  grid[row][col].icm["tensionin"] = 0;
-  grid[row][col].icm["IL6in"] = 0;
-  grid[row][col].icm["IL1in"] = 0;
-  grid[row][col].icm["TNFain"] = 0;
-  grid[row][col].icm["NEin"] = 0;
-  grid[row][col].icm["PDGFin"] = 0;
-  grid[row][col].icm["ET1in"] = 0;
-  grid[row][col].icm["NPin"] = 0;
-  grid[row][col].icm["E2in"] = 0;
+  clearCellInputs(cellIndex(row, col));
 }
 
 // NEW FUNCTION: Clear all input overrides from all cells
 EMSCRIPTEN_KEEPALIVE
 void clearAllInputOverrides() {
-  for (auto &row : grid) {
-    for (auto &cell : row) {
-      cell.input_overrides.clear();
-      cell.has_input_override = false;
-      
-      // Reset all input molecules to 0
-      cell.icm["AngIIin"] = 0;
-      cell.icm["TGFBin"] = 0;
-      cell.icm["tensionin"] = 0;
-      cell.icm["IL6in"] = 0;
-      cell.icm["IL1in"] = 0;
-      cell.icm["TNFain"] = 0;
-      cell.icm["NEin"] = 0;
-      cell.icm["PDGFin"] = 0;
-      cell.icm["ET1in"] = 0;
-      cell.icm["NPin"] = 0;
-      cell.icm["E2in"] = 0;
-    }
-  }
+  // Reset all input molecules to 0
+  std::fill(state.input_override.begin(), state.input_override.end(), 0);
+  for (int k = 0; k < sp::NUM_INPUTS; k++)
+    std::fill_n(field(sp::FIRST_INPUT + k), state.num_cells, 0.0);
+  wakeAll();
+  regroup_classes = true;
 }
 
 // Set all input concentrations at once
@@ -1438,24 +2993,15 @@ EMSCRIPTEN_KEEPALIVE
 void setAllInputs(double angii, double tgfb, double tension, double il6,
                   double il1, double tnfa, double ne, double pdgf, double et1,
                   double np, double e2) {
-  for (auto &row : grid) {
-    for (auto &cell : row) {
-      cell.icm["AngIIin"] = angii;
-      cell.icm["TGFBin"] = tgfb;
-      cell.icm["tensionin"] = tension;
-      cell.icm["IL6in"] = il6;
-      cell.icm["IL1in"] = il1;
-      cell.icm["TNFain"] = tnfa;
-      cell.icm["NEin"] = ne;
-      cell.icm["PDGFin"] = pdgf;
-      cell.icm["ET1in"] = et1;
-      cell.icm["NPin"] = np;
-      cell.icm["E2in"] = e2;
-    }
+  const double values[sp::NUM_INPUTS] = {angii, tgfb, tension, il6, il1, tnfa,
+                                         ne,    pdgf, et1,     np,  e2};
+  for (int k = 0; k < sp::NUM_INPUTS; k++) {
+    setGridInput(sp::FIRST_INPUT + k, values[k]);
   }
 }
 
-// Set time step for simulation
+// Set time step for simulation: the step simulateStep takes when called
+// without one, and the first internal step of the adaptive integrators
 EMSCRIPTEN_KEEPALIVE
 void setTimeStep(double dt) { rates.time_step = dt; }
 
@@ -1472,6 +3018,7 @@ void setRateConstants(double k_in, double k_fb, double k_deg, double k_recep,
   rates.k_activation = k_act;
   rates.k_production = k_prod;
   rates.k_diffusion = k_diff;
+  wakeAll();
 }
 
 // Get ODE system status
@@ -1493,47 +3040,478 @@ double *getODEParameters() {
 EMSCRIPTEN_KEEPALIVE
 void setCellConcentration(int isFeedback, int moleculeIndex, int row, int col, double value) {
     // Boundary check
-    if (row < 0 || row >= GRID_SIZE || col < 0 || col >= GRID_SIZE) return;
-    
-    if (isFeedback) {
-        // For feedback molecules
-        std::string molecule;
-        switch (moleculeIndex) {
-            case 0: molecule = "TGFBfb"; break;
-            case 1: molecule = "AngIIfb"; break;
-            case 2: molecule = "IL6fb"; break;
-            case 3: molecule = "ET1fb"; break;
-            case 4: molecule = "tensionfb"; break;
-            default: molecule = "TGFBfb"; break;
-        }
-        // Set the value, clamped between 0 and 1
-        grid[row][col].feedback[molecule] = std::max(0.0, std::min(1.0, value));
-    } else {
-        // For ECM molecules
-        std::string molecule;
-        switch (moleculeIndex) {
-            case 0: molecule = "proCI"; break;
-            case 1: molecule = "proCIII"; break;
-            case 2: molecule = "fibronectin"; break;
-            case 3: molecule = "periostin"; break;
-            case 4: molecule = "TNC"; break;
-            case 5: molecule = "PAI1"; break;
-            case 6: molecule = "CTGF"; break;
-            case 7: molecule = "EDAFN"; break;
-            case 8: molecule = "TIMP1"; break;
-            case 9: molecule = "TIMP2"; break;
-            case 10: molecule = "proMMP1"; break;
-            case 11: molecule = "proMMP2"; break;
-            case 12: molecule = "proMMP3"; break;
-            case 13: molecule = "proMMP8"; break;
-            case 14: molecule = "proMMP9"; break;
-            case 15: molecule = "proMMP12"; break;
-            case 16: molecule = "proMMP14"; break;
-            default: molecule = "proCI"; break;
-        }
-        // Set the value, clamped between 0 and 1
-        grid[row][col].ecm[molecule] = std::max(0.0, std::min(1.0, value));
+    if (!validCell(row, col)) return;
+
+    int species = isFeedback ? feedbackSpecies(moleculeIndex)
+                             : ecmSpecies(moleculeIndex);
+
+    // Set the value, clamped between 0 and 1
+    field(species)[cellIndex(row, col)] = std::max(0.0, std::min(1.0, value));
+    wakeCell(cellIndex(row, col));
+    checkClass(cellIndex(row, col));
+}
+
+// Load a reaction network spec (format in ecm_program.h) in place of the
+// built-in network. Species declared by the spec are added to every cell at
+// their initial values. Returns 0 on success or the line number of the first
+// error, in which case the current network stays active.
+EMSCRIPTEN_KEEPALIVE
+int loadNetwork(const char *spec) {
+  NetworkProgram program;
+  int error_line = compileNetwork(spec, program);
+  if (error_line != 0) {
+    network.error = program.error;
+    return error_line;
+  }
+
+  network = program;
+  network_spec = spec;
+  use_program = true;
+  jacobian_rows.clear();
+
+  network_params.assign(network.param_defaults.begin(),
+                        network.param_defaults.end());
+  for (int p = 0; p < net::NUM_PARAMS; p++) {
+    if (!std::isnan(network.param_defaults[p]))
+      rateConstant(p) = network.param_defaults[p];
+  }
+  network_coefs.assign(network.coefs.size(), 0.0);
+  network_ecm = network;
+  network_ecm.code = targetCode(network, sp::FIRST_ECM, sp::NUM_ECM);
+
+  allocateSensitivities(); // Released while the program runs
+  resizeSpecies(networkSpeciesCount(network));
+  wakeAll();
+  return 0;
+}
+
+// Number of threads used by simulateStep. threads <= 0 uses every hardware
+// thread; builds without thread support always use 1.
+EMSCRIPTEN_KEEPALIVE
+void setThreadCount(int threads) {
+  const int previous = pool.size();
+  pool.resize(threads);
+  threads_configured = true;
+  // Keep the previous threads if their scratch space does not fit
+  if (!allocateScratch()) {
+    pool.resize(previous);
+    allocateScratch();
+  }
+}
+
+EMSCRIPTEN_KEEPALIVE
+int getThreadCount() { return pool.size(); }
+
+// Select the fused reaction-diffusion sweep (1) or separate reaction and
+// diffusion passes (0, default). Both give the same results; the fused sweep
+// pays off once the grid no longer fits in the last-level cache. It only
+// covers steps of one reaction pass followed by both explicit diffusions,
+// other splitting settings use separate passes.
+EMSCRIPTEN_KEEPALIVE
+void setFusedSweep(int enabled) { fused_sweep = enabled != 0; }
+
+EMSCRIPTEN_KEEPALIVE
+int getFusedSweep() { return fused_sweep ? 1 : 0; }
+
+// Split each step symmetrically (1: half of the diffusion before the
+// reactions, half after; second-order accurate) or sequentially (0,
+// default: reactions, then diffusion)
+EMSCRIPTEN_KEEPALIVE
+void setStrangSplitting(int enabled) {
+  strang_splitting = enabled != 0;
+  feedback_clock = DiffusionClock{feedback_clock.interval};
+  ecm_clock = DiffusionClock{ecm_clock.interval};
+}
+
+EMSCRIPTEN_KEEPALIVE
+int getStrangSplitting() { return strang_splitting ? 1 : 0; }
+
+// Euler substeps per step for the reactions (default 1). The adaptive
+// integrators choose their own substeps and ignore this.
+EMSCRIPTEN_KEEPALIVE
+void setReactionSubsteps(int substeps) {
+  reaction_substeps = std::max(1, substeps);
+}
+
+EMSCRIPTEN_KEEPALIVE
+int getReactionSubsteps() { return reaction_substeps; }
+
+// Diffuse the feedback fields every feedback_steps steps and the ECM fields
+// every ecm_steps steps (default 1), each over the time since their last
+// diffusion
+EMSCRIPTEN_KEEPALIVE
+void setDiffusionIntervals(int feedback_steps, int ecm_steps) {
+  feedback_clock = DiffusionClock{std::max(1, feedback_steps)};
+  ecm_clock = DiffusionClock{std::max(1, ecm_steps)};
+}
+
+EMSCRIPTEN_KEEPALIVE
+int getFeedbackInterval() { return feedback_clock.interval; }
+
+EMSCRIPTEN_KEEPALIVE
+int getECMInterval() { return ecm_clock.interval; }
+
+// Skip dormant cells: blocks of cells whose values change by at most
+// tolerance per unit time are left out of the reaction and diffusion passes
+// until something wakes them (see the active set above). tolerance <= 0
+// keeps the current one (default 1e-6). Only applies to the explicit
+// diffusion scheme.
+EMSCRIPTEN_KEEPALIVE
+void setActiveSet(int enabled, double tolerance) {
+  active_set = enabled != 0;
+  if (tolerance > 0.0)
+    active_tolerance = tolerance;
+  wakeAll();
+}
+
+EMSCRIPTEN_KEEPALIVE
+int getActiveSet() { return active_set ? 1 : 0; }
+
+// Fraction of cells the last step processed (1 without skipping)
+EMSCRIPTEN_KEEPALIVE
+double getActiveFraction() { return active_fraction; }
+
+// Compress spatially uniform regions: cells that agree in every species but
+// the ECM fields share one evaluation of the intracellular rates (see the
+// equivalence classes above). Results are unchanged. Only applies to the
+// Euler integrator; the active set is not used while compressing.
+EMSCRIPTEN_KEEPALIVE
+void setCompression(int enabled) {
+  compression = enabled != 0;
+  regroup_classes = true;
+  wakeAll();
+}
+
+EMSCRIPTEN_KEEPALIVE
+int getCompression() { return compression ? 1 : 0; }
+
+// Classes whose intracellular rates the last step computed, 0 if it
+// reacted cell by cell
+EMSCRIPTEN_KEEPALIVE
+int getClassCount() { return class_count; }
+
+// Select the diffusion scheme: 0 = explicit 8-neighbor update (default),
+// 1 = alternating-direction implicit, 2 = spectral (FFT). Both 1 and 2 are
+// stable at any k_diffusion and time step; the spectral scheme is exact for
+// the 8-neighbor Laplacian and costs O(N log N). Combine with
+// setDiffusionIntervals to diffuse only every few steps. The fused sweep
+// only applies to the explicit scheme. Returns 0 for an unknown scheme, or
+// if the scheme's buffers do not fit in memory, keeping the previous one.
+EMSCRIPTEN_KEEPALIVE
+int setDiffusionScheme(int scheme) {
+  if (scheme < EXPLICIT_DIFFUSION || scheme > SPECTRAL_DIFFUSION)
+    return 0;
+  const int previous = diffusion_scheme;
+  diffusion_scheme = scheme;
+  if (!allocateScratch()) {
+    diffusion_scheme = previous;
+    allocateScratch();
+    return 0;
+  }
+  wakeAll();
+  return 1;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int getDiffusionScheme() { return diffusion_scheme; }
+
+// Select the reaction integrator: 0 = explicit Euler (default), 1 = adaptive
+// Bogacki-Shampine 3(2), 2 = adaptive Dormand-Prince 5(4). The adaptive
+// integrators take as many internal steps per simulateStep as the tolerance
+// requires, cell by cell. Returns 0 for an unknown integrator, or if its
+// buffers do not fit in memory, keeping the previous one.
+EMSCRIPTEN_KEEPALIVE
+int setIntegrator(int method) {
+  if (method < EULER || method > DORMAND_PRINCE)
+    return 0;
+  std::vector<double> steps;
+  try {
+    if (method != EULER)
+      steps.assign(state.num_cells, 0.0);
+  } catch (const std::bad_alloc &) {
+    return 0;
+  }
+  const int previous = integrator;
+  integrator = method;
+  if (!allocateScratch()) {
+    integrator = previous;
+    allocateScratch();
+    return 0;
+  }
+  cell_step.swap(steps);
+  wakeAll();
+  regroup_classes = true;
+  return 1;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int getIntegrator() { return integrator; }
+
+// Error tolerance of the adaptive integrators (absolute and relative)
+EMSCRIPTEN_KEEPALIVE
+void setTolerance(double tol) {
+  if (tol > 0.0)
+    tolerance = tol;
+}
+
+EMSCRIPTEN_KEEPALIVE
+double getTolerance() { return tolerance; }
+
+// Cells evaluated per instruction by the rate kernel (1 without SIMD)
+EMSCRIPTEN_KEEPALIVE
+int getSimdLanes() { return simd::LanesOf<RateScalar>::width; }
+
+// Message for the last failed loadNetwork call
+EMSCRIPTEN_KEEPALIVE
+const char *getNetworkError() { return network.error.c_str(); }
+
+// Return to the built-in network and drop species added by loadNetwork
+EMSCRIPTEN_KEEPALIVE
+void resetNetwork() {
+  use_program = false;
+  network = NetworkProgram();
+  network_ecm = NetworkProgram();
+  network_spec.clear();
+  jacobian_rows.clear();
+  allocateSensitivities();
+  resizeSpecies(sp::NUM_SPECIES);
+  wakeAll();
+}
+
+// Active network as a spec (malloc'd string, release with free)
+EMSCRIPTEN_KEEPALIVE
+char *getNetworkSpec() {
+  std::string spec = use_program ? network_spec : builtinNetworkSpec();
+  char *result = (char *)malloc(spec.size() + 1);
+  memcpy(result, spec.c_str(), spec.size() + 1);
+  return result;
+}
+
+// Set a rate constant by name: a built-in constant (k_input, ...,
+// k_diffusion) or a parameter declared by the loaded network. Returns 0 if
+// the name is unknown.
+EMSCRIPTEN_KEEPALIVE
+int setParameter(const char *name, double value) {
+  for (int p = 0; p < net::NUM_PARAMS; p++) {
+    if (strcmp(name, net::PARAM_NAMES[p]) == 0) {
+      rateConstant(p) = value;
+      wakeAll();
+      return 1;
     }
+  }
+  if (!use_program)
+    return 0;
+  int index = networkParamIndex(network, name);
+  if (index < 0)
+    return 0;
+  network_params[index] = value;
+  wakeAll();
+  return 1;
+}
+
+// Value of a named rate constant, NaN if the name is unknown
+EMSCRIPTEN_KEEPALIVE
+double getParameter(const char *name) {
+  for (int p = 0; p < net::NUM_PARAMS; p++) {
+    if (strcmp(name, net::PARAM_NAMES[p]) == 0)
+      return rateConstant(p);
+  }
+  if (!use_program)
+    return NAN;
+  int index = networkParamIndex(network, name);
+  return index < 0 ? NAN : network_params[index];
+}
+
+// Members of the ensemble the next initializeGrid allocates: members
+// parameter sets advancing together on one grid, each cell holding one
+// value per member (see getGridCols). Every member starts from the same
+// state and shares the rate constants, inputs and options until given its
+// own with setMemberParameter or setMemberInput; member m then evolves
+// exactly as a separate run with its values would. An ensemble always
+// diffuses explicitly and reacts every cell (no active set or
+// compression); it cannot be checkpointed, and cells under a loaded network
+// program or in the Jacobian functions use the shared rate constants.
+// 1 (the default) is a plain grid.
+EMSCRIPTEN_KEEPALIVE
+void setEnsembleSize(int members) { ensemble_size = std::max(1, members); }
+
+// Members of the current grid
+EMSCRIPTEN_KEEPALIVE
+int getEnsembleSize() { return grid_members; }
+
+// Give ensemble member its own value of a built-in rate constant (k_input,
+// ..., k_diffusion), or return it to the shared value if value is NaN.
+// Cleared by initializeGrid. Returns 0 for an unknown member or name.
+EMSCRIPTEN_KEEPALIVE
+int setMemberParameter(int member, const char *name, double value) {
+  if (member < 0 || member >= grid_members || state.num_cells == 0)
+    return 0;
+  for (int p = 0; p < net::NUM_PARAMS; p++) {
+    if (strcmp(name, net::PARAM_NAMES[p]) == 0) {
+      member_overrides[(size_t)member * net::NUM_PARAMS + p] = value;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// Rate constant of an ensemble member, NaN for an unknown member or name
+EMSCRIPTEN_KEEPALIVE
+double getMemberParameter(int member, const char *name) {
+  if (member < 0 || member >= grid_members || state.num_cells == 0)
+    return NAN;
+  for (int p = 0; p < net::NUM_PARAMS; p++) {
+    if (strcmp(name, net::PARAM_NAMES[p]) == 0) {
+      const double value =
+          member_overrides[(size_t)member * net::NUM_PARAMS + p];
+      return std::isnan(value) ? rateConstant(p) : value;
+    }
+  }
+  return NAN;
+}
+
+// Set an input of one ensemble member in every cell that is not brushed
+// with its own value. A later setInputConcentration sets every member.
+EMSCRIPTEN_KEEPALIVE
+void setMemberInput(int member, int molecule_index, double value) {
+  if (member < 0 || member >= grid_members)
+    return;
+  const int input = inputSpecies(molecule_index);
+  Scalar *in = field(input);
+  for (int c = member; c < state.num_cells; c += grid_members) {
+    if (!hasInputOverride(input, c))
+      in[c] = value;
+  }
+  wakeAll();
+  regroup_classes = true;
+}
+
+// Forward sensitivity analysis: with enabled set, every step also
+// integrates d(x)/d(k) of every species field with respect to each built-in
+// rate constant (k_input, ..., k_diffusion), differentiating the Euler
+// reaction update with the analytic Jacobian and the explicit diffusion
+// update, so one run yields the exact derivatives without a perturbation
+// size to choose. It is not faster than finite differences: a step costs
+// about 13 plain steps, more than a 9-member ensemble (README.md,
+// Sensitivities). Sensitivities start at zero when
+// enabled, on initializeGrid and on loadCheckpoint, so they measure the
+// dependence of the state on the rate constants since then. While enabled
+// steps react with Euler substeps whatever the integrator, diffuse
+// explicitly and do not fuse, skip cells or compress; results otherwise
+// match a run without sensitivities. Takes 8 * (species + 22) doubles per
+// cell (10.9 KB with the built-in network). Not advanced, and not
+// allocated, on ensemble grids or under a loaded network. Returns 0 if the fields do not fit in memory,
+// in which case sensitivities stay off.
+EMSCRIPTEN_KEEPALIVE
+int setSensitivity(int enabled) {
+  sensitivity = enabled != 0;
+  bool ok = allocateSensitivities();
+  if (!allocateScratch()) {
+    sensitivity = false;
+    allocateSensitivities();
+    allocateScratch();
+    ok = false;
+  }
+  wakeAll();
+  regroup_classes = true;
+  return ok ? 1 : 0;
+}
+
+EMSCRIPTEN_KEEPALIVE
+int getSensitivity() { return sensitivity ? 1 : 0; }
+
+// Zero-copy view of the sensitivities of a built-in species, in double:
+// for every cell in getFieldView order, d(species)/d(k) for the 8 rate
+// constants in getParameter order (k_input, ..., k_diffusion), so
+// d(species)/d(k_p) of cell c is at c * getSensitivityStride() + p. Valid
+// until the next step, like a field view. Null for an unknown species or
+// while sensitivities are not advanced.
+EMSCRIPTEN_KEEPALIVE
+const double *getSensitivityView(int species) {
+  if (!sensitivityStep() || species < 0 || species >= sp::NUM_SPECIES)
+    return nullptr;
+  return sensitivity_fields[species];
+}
+
+// Doubles from one cell's sensitivities to the next's in a sensitivity view
+EMSCRIPTEN_KEEPALIVE
+int getSensitivityStride() { return (int)sensitivity_stride; }
+
+// Number of nonzeros in the Jacobian pattern of the active network
+EMSCRIPTEN_KEEPALIVE
+int getJacobianNonzeros() {
+  buildJacobianPattern();
+  return (int)jacobian_columns.size();
+}
+
+// Jacobian pattern in CSR form: the num_species + 1 row offsets followed by
+// the column of each nonzero (malloc'd, release with free). Entry i of
+// getCellJacobian is d(rate[row])/d(x[col]) for the row whose range holds i.
+EMSCRIPTEN_KEEPALIVE
+int *getJacobianPattern() {
+  buildJacobianPattern();
+  const size_t rows = jacobian_rows.size();
+  const size_t nonzeros = jacobian_columns.size();
+  int *result = (int *)malloc((rows + nonzeros) * sizeof(int));
+  memcpy(result, jacobian_rows.data(), rows * sizeof(int));
+  memcpy(result + rows, jacobian_columns.data(), nonzeros * sizeof(int));
+  return result;
+}
+
+// Analytic Jacobian values of a cell in the CSR pattern (malloc'd, release
+// with freeData), NULL for a cell outside the grid
+EMSCRIPTEN_KEEPALIVE
+double *getCellJacobian(int row, int col) {
+  if (!validCell(row, col))
+    return nullptr;
+  buildJacobianPattern();
+  prepareRates();
+  std::vector<double> x(state.num_species);
+  gatherCell(cellIndex(row, col), x.data());
+  double *values =
+      (double *)malloc(jacobian_columns.size() * sizeof(double));
+  cellJacobian(x.data(), values);
+  return values;
+}
+
+// Consistency check of the analytic Jacobian at a cell against central
+// finite differences of the rates, over every entry including those outside
+// the pattern. Returns the largest |analytic - numeric| / (1 + |analytic|),
+// around 1e-9 when both agree, or -1 for a cell outside the grid.
+EMSCRIPTEN_KEEPALIVE
+double checkJacobian(int row, int col) {
+  if (!validCell(row, col))
+    return -1.0;
+  buildJacobianPattern();
+  prepareRates();
+
+  const int n = state.num_species;
+  const double h = 1e-6;
+  std::vector<double> x(n), values(jacobian_columns.size());
+  std::vector<double> dense((size_t)n * n, 0.0), plus(n), minus(n);
+  gatherCell(cellIndex(row, col), x.data());
+  cellJacobian(x.data(), values.data());
+  for (int r = 0; r < n; r++) {
+    for (int i = jacobian_rows[r]; i < jacobian_rows[r + 1]; i++)
+      dense[(size_t)r * n + jacobian_columns[i]] = values[i];
+  }
+
+  double error = 0.0;
+  for (int c = 0; c < n; c++) {
+    const double value = x[c];
+    x[c] = value + h;
+    cellRates(x.data(), plus.data());
+    x[c] = value - h;
+    cellRates(x.data(), minus.data());
+    x[c] = value;
+    for (int r = 0; r < n; r++) {
+      const double analytic = dense[(size_t)r * n + c];
+      const double numeric = (plus[r] - minus[r]) / (2.0 * h);
+      error = std::max(error, std::fabs(analytic - numeric) /
+                                  (1.0 + std::fabs(analytic)));
+    }
+  }
+  return error;
 }
 
-} // extern "C"
\ No newline at end of file
+} // extern "C"
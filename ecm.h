@@ -0,0 +1,150 @@
+// C interface of the simulation engine.
+//
+// These are the functions compile.sh exports to JavaScript, declared for
+// native programs that link the engine directly (see CMakeLists.txt and
+// ecm_cli.cpp). Each function is documented where it is defined in ecm.cpp.
+// Molecule indices follow the exported getters and setters: inputs 0-10
+// (AngII, TGFB, tension, IL6, IL1, TNFa, NE, PDGF, ET1, NP, E2), ECM 0-16
+// and feedback 0-4; species indices are those of getSpeciesIndex().
+#ifndef ECM_H
+#define ECM_H
+
+#if defined(__EMSCRIPTEN__)
+#include <emscripten.h>
+#else
+#define EMSCRIPTEN_KEEPALIVE
+#endif
+
+// Values of a field view: double, or float in a -DECM_FLOAT32 build
+#if defined(ECM_FLOAT32)
+typedef float ECMScalar;
+#else
+typedef double ECMScalar;
+#endif
+
+// Called during a batch, see setStepCallback
+typedef int (*StepCallback)(int steps, double time);
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Grid and stepping
+int initializeGrid(int rows, int cols);
+void setRandomSeed(unsigned seed);
+int getGridRows();
+int getGridCols();
+void simulateStep(double delta_t);
+int simulateSteps(int steps, double delta_t);
+int runUntil(double end_time);
+void setStepCallback(StepCallback callback, int interval);
+void setTimeBudget(double ms);
+double getTimeBudget();
+double getSimulationTime();
+void setTimeStep(double dt);
+
+// Readback
+double *getECMData(int molecule_index);
+double *getFeedbackData(int molecule_index);
+void freeData(double *ptr);
+double readDataValue(double *data, int i, int j);
+const ECMScalar *getFieldView(int species);
+const ECMScalar *getECMView(int molecule_index);
+const ECMScalar *getFeedbackView(int molecule_index);
+int getFieldStride();
+int getFieldBytes();
+int getSpeciesCount();
+int getInputCount();
+int getSpeciesIndex(const char *name);
+const char *getSpeciesName(int species);
+int snapshotFields(const int *species, int count, double *out);
+int snapshotFieldsFloat(const int *species, int count, float *out);
+
+// Checkpoints
+double getCheckpointSize();
+double saveCheckpoint(void *out, double capacity);
+int loadCheckpoint(const void *data, double size);
+const char *getCheckpointError();
+
+// Ensembles
+void setEnsembleSize(int members);
+int getEnsembleSize();
+int setMemberParameter(int member, const char *name, double value);
+double getMemberParameter(int member, const char *name);
+void setMemberInput(int member, int molecule_index, double value);
+
+// Sensitivities
+int setSensitivity(int enabled);
+int getSensitivity();
+const double *getSensitivityView(int species);
+int getSensitivityStride();
+
+// Inputs and concentrations
+void setInputConcentration(int molecule_index, double value);
+void setCellInputConcentration(int molecule_index, int row, int col,
+                               double value);
+void clearCellInputOverrides(int row, int col);
+void clearAllInputOverrides();
+void setAllInputs(double angii, double tgfb, double tension, double il6,
+                  double il1, double tnfa, double ne, double pdgf, double et1,
+                  double np, double e2);
+void setCellConcentration(int isFeedback, int moleculeIndex, int row, int col,
+                          double value);
+
+// Rate constants and networks
+void setRateConstants(double k_in, double k_fb, double k_deg, double k_recep,
+                      double k_inhib, double k_act, double k_prod,
+                      double k_diff);
+double *getODEParameters();
+int setParameter(const char *name, double value);
+double getParameter(const char *name);
+int loadNetwork(const char *spec);
+const char *getNetworkError();
+void resetNetwork();
+char *getNetworkSpec();
+
+// Performance and numerical options
+void setThreadCount(int threads);
+int getThreadCount();
+int getSimdLanes();
+void setFusedSweep(int enabled);
+int getFusedSweep();
+void setStrangSplitting(int enabled);
+int getStrangSplitting();
+void setReactionSubsteps(int substeps);
+int getReactionSubsteps();
+void setDiffusionIntervals(int feedback_steps, int ecm_steps);
+int getFeedbackInterval();
+int getECMInterval();
+void setActiveSet(int enabled, double tolerance);
+int getActiveSet();
+double getActiveFraction();
+void setCompression(int enabled);
+int getCompression();
+int getClassCount();
+int setDiffusionScheme(int scheme);
+int getDiffusionScheme();
+int setIntegrator(int method);
+int getIntegrator();
+void setTolerance(double tol);
+double getTolerance();
+
+// Jacobian
+int getJacobianNonzeros();
+int *getJacobianPattern();
+double *getCellJacobian(int row, int col);
+double checkJacobian(int row, int col);
+
+// Benchmarking and profiling
+double benchmarkPhase(int phase, int repeats, double delta_t);
+void setProfiling(int enabled);
+int getProfiling();
+void resetProfile();
+// Per phase: total ns, last-step ns, calls, bytes allocated and cells
+double *getProfile();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ECM_H
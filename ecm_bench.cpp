@@ -0,0 +1,255 @@
+// Benchmark of the simulation engine: times every phase of a step across
+// grid sizes, thread counts and integrators and writes the results as JSON.
+//
+//   ecmbench [-g GRIDS] [-t THREADS] [-i INTEGRATORS] [-m SECONDS]
+//            [-d DT] [-o FILE]
+//
+//   -g  square grid sizes, comma separated (default 100,200,500,1000,2000)
+//   -t  thread counts (default 1 and every hardware thread, 0 = every one)
+//   -i  integrators: euler, bs32, dp54 (default all three)
+//   -m  minimum measured time per phase in seconds (default 0.2)
+//   -d  step size (default 0.1)
+//   -o  output file (default: standard output)
+//
+// Each configuration starts from a freshly seeded grid with TGF-beta = 1
+// everywhere. The phases are timed on their own with benchmarkPhase and
+// reported as nanoseconds per call and cell-steps per second:
+// calculateRates, updateCell (the reaction pass), diffuseFeedbackMolecules,
+// diffuseECMMolecules and simulateStep. Bytes allocated per step count the
+// operator new calls of simulateStep; peak RSS is that of the process so
+// far, so grids run smallest first. Grids that cannot be allocated are
+// reported with an error.
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+#include "ecm.h"
+
+namespace {
+
+// Bytes requested from operator new by the whole program
+std::atomic<long long> allocated_bytes(0);
+
+} // namespace
+
+void *operator new(size_t size) {
+  allocated_bytes += (long long)size;
+  if (void *p = malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void *operator new[](size_t size) { return operator new(size); }
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  allocated_bytes += (long long)size;
+  return malloc(size ? size : 1);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &tag) noexcept {
+  return operator new(size, tag);
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+namespace {
+
+// Phases in benchmarkPhase order, named after the engine functions
+const char *const PHASES[] = {"calculateRates", "updateCell",
+                              "diffuseFeedbackMolecules",
+                              "diffuseECMMolecules", "simulateStep"};
+const int NUM_PHASES = 5;
+const int STEP_PHASE = 4;
+
+const char *const INTEGRATORS[] = {"euler", "bs32", "dp54"};
+
+struct Options {
+  std::vector<int> grids = {100, 200, 500, 1000, 2000};
+  std::vector<int> threads;
+  std::vector<int> integrators = {0, 1, 2};
+  double min_time = 0.2;
+  double dt = 0.1;
+  const char *output = nullptr;
+};
+
+// Split a comma-separated list
+std::vector<std::string> split(const char *list) {
+  std::vector<std::string> items;
+  std::istringstream in(list);
+  std::string item;
+  while (std::getline(in, item, ','))
+    items.push_back(item);
+  return items;
+}
+
+// Parse a list of integers >= low, false on a bad item
+bool parseInts(const char *list, int low, std::vector<int> &values) {
+  values.clear();
+  for (const std::string &item : split(list)) {
+    char *end;
+    const long value = strtol(item.c_str(), &end, 10);
+    if (item.empty() || *end || value < low)
+      return false;
+    values.push_back((int)value);
+  }
+  return !values.empty();
+}
+
+bool parseIntegrators(const char *list, std::vector<int> &values) {
+  values.clear();
+  for (const std::string &item : split(list)) {
+    const char *const *found =
+        std::find_if(INTEGRATORS, INTEGRATORS + 3,
+                     [&](const char *name) { return item == name; });
+    if (found == INTEGRATORS + 3)
+      return false;
+    values.push_back((int)(found - INTEGRATORS));
+  }
+  return !values.empty();
+}
+
+// Peak resident set size of the process in bytes, 0 if unknown
+long long peakRSS() {
+#if defined(__unix__) || defined(__APPLE__)
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+#if defined(__APPLE__)
+  return (long long)usage.ru_maxrss;
+#else
+  return (long long)usage.ru_maxrss * 1024;
+#endif
+#else
+  return 0;
+#endif
+}
+
+// Mean nanoseconds of one run of a phase, repeated for at least min_time
+// seconds after a warm-up run
+double timePhase(int phase, double dt, double min_time) {
+  const double once = benchmarkPhase(phase, 1, dt);
+  const double repeats = std::ceil(min_time * 1e9 / std::max(once, 1.0));
+  return benchmarkPhase(phase, (int)std::min(repeats, 1e6), dt);
+}
+
+// Benchmark one configuration and write it as a JSON object
+void runConfig(FILE *out, int size, int threads, int integrator,
+               const Options &opt) {
+  fprintf(stderr, "%d x %d, %d threads, %s\n", size, size, threads,
+          INTEGRATORS[integrator]);
+  fprintf(out, "    {\"rows\": %d, \"cols\": %d, \"threads\": %d, "
+               "\"integrator\": \"%s\", ",
+          size, size, threads, INTEGRATORS[integrator]);
+
+  setThreadCount(threads);
+  setIntegrator(integrator);
+  setRandomSeed(1);
+  if (!initializeGrid(size, size)) {
+    fprintf(out, "\"error\": \"cannot allocate the grid\"}");
+    return;
+  }
+  setInputConcentration(1, 1.0); // TGF-beta
+
+  const double cells = (double)size * size;
+  fprintf(out, "\"actual_threads\": %d,\n     \"phases\": {", getThreadCount());
+  for (int p = 0; p < NUM_PHASES; p++) {
+    const double ns = timePhase(p, opt.dt, opt.min_time);
+    fprintf(out, "%s\n       \"%s\": {\"ns\": %.0f, "
+                 "\"cell_steps_per_sec\": %.6g}",
+            p ? "," : "", PHASES[p], ns, cells / (ns * 1e-9));
+  }
+
+  const long long before = allocated_bytes;
+  const int steps = 3;
+  benchmarkPhase(STEP_PHASE, steps, opt.dt);
+  const long long per_step = (allocated_bytes - before) / steps;
+  fprintf(out, "},\n     \"bytes_allocated_per_step\": %lld, "
+               "\"peak_rss_bytes\": %lld}",
+          per_step, peakRSS());
+}
+
+void usage() {
+  fprintf(stderr, "usage: ecmbench [-g GRIDS] [-t THREADS] [-i INTEGRATORS] "
+                  "[-m SECONDS] [-d DT] [-o FILE]\n");
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  Options opt;
+  setThreadCount(0);
+  const int hardware = getThreadCount();
+  opt.threads = {1};
+  if (hardware > 1)
+    opt.threads.push_back(hardware);
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    const char *value = i + 1 < argc ? argv[i + 1] : nullptr;
+    bool ok = value != nullptr;
+    if (ok && strcmp(arg, "-g") == 0) {
+      ok = parseInts(value, 1, opt.grids);
+    } else if (ok && strcmp(arg, "-t") == 0) {
+      ok = parseInts(value, 0, opt.threads);
+    } else if (ok && strcmp(arg, "-i") == 0) {
+      ok = parseIntegrators(value, opt.integrators);
+    } else if (ok && strcmp(arg, "-m") == 0) {
+      opt.min_time = atof(value);
+      ok = opt.min_time > 0.0;
+    } else if (ok && strcmp(arg, "-d") == 0) {
+      opt.dt = atof(value);
+      ok = opt.dt > 0.0;
+    } else if (ok && strcmp(arg, "-o") == 0) {
+      opt.output = value;
+    } else {
+      ok = false;
+    }
+    if (!ok) {
+      usage();
+      return 2;
+    }
+    i++;
+  }
+
+  FILE *out = opt.output ? fopen(opt.output, "w") : stdout;
+  if (!out) {
+    fprintf(stderr, "%s: cannot write\n", opt.output);
+    return 1;
+  }
+
+  std::sort(opt.grids.begin(), opt.grids.end());
+  fprintf(out, "{\n  \"simd_lanes\": %d,\n  \"field_bytes\": %d,\n"
+               "  \"hardware_threads\": %d,\n  \"dt\": %g,\n"
+               "  \"results\": [\n",
+          getSimdLanes(), getFieldBytes(), hardware, opt.dt);
+  bool first = true;
+  for (int size : opt.grids) {
+    for (int integrator : opt.integrators) {
+      for (int threads : opt.threads) {
+        if (!first)
+          fprintf(out, ",\n");
+        first = false;
+        runConfig(out, size, threads, integrator, opt);
+        fflush(out);
+      }
+    }
+  }
+  fprintf(out, "\n  ]\n}\n");
+  if (out != stdout)
+    fclose(out);
+  return 0;
+}
@@ -0,0 +1,759 @@
+// Headless driver: runs a scenario file with the native engine.
+//
+//   ecmsim [-o PREFIX] [-t THREADS] [-p] [-q] SCENARIO
+//
+// -p prints the engine's phase profile at the end.
+//
+// A scenario is a plain-text list of directives, one per line, in any
+// order; "#" starts a comment:
+//
+//   grid 200 200                  # rows cols (default 100 100)
+//   seed 42                       # random ECM start (default: clock)
+//   threads 8                     # 0 = every core (default)
+//   network fibroblast.txt        # network spec, see ecm_program.h
+//   integrator euler              # euler | bs32 | dp54
+//   tolerance 1e-4                # adaptive integrators
+//   diffusion explicit            # explicit | adi | spectral
+//   substeps 1                    # Euler reaction substeps per step
+//   strang 0                      # Strang splitting on/off
+//   intervals 1 1                 # feedback and ECM diffusion interval
+//   fused 0                       # fused sweep on/off
+//   active 0                      # active-set tolerance, 0 = off
+//   compression 0                 # compression on/off
+//   dt 0.1                        # step size
+//   param k_production 0.03       # rate constant or network parameter
+//   input TGFB 1.0                # input of every cell (TGFB or TGFBin)
+//   brush TGFB 1.0 40 40 59 59    # input of rows 40-59, columns 40-59
+//   steps 1000                    # steps to run
+//   every 100                     # output cadence in steps (0 = end only)
+//   record proCI_ecm TGFB         # species in the time series
+//   save proCI_ecm                # species whose fields are written
+//   output results                # output file prefix (default: scenario)
+//   restore state.ckpt            # start from a checkpoint instead of a
+//                                 # fresh grid (grid and seed are ignored)
+//   checkpoint final.ckpt         # save a checkpoint at the end
+//   stream frames.ecmts           # stream frames to a binary time series
+//   stream_species proCI_ecm      # species streamed
+//   stream_every 10               # stream every 10th step (default 1)
+//   stream_stride 2               # every 2nd row and column (default 1)
+//   stream_chunk 16               # frames per chunk (default 16)
+//   stream_compress 1             # zlib compression on/off (default on)
+//   sweep k_input 0.5 1 2         # run once per value of a rate constant
+//   sweep TGFB 0 0.5 1            # or of an input
+//   sensitivity proCI_ecm         # species whose sensitivities to the rate
+//                                 # constants are recorded
+//
+// Sweeps expand to every combination of their values, the first sweep
+// varying slowest, and all combinations advance together as the members of
+// one ensemble grid (see setEnsembleSize), sharing the threads row by row.
+// Brushed cells keep their brushed input in every member. A sweep cannot
+// start from or write a checkpoint.
+//
+// The time series PREFIX.csv holds the step, time and the mean, minimum and
+// maximum of every recorded species at step 0, every `every` steps and at
+// the end. Each saved species is written as PREFIX_NAME_STEP.csv, one grid
+// row per line. Streamed frames go to the chunked float32 format described
+// in ecm_output.h, written by a background thread. Under a sweep the time
+// series has one row per member after the step and time, PREFIX_members.csv
+// lists the swept values of every member, fields are written as
+// PREFIX_NAME_mMEMBER_STEP.csv and streamed frames hold the ensemble grid,
+// members side by side in every kept cell, with the member count in the
+// file header. With sensitivity, PREFIX_sensitivity.csv
+// holds the step, time and, for every listed species and rate constant, the
+// mean over the grid of d(species)/d(rate constant) at each output step; the
+// run then reacts with Euler substeps and diffuses explicitly (see
+// setSensitivity). A sweep cannot record sensitivities.
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <initializer_list>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "ecm.h"
+#include "ecm_output.h"
+
+namespace {
+
+// Input brushed onto a rectangle of cells, corners inclusive
+struct Brush {
+  std::string input;
+  double value;
+  int row0, col0, row1, col1;
+};
+
+// Values of a rate constant or input tried by a sweep
+struct Sweep {
+  std::string name;
+  std::vector<double> values;
+};
+
+struct Scenario {
+  int rows = 100;
+  int cols = 100;
+  unsigned seed = 0;
+  int threads = 0;
+  std::string network;
+  int integrator = 0;
+  double tolerance = -1.0;
+  int diffusion = 0;
+  int substeps = 1;
+  int strang = 0;
+  int feedback_interval = 1;
+  int ecm_interval = 1;
+  int fused = 0;
+  double active = 0.0;
+  int compression = 0;
+  double dt = 0.1;
+  std::vector<std::pair<std::string, double>> params;
+  std::vector<std::pair<std::string, double>> inputs;
+  std::vector<Brush> brushes;
+  int steps = 100;
+  int every = 0;
+  std::vector<std::string> record;
+  std::vector<std::string> save;
+  std::string output;
+  std::string restore;
+  std::string checkpoint;
+  std::string stream;
+  std::vector<std::string> stream_species;
+  FrameWriter::Options stream_options;
+  std::vector<Sweep> sweeps;
+  std::vector<std::string> sensitivity;
+
+  // Ensemble members of the sweeps, 1 without any
+  int members() const {
+    int count = 1;
+    for (const Sweep &sweep : sweeps)
+      count *= (int)sweep.values.size();
+    return count;
+  }
+
+  // Value of sweep i in member m
+  double sweepValue(size_t i, int m) const {
+    for (size_t j = sweeps.size() - 1; j > i; j--)
+      m /= (int)sweeps[j].values.size();
+    return sweeps[i].values[m % sweeps[i].values.size()];
+  }
+};
+
+// Index of a name in a list of choices, -1 if absent
+int choice(const std::string &name, std::initializer_list<const char *> list) {
+  int i = 0;
+  for (const char *item : list) {
+    if (name == item)
+      return i;
+    i++;
+  }
+  return -1;
+}
+
+// Parse a scenario file. Returns false after printing the first error as
+// file:line: message.
+bool parseScenario(const char *path, Scenario &sc) {
+  std::ifstream in(path);
+  if (!in) {
+    fprintf(stderr, "%s: cannot open\n", path);
+    return false;
+  }
+
+  std::string line;
+  int number = 0;
+  auto fail = [&](const std::string &message) {
+    fprintf(stderr, "%s:%d: %s\n", path, number, message.c_str());
+    return false;
+  };
+
+  while (std::getline(in, line)) {
+    number++;
+    line = line.substr(0, line.find('#'));
+    std::istringstream words(line);
+    std::string key;
+    if (!(words >> key))
+      continue;
+
+    bool ok = true;
+    if (key == "grid") {
+      ok = bool(words >> sc.rows >> sc.cols) && sc.rows > 0 && sc.cols > 0;
+    } else if (key == "seed") {
+      ok = bool(words >> sc.seed);
+    } else if (key == "threads") {
+      ok = bool(words >> sc.threads) && sc.threads >= 0;
+    } else if (key == "network") {
+      ok = bool(words >> sc.network);
+    } else if (key == "integrator") {
+      std::string name;
+      ok = bool(words >> name) &&
+           (sc.integrator = choice(name, {"euler", "bs32", "dp54"})) >= 0;
+    } else if (key == "tolerance") {
+      ok = bool(words >> sc.tolerance) && sc.tolerance > 0.0;
+    } else if (key == "diffusion") {
+      std::string name;
+      ok = bool(words >> name) &&
+           (sc.diffusion = choice(name, {"explicit", "adi", "spectral"})) >= 0;
+    } else if (key == "substeps") {
+      ok = bool(words >> sc.substeps) && sc.substeps > 0;
+    } else if (key == "strang") {
+      ok = bool(words >> sc.strang);
+    } else if (key == "intervals") {
+      ok = bool(words >> sc.feedback_interval >> sc.ecm_interval) &&
+           sc.feedback_interval > 0 && sc.ecm_interval > 0;
+    } else if (key == "fused") {
+      ok = bool(words >> sc.fused);
+    } else if (key == "active") {
+      ok = bool(words >> sc.active) && sc.active >= 0.0;
+    } else if (key == "compression") {
+      ok = bool(words >> sc.compression);
+    } else if (key == "dt") {
+      ok = bool(words >> sc.dt) && sc.dt > 0.0;
+    } else if (key == "param" || key == "input") {
+      std::string name;
+      double value;
+      ok = bool(words >> name >> value);
+      (key == "param" ? sc.params : sc.inputs).emplace_back(name, value);
+    } else if (key == "brush") {
+      Brush b;
+      ok = bool(words >> b.input >> b.value >> b.row0 >> b.col0 >> b.row1 >>
+                b.col1);
+      sc.brushes.push_back(b);
+    } else if (key == "steps") {
+      ok = bool(words >> sc.steps) && sc.steps >= 0;
+    } else if (key == "every") {
+      ok = bool(words >> sc.every) && sc.every >= 0;
+    } else if (key == "record" || key == "save" || key == "stream_species" ||
+               key == "sensitivity") {
+      std::string name;
+      while (words >> name)
+        (key == "record"           ? sc.record
+         : key == "save"           ? sc.save
+         : key == "stream_species" ? sc.stream_species
+                                   : sc.sensitivity)
+            .push_back(name);
+    } else if (key == "output") {
+      ok = bool(words >> sc.output);
+    } else if (key == "restore") {
+      ok = bool(words >> sc.restore);
+    } else if (key == "checkpoint") {
+      ok = bool(words >> sc.checkpoint);
+    } else if (key == "stream") {
+      ok = bool(words >> sc.stream);
+    } else if (key == "stream_every") {
+      ok = bool(words >> sc.stream_options.time_stride) &&
+           sc.stream_options.time_stride > 0;
+    } else if (key == "stream_stride") {
+      ok = bool(words >> sc.stream_options.space_stride) &&
+           sc.stream_options.space_stride > 0;
+    } else if (key == "stream_chunk") {
+      ok = bool(words >> sc.stream_options.frames_per_chunk) &&
+           sc.stream_options.frames_per_chunk > 0;
+    } else if (key == "stream_compress") {
+      ok = bool(words >> sc.stream_options.compress);
+    } else if (key == "sweep") {
+      Sweep sweep;
+      double value;
+      ok = bool(words >> sweep.name);
+      while (ok && words >> value)
+        sweep.values.push_back(value);
+      ok = ok && words.eof() && !sweep.values.empty() &&
+           (double)sc.members() * sweep.values.size() <= 1e6;
+      sc.sweeps.push_back(sweep);
+    } else {
+      return fail("unknown directive '" + key + "'");
+    }
+    std::string extra;
+    if (!ok || words >> extra)
+      return fail("bad arguments to '" + key + "'");
+  }
+  return true;
+}
+
+// Molecule index of an input given as TGFB or TGFBin, -1 if not an input
+int inputIndex(const std::string &name) {
+  const int inputs = getInputCount();
+  for (const std::string &candidate : {name, name + "in"}) {
+    const int s = getSpeciesIndex(candidate.c_str());
+    if (s >= 0 && s < inputs)
+      return s;
+  }
+  return -1;
+}
+
+// Species indices of names, printing the first unknown one
+bool speciesIndices(const std::vector<std::string> &names,
+                    std::vector<int> &indices) {
+  for (const std::string &name : names) {
+    const int s = getSpeciesIndex(name.c_str());
+    if (s < 0) {
+      fprintf(stderr, "unknown species '%s'\n", name.c_str());
+      return false;
+    }
+    indices.push_back(s);
+  }
+  return true;
+}
+
+// Restore a checkpoint file, mapping it in place where possible
+bool restoreCheckpoint(const std::string &path) {
+#if defined(__unix__) || defined(__APPLE__)
+  const int fd = open(path.c_str(), O_RDONLY);
+  struct stat info;
+  if (fd < 0 || fstat(fd, &info) != 0) {
+    fprintf(stderr, "%s: cannot open\n", path.c_str());
+    if (fd >= 0)
+      close(fd);
+    return false;
+  }
+  void *data = info.st_size > 0 ? mmap(nullptr, info.st_size, PROT_READ,
+                                       MAP_PRIVATE, fd, 0)
+                                : MAP_FAILED;
+  close(fd);
+  const int ok = data != MAP_FAILED &&
+                 loadCheckpoint(data, (double)info.st_size);
+  if (data != MAP_FAILED)
+    munmap(data, info.st_size);
+#else
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    fprintf(stderr, "%s: cannot open\n", path.c_str());
+    return false;
+  }
+  std::vector<char> data((std::istreambuf_iterator<char>(in)),
+                         std::istreambuf_iterator<char>());
+  const int ok = loadCheckpoint(data.data(), (double)data.size());
+#endif
+  if (!ok)
+    fprintf(stderr, "%s: %s\n", path.c_str(), getCheckpointError());
+  return ok != 0;
+}
+
+bool saveCheckpointFile(const std::string &path) {
+  std::vector<unsigned char> data((size_t)getCheckpointSize());
+  const size_t size = (size_t)saveCheckpoint(data.data(), (double)data.size());
+  if (size == 0) {
+    fprintf(stderr, "%s: %s\n", path.c_str(), getCheckpointError());
+    return false;
+  }
+  FILE *out = fopen(path.c_str(), "wb");
+  bool ok = out && fwrite(data.data(), 1, size, out) == size;
+  if (out && fclose(out) != 0)
+    ok = false;
+  if (!ok)
+    fprintf(stderr, "%s: cannot write\n", path.c_str());
+  return ok;
+}
+
+bool readFile(const std::string &path, std::string &text) {
+  std::ifstream in(path);
+  if (!in)
+    return false;
+  std::ostringstream buffer;
+  buffer << in.rdbuf();
+  text = buffer.str();
+  return true;
+}
+
+// Configure the engine and set up the grid
+bool applyScenario(const Scenario &sc) {
+  if (!sc.network.empty()) {
+    std::string spec;
+    if (!readFile(sc.network, spec)) {
+      fprintf(stderr, "%s: cannot open\n", sc.network.c_str());
+      return false;
+    }
+    const int line = loadNetwork(spec.c_str());
+    if (line) {
+      fprintf(stderr, "%s:%d: %s\n", sc.network.c_str(), line,
+              getNetworkError());
+      return false;
+    }
+  }
+
+  setThreadCount(sc.threads);
+  setIntegrator(sc.integrator);
+  if (sc.tolerance > 0.0)
+    setTolerance(sc.tolerance);
+  setDiffusionScheme(sc.diffusion);
+  setReactionSubsteps(sc.substeps);
+  setStrangSplitting(sc.strang);
+  setDiffusionIntervals(sc.feedback_interval, sc.ecm_interval);
+  setFusedSweep(sc.fused);
+  setActiveSet(sc.active > 0.0, sc.active);
+  setCompression(sc.compression);
+
+  // A checkpoint brings its own rate constants; the scenario's override them
+  const int members = sc.members();
+  if (members > 1 && (!sc.restore.empty() || !sc.checkpoint.empty())) {
+    fprintf(stderr, "a sweep cannot restore or save a checkpoint\n");
+    return false;
+  }
+  if (members > 1 && !sc.sensitivity.empty()) {
+    fprintf(stderr, "a sweep cannot record sensitivities\n");
+    return false;
+  }
+  setSensitivity(!sc.sensitivity.empty());
+  if (!sc.restore.empty()) {
+    if (!restoreCheckpoint(sc.restore))
+      return false;
+  } else {
+    setRandomSeed(sc.seed);
+    setEnsembleSize(members);
+    if (!initializeGrid(sc.rows, sc.cols)) {
+      fprintf(stderr, "cannot allocate a %d x %d grid\n", sc.rows, sc.cols);
+      return false;
+    }
+  }
+  if (!sc.sensitivity.empty() && !getSensitivity()) {
+    fprintf(stderr, "the sensitivity fields do not fit in memory\n");
+    return false;
+  }
+  setTimeStep(sc.dt);
+  for (const auto &param : sc.params) {
+    if (!setParameter(param.first.c_str(), param.second)) {
+      fprintf(stderr, "unknown parameter '%s'\n", param.first.c_str());
+      return false;
+    }
+  }
+
+  for (const auto &input : sc.inputs) {
+    const int index = inputIndex(input.first);
+    if (index < 0) {
+      fprintf(stderr, "unknown input '%s'\n", input.first.c_str());
+      return false;
+    }
+    setInputConcentration(index, input.second);
+  }
+  for (const Brush &b : sc.brushes) {
+    const int index = inputIndex(b.input);
+    if (index < 0) {
+      fprintf(stderr, "unknown input '%s'\n", b.input.c_str());
+      return false;
+    }
+    for (int row = b.row0; row <= b.row1; row++) {
+      for (int col = b.col0; col <= b.col1; col++) {
+        for (int m = 0; m < members; m++)
+          setCellInputConcentration(index, row, col * members + m, b.value);
+      }
+    }
+  }
+
+  // Give every member its combination of swept values
+  for (size_t i = 0; i < sc.sweeps.size(); i++) {
+    const Sweep &sweep = sc.sweeps[i];
+    const int index = inputIndex(sweep.name);
+    if (index < 0 && std::isnan(getMemberParameter(0, sweep.name.c_str()))) {
+      fprintf(stderr, "cannot sweep '%s'\n", sweep.name.c_str());
+      return false;
+    }
+    for (int m = 0; m < members; m++) {
+      if (index >= 0)
+        setMemberInput(m, index, sc.sweepValue(i, m));
+      else
+        setMemberParameter(m, sweep.name.c_str(), sc.sweepValue(i, m));
+    }
+  }
+  return true;
+}
+
+// Write the swept values of every member
+bool writeMembers(const std::string &prefix, const Scenario &sc) {
+  const std::string path = prefix + "_members.csv";
+  FILE *out = fopen(path.c_str(), "w");
+  if (!out) {
+    fprintf(stderr, "%s: cannot write\n", path.c_str());
+    return false;
+  }
+  fprintf(out, "member");
+  for (const Sweep &sweep : sc.sweeps)
+    fprintf(out, ",%s", sweep.name.c_str());
+  fprintf(out, "\n");
+  for (int m = 0; m < sc.members(); m++) {
+    fprintf(out, "%d", m);
+    for (size_t i = 0; i < sc.sweeps.size(); i++)
+      fprintf(out, ",%.10g", sc.sweepValue(i, m));
+    fprintf(out, "\n");
+  }
+  fclose(out);
+  return true;
+}
+
+// Time series rows of the recorded species, one per ensemble member
+void writeRecord(FILE *out, int step, const std::vector<int> &species) {
+  const int members = getEnsembleSize();
+  const int cells = getGridRows() * getGridCols();
+  for (int m = 0; m < members; m++) {
+    fprintf(out, "%d,%.10g", step, getSimulationTime());
+    if (members > 1)
+      fprintf(out, ",%d", m);
+    for (int s : species) {
+      const ECMScalar *values = getFieldView(s);
+      double sum = 0.0, lo = values[m], hi = values[m];
+      for (int c = m; c < cells; c += members) {
+        sum += values[c];
+        lo = std::min(lo, (double)values[c]);
+        hi = std::max(hi, (double)values[c]);
+      }
+      fprintf(out, ",%.10g,%.10g,%.10g", sum / (cells / members), lo, hi);
+    }
+    fprintf(out, "\n");
+  }
+  fflush(out);
+}
+
+// Rate constants of the sensitivities, in getSensitivityView order
+const char *const RATE_CONSTANTS[] = {
+    "k_input",      "k_feedback",   "k_degradation", "k_receptor",
+    "k_inhibition", "k_activation", "k_production",  "k_diffusion"};
+
+// Sensitivity row: the grid mean of d(species)/d(k) for every species and
+// rate constant
+void writeSensitivity(FILE *out, int step, const std::vector<int> &species) {
+  const int cells = getGridRows() * getGridCols();
+  const int count = (int)(sizeof(RATE_CONSTANTS) / sizeof(RATE_CONSTANTS[0]));
+  const size_t stride = getSensitivityStride();
+  fprintf(out, "%d,%.10g", step, getSimulationTime());
+  for (int s : species) {
+    const double *values = getSensitivityView(s);
+    for (int p = 0; p < count; p++) {
+      double sum = 0.0;
+      for (int c = 0; values && c < cells; c++)
+        sum += values[c * stride + p];
+      fprintf(out, ",%.10g", sum / cells);
+    }
+  }
+  fprintf(out, "\n");
+  fflush(out);
+}
+
+// Write the fields of the saved species, one file each per ensemble member
+bool writeFields(const std::string &prefix, int step,
+                 const std::vector<std::string> &names,
+                 const std::vector<int> &species) {
+  const int members = getEnsembleSize();
+  const int rows = getGridRows();
+  const int cols = getGridCols();
+  for (size_t i = 0; i < species.size(); i++) {
+    for (int m = 0; m < members; m++) {
+      const std::string member =
+          members > 1 ? "_m" + std::to_string(m) : std::string();
+      const std::string path = prefix + "_" + names[i] + member + "_" +
+                               std::to_string(step) + ".csv";
+      FILE *out = fopen(path.c_str(), "w");
+      if (!out) {
+        fprintf(stderr, "%s: cannot write\n", path.c_str());
+        return false;
+      }
+      const ECMScalar *values = getFieldView(species[i]);
+      for (int row = 0; row < rows; row++) {
+        for (int col = m; col < cols; col += members)
+          fprintf(out, col != m ? ",%.8g" : "%.8g",
+                  (double)values[row * cols + col]);
+        fprintf(out, "\n");
+      }
+      fclose(out);
+    }
+  }
+  return true;
+}
+
+// Print steps/sec and the time, calls, cells and allocated bytes of every
+// profiled phase
+void printProfile() {
+  static const char *const names[] = {"reaction", "feedback diffusion",
+                                      "ECM diffusion", "readback", "step"};
+  const double *p = getProfile();
+  const double *step = p + 4 * 5;
+  fprintf(stderr, "profile: %.1f steps/s\n",
+          step[0] > 0.0 ? step[2] / (step[0] * 1e-9) : 0.0);
+  fprintf(stderr, "  %-20s %12s %8s %10s %14s %12s\n", "phase", "total ms",
+          "share", "calls", "cells", "bytes");
+  for (int i = 0; i < 5; i++) {
+    const double *row = p + i * 5;
+    char share[16] = "";
+    if (i != 3 && step[0] > 0.0)
+      snprintf(share, sizeof(share), "%.1f%%", 100.0 * row[0] / step[0]);
+    fprintf(stderr, "  %-20s %12.3f %8s %10.0f %14.0f %12.0f\n", names[i],
+            row[0] * 1e-6, share, row[2], row[4], row[3]);
+  }
+}
+
+void usage() {
+  fprintf(stderr,
+          "usage: ecmsim [-o PREFIX] [-t THREADS] [-p] [-q] SCENARIO\n");
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  const char *path = nullptr;
+  const char *prefix = nullptr;
+  int threads = -1;
+  bool quiet = false;
+  bool profile = false;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+      prefix = argv[++i];
+    } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-p") == 0) {
+      profile = true;
+    } else if (strcmp(argv[i], "-q") == 0) {
+      quiet = true;
+    } else if (argv[i][0] != '-' && !path) {
+      path = argv[i];
+    } else {
+      usage();
+      return 2;
+    }
+  }
+  if (!path) {
+    usage();
+    return 2;
+  }
+
+  Scenario sc;
+  if (!parseScenario(path, sc))
+    return 1;
+  if (threads >= 0)
+    sc.threads = threads;
+  if (prefix)
+    sc.output = prefix;
+  if (sc.output.empty()) {
+    sc.output = path;
+    sc.output = sc.output.substr(0, sc.output.rfind('.'));
+  }
+  if (!applyScenario(sc) ||
+      (sc.members() > 1 && !writeMembers(sc.output, sc)))
+    return 1;
+
+  std::vector<int> record, save, sensitivity;
+  if (!speciesIndices(sc.record, record) || !speciesIndices(sc.save, save) ||
+      !speciesIndices(sc.sensitivity, sensitivity))
+    return 1;
+
+  FILE *series = nullptr;
+  if (!record.empty()) {
+    const std::string file = sc.output + ".csv";
+    series = fopen(file.c_str(), "w");
+    if (!series) {
+      fprintf(stderr, "%s: cannot write\n", file.c_str());
+      return 1;
+    }
+    fprintf(series, sc.members() > 1 ? "step,time,member" : "step,time");
+    for (const std::string &name : sc.record)
+      fprintf(series, ",%s_mean,%s_min,%s_max", name.c_str(), name.c_str(),
+              name.c_str());
+    fprintf(series, "\n");
+  }
+
+  FILE *sensitivities = nullptr;
+  if (!sensitivity.empty()) {
+    const std::string file = sc.output + "_sensitivity.csv";
+    sensitivities = fopen(file.c_str(), "w");
+    if (!sensitivities) {
+      fprintf(stderr, "%s: cannot write\n", file.c_str());
+      return 1;
+    }
+    fprintf(sensitivities, "step,time");
+    for (const std::string &name : sc.sensitivity) {
+      for (const char *k : RATE_CONSTANTS)
+        fprintf(sensitivities, ",d%s/d%s", name.c_str(), k);
+    }
+    fprintf(sensitivities, "\n");
+  }
+
+  auto output = [&](int step) {
+    if (series)
+      writeRecord(series, step, record);
+    if (sensitivities)
+      writeSensitivity(sensitivities, step, sensitivity);
+    if (!quiet)
+      fprintf(stderr, "step %d/%d  time %g\n", step, sc.steps,
+              getSimulationTime());
+    return writeFields(sc.output, step, sc.save, save);
+  };
+
+  FrameWriter stream;
+  const bool streaming = !sc.stream.empty();
+  if (streaming) {
+    if (sc.stream_species.empty()) {
+      fprintf(stderr, "stream needs stream_species\n");
+      return 1;
+    }
+    if (!speciesIndices(sc.stream_species, sc.stream_options.species))
+      return 1;
+    if (!stream.open(sc.stream, sc.stream_options)) {
+      fprintf(stderr, "%s\n", stream.error().c_str());
+      return 1;
+    }
+  }
+
+  setProfiling(profile);
+
+  // Step from one output or streamed frame to the next. Time spent
+  // stepping, without the output.
+  double seconds = 0.0;
+  const int every = sc.every > 0 ? sc.every : sc.steps;
+  const int stream_every = sc.stream_options.time_stride;
+  bool ok = output(0) && (!streaming || stream.capture(0, getSimulationTime()));
+  int step = 0;
+  while (ok && step < sc.steps) {
+    int next = std::min(sc.steps, (step / every + 1) * every);
+    if (streaming)
+      next = std::min(next, (step / stream_every + 1) * stream_every);
+    const auto start = std::chrono::steady_clock::now();
+    step += simulateSteps(next - step, sc.dt);
+    seconds += std::chrono::duration<double>(
+                   std::chrono::steady_clock::now() - start)
+                   .count();
+    if (step % every == 0 || step == sc.steps)
+      ok = output(step);
+    if (ok && streaming)
+      ok = stream.capture(step, getSimulationTime());
+  }
+  if (series)
+    fclose(series);
+  if (sensitivities)
+    fclose(sensitivities);
+  if (streaming) {
+    if (!stream.close()) {
+      fprintf(stderr, "%s: %s\n", sc.stream.c_str(), stream.error().c_str());
+      ok = false;
+    } else if (!quiet) {
+      fprintf(stderr,
+              "streamed %lld frames to %s: %.1f MB, %.1f MB stored, "
+              "%.3f s waiting for the writer\n",
+              stream.frames(), sc.stream.c_str(), stream.rawBytes() / 1e6,
+              stream.storedBytes() / 1e6, stream.stallSeconds());
+    }
+  }
+  if (ok && !sc.checkpoint.empty())
+    ok = saveCheckpointFile(sc.checkpoint);
+  if (!ok)
+    return 1;
+
+  if (!quiet) {
+    const double cell_steps = (double)getGridRows() * getGridCols() * step;
+    fprintf(stderr,
+            "%d steps of %d x %d cells x %d members in %.3f s (%d threads, "
+            "%d lanes): %.3g cell-steps/s\n",
+            step, getGridRows(), getGridCols() / getEnsembleSize(),
+            getEnsembleSize(), seconds, getThreadCount(), getSimdLanes(),
+            seconds > 0.0 ? cell_steps / seconds : 0.0);
+  }
+  if (profile)
+    printProfile();
+  return 0;
+}
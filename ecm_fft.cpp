@@ -0,0 +1,141 @@
+#include "ecm_fft.h"
+
+#include <cmath>
+#include <utility>
+
+static const double PI = 3.14159265358979323846;
+
+static bool isPowerOfTwo(int n) { return (n & (n - 1)) == 0; }
+
+void FFT::Radix2::prepare(int size) {
+  n = size;
+  int bits = 0;
+  while ((1 << bits) < n)
+    bits++;
+  reverse.resize(n);
+  for (int i = 0; i < n; i++) {
+    int r = 0;
+    for (int b = 0; b < bits; b++)
+      r |= ((i >> b) & 1) << (bits - 1 - b);
+    reverse[i] = r;
+  }
+  cos_.resize(n / 2);
+  sin_.resize(n / 2);
+  for (int k = 0; k < n / 2; k++) {
+    cos_[k] = std::cos(2.0 * PI * k / n);
+    sin_[k] = -std::sin(2.0 * PI * k / n);
+  }
+}
+
+template <typename T>
+void FFT::Radix2::transform(T *re, T *im, bool inverse) const {
+  for (int i = 0; i < n; i++) {
+    const int r = reverse[i];
+    if (r > i) {
+      std::swap(re[i], re[r]);
+      std::swap(im[i], im[r]);
+    }
+  }
+
+  const double sign = inverse ? -1.0 : 1.0;
+  for (int len = 2; len <= n; len *= 2) {
+    const int half = len / 2;
+    const int step = n / len;
+    for (int start = 0; start < n; start += len) {
+      for (int k = 0; k < half; k++) {
+        const double wr = cos_[k * step];
+        const double wi = sign * sin_[k * step];
+        const int a = start + k;
+        const int b = a + half;
+        const double tr = re[b] * wr - im[b] * wi;
+        const double ti = re[b] * wi + im[b] * wr;
+        re[b] = re[a] - tr;
+        im[b] = im[a] - ti;
+        re[a] += tr;
+        im[a] += ti;
+      }
+    }
+  }
+}
+
+void FFT::prepare(int n) {
+  n_ = n;
+  if (isPowerOfTwo(n)) {
+    m_ = 0;
+    radix2_.prepare(n);
+    return;
+  }
+
+  m_ = 1;
+  while (m_ < 2 * n - 1)
+    m_ *= 2;
+  radix2_.prepare(m_);
+
+  // Chirp, with k^2 reduced mod 2n to keep the angle accurate
+  chirp_re_.resize(n);
+  chirp_im_.resize(n);
+  for (int k = 0; k < n; k++) {
+    const long long k2 = (long long)k * k % (2LL * n);
+    chirp_re_[k] = std::cos(PI * k2 / n);
+    chirp_im_[k] = -std::sin(PI * k2 / n);
+  }
+
+  // Kernel b_j = conj(c_j) for |j| < n, wrapped to length m_
+  kernel_re_.assign(m_, 0.0);
+  kernel_im_.assign(m_, 0.0);
+  for (int k = 0; k < n; k++) {
+    kernel_re_[k] = chirp_re_[k];
+    kernel_im_[k] = -chirp_im_[k];
+    if (k > 0) {
+      kernel_re_[m_ - k] = kernel_re_[k];
+      kernel_im_[m_ - k] = kernel_im_[k];
+    }
+  }
+  radix2_.transform(kernel_re_.data(), kernel_im_.data(), false);
+  for (int k = 0; k < m_; k++) {
+    kernel_re_[k] /= m_;
+    kernel_im_[k] /= m_;
+  }
+}
+
+size_t FFT::workSize() const { return 2 * (size_t)m_; }
+
+template <typename T>
+void FFT::transform(T *re, T *im, bool inverse, double *work) const {
+  if (m_ == 0) {
+    radix2_.transform(re, im, inverse);
+    return;
+  }
+
+  // The inverse transform is the conjugate of the forward transform of the
+  // conjugate
+  const double sign = inverse ? -1.0 : 1.0;
+  double *a_re = work;
+  double *a_im = work + m_;
+  for (int k = 0; k < n_; k++) {
+    const double x_re = re[k];
+    const double x_im = sign * im[k];
+    a_re[k] = x_re * chirp_re_[k] - x_im * chirp_im_[k];
+    a_im[k] = x_re * chirp_im_[k] + x_im * chirp_re_[k];
+  }
+  for (int k = n_; k < m_; k++)
+    a_re[k] = a_im[k] = 0.0;
+
+  // Convolve with the kernel
+  radix2_.transform(a_re, a_im, false);
+  for (int k = 0; k < m_; k++) {
+    const double r = a_re[k] * kernel_re_[k] - a_im[k] * kernel_im_[k];
+    const double i = a_re[k] * kernel_im_[k] + a_im[k] * kernel_re_[k];
+    a_re[k] = r;
+    a_im[k] = i;
+  }
+  radix2_.transform(a_re, a_im, true);
+
+  for (int k = 0; k < n_; k++) {
+    re[k] = a_re[k] * chirp_re_[k] - a_im[k] * chirp_im_[k];
+    im[k] = sign * (a_re[k] * chirp_im_[k] + a_im[k] * chirp_re_[k]);
+  }
+}
+
+template void FFT::transform(double *, double *, bool, double *) const;
+template void FFT::transform(float *, float *, bool, double *) const;
@@ -0,0 +1,51 @@
+// Self-contained complex FFT for the spectral diffusion scheme.
+//
+// Transforms of any length n >= 1: powers of two use an iterative radix-2
+// transform, other lengths Bluestein's algorithm, which rewrites the DFT as
+// a convolution evaluated with radix-2 transforms of length >= 2n - 1. Data
+// is in split format (separate real and imaginary arrays) so two real
+// fields can be transformed at once as the real and imaginary parts of one
+// complex field.
+#ifndef ECM_FFT_H
+#define ECM_FFT_H
+
+#include <cstddef>
+#include <vector>
+
+class FFT {
+public:
+  // Plan transforms of length n >= 1
+  void prepare(int n);
+  int size() const { return n_; }
+
+  // Doubles of workspace transform() needs (0 for powers of two)
+  size_t workSize() const;
+
+  // Unnormalized forward (exp(-2 pi i jk / n)) or inverse transform in
+  // place. work must hold workSize() doubles. T is double or float; the
+  // arithmetic is in double either way.
+  template <typename T>
+  void transform(T *re, T *im, bool inverse, double *work) const;
+
+private:
+  int n_ = 0;
+
+  // Radix-2 plan of length n_ (or m_ for Bluestein)
+  struct Radix2 {
+    int n = 0;
+    std::vector<int> reverse;    // Bit-reversal permutation
+    std::vector<double> cos_;    // Twiddles exp(-2 pi i k / n), k < n / 2
+    std::vector<double> sin_;
+    void prepare(int n);
+    template <typename T> void transform(T *re, T *im, bool inverse) const;
+  };
+  Radix2 radix2_;
+
+  // Bluestein: chirp c_k = exp(-pi i k^2 / n) and the transformed,
+  // normalized convolution kernel of length m_
+  int m_ = 0;
+  std::vector<double> chirp_re_, chirp_im_;
+  std::vector<double> kernel_re_, kernel_im_;
+};
+
+#endif // ECM_FFT_H
@@ -0,0 +1,675 @@
+// Reaction network of the cardiac fibroblast model.
+//
+// The network is declared once, as a constexpr table of rate terms
+// (NETWORK). Templates at the end of this file expand that table at compile
+// time into a fully inlined, branch-free rate kernel and the matching
+// Jacobian for any arithmetic type T, so adding a pathway only means adding
+// rows to the table.
+#ifndef ECM_NETWORK_H
+#define ECM_NETWORK_H
+
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include <utility>
+
+#if defined(__GNUC__) || defined(__clang__)
+#define NETWORK_INLINE inline __attribute__((always_inline))
+#else
+#define NETWORK_INLINE inline
+#endif
+
+// Every molecule tracked per cell. Intracellular (icm) species come first,
+// followed by the extracellular ECM pool and the diffusing feedback
+// molecules. ECM, feedback and input blocks are listed in the same order as
+// the molecule indices used by the exported getters/setters.
+namespace sp {
+enum Species : int {
+  // Input signals
+  AngIIin, TGFBin, tensionin, IL6in, IL1in, TNFain, NEin, PDGFin, ET1in, NPin,
+  E2in,
+
+  // Ligands
+  AngII, TGFB, tension, IL6, IL1, TNFa, NE, PDGF, ET1, NP, E2,
+
+  // Receptors
+  AT1R, TGFB1R, ETAR, IL1RI, PDGFR, TNFaR, NPRA, gp130, BAR, AT2R,
+
+  // Second messengers
+  NOX, ROS, DAG, AC, cAMP, cGMP, Ca, TRPC,
+
+  // Kinases and phosphatases
+  PKA, PKG, PKC, calcineurin, PP1,
+
+  // Transcription factors
+  CREB, CBP, NFAT, AP1, STAT, NFKB, SRF, MRTF,
+
+  // MAPK pathways
+  Ras, Raf, MEK1, ERK, p38, JNK, MKK3, MKK4, MEKK1, ASK1, TRAF,
+
+  // PI3K-Akt-mTOR pathway
+  PI3K, Akt, mTORC1, mTORC2, p70S6K, EBP1,
+
+  // Rho/ROCK pathway
+  Rho, ROCK, RhoGEF, RhoGDI,
+
+  // Cytoskeleton and adhesion
+  Factin, Gactin, B1int, B3int, FAK, Src, Grb2, p130Cas, Rac1, abl, talin,
+  vinculin, paxillin, FA, MLC, contractility,
+
+  // YAP/TAZ signaling
+  YAP,
+
+  // Estrogen signaling
+  ERX, ERB, GPR30, CyclinB1, CDK1,
+
+  // Additional components
+  AGT, ACE, BAMBI, smad3, smad7, epac, cmyc, proliferation, latentTGFB,
+  thrombospondin4, osteopontin, syndecan4, aSMA, LOX,
+
+  // Intracellular ECM production
+  proCI, proCIII, fibronectin, periostin, TNC, PAI1, CTGF, EDAFN, TIMP1, TIMP2,
+  proMMP1, proMMP2, proMMP3, proMMP8, proMMP9, proMMP12, proMMP14,
+
+  NUM_ICM,
+
+  // Extracellular ECM components
+  proCI_ecm = NUM_ICM, proCIII_ecm, fibronectin_ecm, periostin_ecm, TNC_ecm,
+  PAI1_ecm, CTGF_ecm, EDAFN_ecm, TIMP1_ecm, TIMP2_ecm, proMMP1_ecm,
+  proMMP2_ecm, proMMP3_ecm, proMMP8_ecm, proMMP9_ecm, proMMP12_ecm,
+  proMMP14_ecm,
+
+  // Feedback mechanisms
+  TGFBfb, AngIIfb, IL6fb, ET1fb, tensionfb,
+
+  NUM_SPECIES
+};
+
+constexpr int FIRST_INPUT = AngIIin;
+constexpr int NUM_INPUTS = E2in - AngIIin + 1;
+constexpr int FIRST_ECM = proCI_ecm;
+constexpr int NUM_ECM = proMMP14_ecm - proCI_ecm + 1;
+constexpr int FIRST_FEEDBACK = TGFBfb;
+constexpr int NUM_FEEDBACK = tensionfb - TGFBfb + 1;
+} // namespace sp
+
+// Species names, indexed by sp::Species
+constexpr const char *SPECIES_NAMES[] = {
+    "AngIIin", "TGFBin", "tensionin", "IL6in", "IL1in", "TNFain", "NEin",
+    "PDGFin", "ET1in", "NPin", "E2in", "AngII", "TGFB", "tension", "IL6", "IL1",
+    "TNFa", "NE", "PDGF", "ET1", "NP", "E2", "AT1R", "TGFB1R", "ETAR", "IL1RI",
+    "PDGFR", "TNFaR", "NPRA", "gp130", "BAR", "AT2R", "NOX", "ROS", "DAG", "AC",
+    "cAMP", "cGMP", "Ca", "TRPC", "PKA", "PKG", "PKC", "calcineurin", "PP1",
+    "CREB", "CBP", "NFAT", "AP1", "STAT", "NFKB", "SRF", "MRTF", "Ras", "Raf",
+    "MEK1", "ERK", "p38", "JNK", "MKK3", "MKK4", "MEKK1", "ASK1", "TRAF",
+    "PI3K", "Akt", "mTORC1", "mTORC2", "p70S6K", "EBP1", "Rho", "ROCK",
+    "RhoGEF", "RhoGDI", "Factin", "Gactin", "B1int", "B3int", "FAK", "Src",
+    "Grb2", "p130Cas", "Rac1", "abl", "talin", "vinculin", "paxillin", "FA",
+    "MLC", "contractility", "YAP", "ERX", "ERB", "GPR30", "CyclinB1", "CDK1",
+    "AGT", "ACE", "BAMBI", "smad3", "smad7", "epac", "cmyc", "proliferation",
+    "latentTGFB", "thrombospondin4", "osteopontin", "syndecan4", "aSMA", "LOX",
+    "proCI", "proCIII", "fibronectin", "periostin", "TNC", "PAI1", "CTGF",
+    "EDAFN", "TIMP1", "TIMP2", "proMMP1", "proMMP2", "proMMP3", "proMMP8",
+    "proMMP9", "proMMP12", "proMMP14", "proCI_ecm", "proCIII_ecm",
+    "fibronectin_ecm", "periostin_ecm", "TNC_ecm", "PAI1_ecm", "CTGF_ecm",
+    "EDAFN_ecm", "TIMP1_ecm", "TIMP2_ecm", "proMMP1_ecm", "proMMP2_ecm",
+    "proMMP3_ecm", "proMMP8_ecm", "proMMP9_ecm", "proMMP12_ecm", "proMMP14_ecm",
+    "TGFBfb", "AngIIfb", "IL6fb", "ET1fb", "tensionfb",
+};
+static_assert(sizeof(SPECIES_NAMES) / sizeof(SPECIES_NAMES[0]) ==
+                  sp::NUM_SPECIES,
+              "SPECIES_NAMES must list every species");
+
+// Look up a species by name, -1 if unknown
+inline int speciesIndex(const char *name) {
+  for (int s = 0; s < sp::NUM_SPECIES; s++) {
+    if (strcmp(SPECIES_NAMES[s], name) == 0)
+      return s;
+  }
+  return -1;
+}
+
+namespace net {
+
+// Rate constants referenced by network terms, in RateConstants order
+enum Param : int {
+  K_INPUT,
+  K_FEEDBACK,
+  K_DEGRADATION,
+  K_RECEPTOR,
+  K_INHIBITION,
+  K_ACTIVATION,
+  K_PRODUCTION,
+  K_DIFFUSION,
+  NUM_PARAMS
+};
+
+constexpr const char *PARAM_NAMES[] = {
+    "k_input",      "k_feedback",   "k_degradation", "k_receptor",
+    "k_inhibition", "k_activation", "k_production",  "k_diffusion"};
+static_assert(sizeof(PARAM_NAMES) / sizeof(PARAM_NAMES[0]) == NUM_PARAMS,
+              "PARAM_NAMES must list every parameter");
+
+constexpr int MAX_FACTORS = 3;
+constexpr int MAX_MONOMIALS = 6;
+
+// A species concentration x, or its complement (1 - x)
+struct Factor {
+  int species;
+  bool complement;
+
+  constexpr Factor() : species(0), complement(false) {}
+  constexpr Factor(sp::Species s, bool c = false)
+      : species(s), complement(c) {}
+};
+
+constexpr Factor oneMinus(sp::Species s) { return Factor(s, true); }
+
+// Product of up to MAX_FACTORS factors; the empty product is 1
+struct Monomial {
+  Factor factors[MAX_FACTORS];
+  int count;
+
+  constexpr Monomial() : factors(), count(0) {}
+  constexpr Monomial(Factor f) : factors{f}, count(1) {}
+  constexpr Monomial(sp::Species s) : factors{Factor(s)}, count(1) {}
+};
+
+template <typename... F> constexpr Monomial times(F... f) {
+  static_assert(sizeof...(F) <= MAX_FACTORS, "too many factors in product");
+  Monomial m;
+  ((m.factors[m.count++] = Factor(f)), ...);
+  return m;
+}
+
+// One signed contribution to the rate of `target`:
+//   sign * k[param] * scale * (monomial_0 + monomial_1 + ...)
+struct Term {
+  int target;
+  int sign;
+  Param param;
+  double scale;
+  Monomial monomials[MAX_MONOMIALS];
+  int count;
+};
+
+constexpr Term term(sp::Species target, int sign, Param param,
+                    std::initializer_list<Monomial> sum, double scale = 1.0) {
+  Term t{target, sign, param, scale, {}, 0};
+  for (const Monomial &m : sum)
+    t.monomials[t.count++] = m;
+  return t;
+}
+
+// Term vocabulary of the model
+constexpr Term input(sp::Species target, sp::Species signal) {
+  return term(target, +1, K_INPUT, {signal});
+}
+
+constexpr Term feedback(sp::Species target, sp::Species signal) {
+  return term(target, +1, K_FEEDBACK, {signal});
+}
+
+constexpr Term receptor(sp::Species target, sp::Species ligand) {
+  return term(target, +1, K_RECEPTOR, {ligand});
+}
+
+constexpr Term activation(sp::Species target, Monomial by) {
+  return term(target, +1, K_ACTIVATION, {by});
+}
+
+// k_activation * (m_0 + m_1 + ...)
+constexpr Term activation(sp::Species target,
+                          std::initializer_list<Monomial> by) {
+  return term(target, +1, K_ACTIVATION, by);
+}
+
+// Constitutive activation at rate k_activation
+constexpr Term basal(sp::Species target) {
+  return term(target, +1, K_ACTIVATION, {Monomial()});
+}
+
+constexpr Term inhibition(sp::Species target, sp::Species by) {
+  return term(target, -1, K_INHIBITION, {times(target, by)});
+}
+
+constexpr Term degradation(sp::Species target) {
+  return term(target, -1, K_DEGRADATION, {target});
+}
+
+constexpr Term production(sp::Species target, sp::Species from) {
+  return term(target, +1, K_PRODUCTION, {from});
+}
+
+// Slow extracellular turnover at 1% of the degradation rate
+constexpr Term turnover(sp::Species target) {
+  return term(target, -1, K_DEGRADATION, {target}, 0.01);
+}
+
+using namespace sp;
+
+constexpr Term NETWORK[] = {
+    // Input signals to ligands
+    input(AngII, AngIIin), feedback(AngII, AngIIfb), degradation(AngII),
+    input(TGFB, TGFBin), feedback(TGFB, TGFBfb), degradation(TGFB),
+    input(tension, tensionin), feedback(tension, tensionfb),
+    degradation(tension),
+    input(IL6, IL6in), feedback(IL6, IL6fb), degradation(IL6),
+    input(IL1, IL1in), degradation(IL1),
+    input(TNFa, TNFain), degradation(TNFa),
+    input(NE, NEin), degradation(NE),
+    input(PDGF, PDGFin), degradation(PDGF),
+    input(ET1, ET1in), feedback(ET1, ET1fb), degradation(ET1),
+    input(NP, NPin), degradation(NP),
+    input(E2, E2in), degradation(E2),
+
+    // Receptor activation with inhibition
+    receptor(AT1R, AngII), inhibition(AT1R, ERB), degradation(AT1R),
+    receptor(TGFB1R, TGFB), inhibition(TGFB1R, BAMBI), degradation(TGFB1R),
+    receptor(ETAR, ET1), degradation(ETAR),
+    receptor(IL1RI, IL1), degradation(IL1RI),
+    receptor(PDGFR, PDGF), degradation(PDGFR),
+    receptor(TNFaR, TNFa), degradation(TNFaR),
+    receptor(NPRA, NP), degradation(NPRA),
+    receptor(gp130, IL6), degradation(gp130),
+    receptor(BAR, NE), degradation(BAR),
+    receptor(AT2R, AngII), degradation(AT2R),
+
+    // Second messengers
+    activation(NOX, {AT1R, TGFB1R}), degradation(NOX),
+    activation(ROS, {NOX, ETAR}), degradation(ROS),
+    activation(DAG, {ETAR, AT1R}), degradation(DAG),
+    activation(AC, BAR), inhibition(AC, AT1R), degradation(AC),
+    activation(cAMP, {AC, ERB}), degradation(cAMP),
+    activation(cGMP, NPRA), degradation(cGMP),
+    activation(Ca, TRPC), degradation(Ca),
+
+    // Kinases and phosphatases
+    activation(PKA, {cAMP, ERB}), degradation(PKA),
+    activation(PKG, cGMP), degradation(PKG),
+    activation(PKC, {times(DAG, mTORC2), syndecan4}), degradation(PKC),
+    activation(calcineurin, Ca), degradation(calcineurin),
+    activation(PP1, p38), degradation(PP1),
+
+    // Transcription factors
+    activation(CREB, PKA), degradation(CREB),
+    activation(CBP, oneMinus(smad3)), activation(CBP, oneMinus(CREB)),
+    degradation(CBP),
+    activation(NFAT, calcineurin), degradation(NFAT),
+    activation(AP1, {ERK, JNK}), degradation(AP1),
+    activation(STAT, gp130), degradation(STAT),
+    activation(NFKB, IL1RI), activation(NFKB, ERK), activation(NFKB, p38),
+    activation(NFKB, Akt), inhibition(NFKB, ERX), degradation(NFKB),
+    activation(SRF, MRTF), degradation(SRF),
+    activation(MRTF, NFAT), inhibition(MRTF, Gactin), degradation(MRTF),
+
+    // MAPK pathways
+    activation(Ras, {AT1R, Grb2}), degradation(Ras),
+    activation(Raf, Ras), degradation(Raf),
+    activation(MEK1, Raf), inhibition(MEK1, ERK), degradation(MEK1),
+    activation(ERK, MEK1), inhibition(ERK, PP1), activation(ERK, ROS),
+    inhibition(ERK, AT2R), degradation(ERK),
+    activation(p38, ROS), activation(p38, MKK3), activation(p38, Ras),
+    activation(p38, Rho), inhibition(p38, Rac1), degradation(p38),
+    activation(JNK, ROS), activation(JNK, MKK4), inhibition(JNK, NFKB),
+    inhibition(JNK, Rho), degradation(JNK),
+    activation(MKK3, ASK1), degradation(MKK3),
+    activation(MKK4, {MEKK1, ASK1}), degradation(MKK4),
+    activation(MEKK1, {FAK, Rac1}), degradation(MEKK1),
+    activation(ASK1, {TRAF, IL1RI}), degradation(ASK1),
+    activation(TRAF, {TGFB1R, TNFaR}), degradation(TRAF),
+
+    // PI3K-Akt-mTOR pathway
+    activation(PI3K, {TNFaR, TGFB1R, PDGFR, FAK}), degradation(PI3K),
+    activation(Akt, times(PI3K, mTORC2)), activation(Akt, ERX),
+    activation(Akt, GPR30), degradation(Akt),
+    activation(mTORC1, Akt), degradation(mTORC1),
+    basal(mTORC2), inhibition(mTORC2, p70S6K), degradation(mTORC2),
+    activation(p70S6K, mTORC1), degradation(p70S6K),
+    basal(EBP1), inhibition(EBP1, mTORC1), degradation(EBP1),
+
+    // Rho/ROCK pathway
+    activation(Rho, TGFB1R), activation(Rho, RhoGEF), inhibition(Rho, RhoGDI),
+    inhibition(Rho, PKG), degradation(Rho),
+    activation(ROCK, Rho), degradation(ROCK),
+    activation(RhoGEF, times(FAK, Src)), degradation(RhoGEF),
+    basal(RhoGDI), inhibition(RhoGDI, Src), activation(RhoGDI, PKA),
+    basal(RhoGDI), inhibition(RhoGDI, PKC), degradation(RhoGDI),
+
+    // Cytoskeleton and adhesion
+    activation(Factin, times(ROCK, Gactin)), degradation(Factin),
+    basal(Gactin), inhibition(Gactin, Factin), degradation(Gactin),
+    activation(B1int, tension), activation(B1int, times(PKC, tension)),
+    degradation(B1int),
+    activation(B3int, tension), inhibition(B3int, thrombospondin4),
+    activation(B3int, osteopontin), degradation(B3int),
+    activation(FAK, B1int), degradation(FAK),
+    activation(Src, {PDGFR, B3int}), degradation(Src),
+    activation(Grb2, times(FAK, Src)), degradation(Grb2),
+    activation(p130Cas, {times(tension, Src), times(FAK, Src)}),
+    degradation(p130Cas),
+    activation(Rac1, abl), activation(Rac1, times(p130Cas, abl)),
+    degradation(Rac1),
+    activation(abl, PDGFR), degradation(abl),
+    activation(talin, {B1int, B3int}), degradation(talin),
+    activation(vinculin, times(contractility, talin)), degradation(vinculin),
+    activation(paxillin, times(FAK, Src, MLC)), degradation(paxillin),
+    activation(FA, times(vinculin, CDK1)), inhibition(FA, paxillin),
+    degradation(FA),
+    activation(MLC, ROCK), degradation(MLC),
+    activation(contractility, {times(Factin, MLC), times(aSMA, MLC)}),
+    degradation(contractility),
+
+    // YAP/TAZ signaling
+    activation(YAP, {AT1R, Factin}), degradation(YAP),
+
+    // Estrogen signaling
+    activation(ERX, E2), degradation(ERX),
+    activation(ERB, E2), degradation(ERB),
+    activation(GPR30, E2), degradation(GPR30),
+    basal(CyclinB1), inhibition(CyclinB1, GPR30), degradation(CyclinB1),
+    activation(CDK1, times(CyclinB1, AngII)), degradation(CDK1),
+
+    // Additional components
+    activation(AGT, times(oneMinus(AT1R), oneMinus(JNK), p38)),
+    degradation(AGT),
+    activation(ACE, TGFB1R), degradation(ACE),
+    activation(BAMBI, times(TGFB, IL1RI)), degradation(BAMBI),
+    activation(smad3, TGFB1R), inhibition(smad3, smad7),
+    inhibition(smad3, PKG), inhibition(smad3, ERB), activation(smad3, Akt),
+    degradation(smad3),
+    activation(smad7, STAT), activation(smad7, AP1), inhibition(smad7, YAP),
+    degradation(smad7),
+    activation(epac, cAMP), degradation(epac),
+    activation(cmyc, JNK), degradation(cmyc),
+    activation(proliferation, {CDK1, AP1, CREB, CTGF, PKC, p70S6K}),
+    inhibition(proliferation, EBP1), activation(proliferation, cmyc),
+    degradation(proliferation),
+    activation(latentTGFB, AP1), degradation(latentTGFB),
+    activation(thrombospondin4, smad3), degradation(thrombospondin4),
+    activation(osteopontin, AP1), degradation(osteopontin),
+    activation(syndecan4, tension), inhibition(syndecan4, TNC),
+    degradation(syndecan4),
+    activation(aSMA, {YAP, times(smad3, CBP), SRF}), degradation(aSMA),
+    activation(LOX, Akt), degradation(LOX),
+
+    // ECM production driven by intracellular signaling
+    activation(proCI, SRF), activation(proCI, times(smad3, CBP)),
+    inhibition(proCI, epac), degradation(proCI),
+    activation(proCIII, SRF), activation(proCIII, times(smad3, CBP)),
+    inhibition(proCIII, epac), degradation(proCIII),
+    activation(fibronectin, times(smad3, CBP)), activation(fibronectin, NFKB),
+    degradation(fibronectin),
+    activation(periostin, times(smad3, CBP)),
+    activation(periostin, times(CREB, CBP)), degradation(periostin),
+    activation(TNC, {NFKB, MRTF}), degradation(TNC),
+    activation(PAI1, {smad3, YAP}), degradation(PAI1),
+    activation(CTGF, times(smad3, CBP, ERK)), activation(CTGF, YAP),
+    degradation(CTGF),
+    activation(EDAFN, NFAT), degradation(EDAFN),
+
+    // MMPs and TIMPs
+    activation(proMMP1, times(NFKB, AP1)), inhibition(proMMP1, smad3),
+    degradation(proMMP1),
+    activation(proMMP2, {AP1, STAT}), degradation(proMMP2),
+    activation(proMMP3, times(NFKB, AP1)), inhibition(proMMP3, smad3),
+    degradation(proMMP3),
+    activation(proMMP8, times(NFKB, AP1)), inhibition(proMMP8, smad3),
+    degradation(proMMP8),
+    activation(proMMP9, {STAT, times(NFKB, AP1)}), degradation(proMMP9),
+    activation(proMMP12, CREB), degradation(proMMP12),
+    activation(proMMP14, {AP1, NFKB}), degradation(proMMP14),
+    activation(TIMP1, AP1), degradation(TIMP1),
+    activation(TIMP2, AP1), degradation(TIMP2),
+
+    // Feedback mechanisms
+    activation(TGFBfb, {times(proMMP9, latentTGFB), times(proMMP2, latentTGFB),
+                        times(tension, latentTGFB)}),
+    degradation(TGFBfb),
+    activation(AngIIfb, times(ACE, AGT)), degradation(AngIIfb),
+    activation(IL6fb, {times(CREB, CBP), NFKB, AP1}), degradation(IL6fb),
+    activation(ET1fb, AP1), degradation(ET1fb),
+    activation(tensionfb, times(FA, contractility)), degradation(tensionfb),
+
+    // Extracellular ECM deposition and turnover
+    production(proCI_ecm, proCI), turnover(proCI_ecm),
+    production(proCIII_ecm, proCIII), turnover(proCIII_ecm),
+    production(fibronectin_ecm, fibronectin), turnover(fibronectin_ecm),
+    production(periostin_ecm, periostin), turnover(periostin_ecm),
+    production(TNC_ecm, TNC), turnover(TNC_ecm),
+    production(PAI1_ecm, PAI1), turnover(PAI1_ecm),
+    production(CTGF_ecm, CTGF), turnover(CTGF_ecm),
+    production(EDAFN_ecm, EDAFN), turnover(EDAFN_ecm),
+    production(TIMP1_ecm, TIMP1), turnover(TIMP1_ecm),
+    production(TIMP2_ecm, TIMP2), turnover(TIMP2_ecm),
+    production(proMMP1_ecm, proMMP1), turnover(proMMP1_ecm),
+    production(proMMP2_ecm, proMMP2), turnover(proMMP2_ecm),
+    production(proMMP3_ecm, proMMP3), turnover(proMMP3_ecm),
+    production(proMMP8_ecm, proMMP8), turnover(proMMP8_ecm),
+    production(proMMP9_ecm, proMMP9), turnover(proMMP9_ecm),
+    production(proMMP12_ecm, proMMP12), turnover(proMMP12_ecm),
+    production(proMMP14_ecm, proMMP14), turnover(proMMP14_ecm),
+};
+
+constexpr size_t NUM_TERMS = sizeof(NETWORK) / sizeof(NETWORK[0]);
+
+// Reject malformed tables at compile time: every term must target a
+// non-input species and reference valid species only
+constexpr bool validNetwork() {
+  for (const Term &t : NETWORK) {
+    if (t.target < NUM_INPUTS || t.target >= NUM_SPECIES)
+      return false;
+    if (t.sign != 1 && t.sign != -1)
+      return false;
+    if (t.param < 0 || t.param >= NUM_PARAMS || t.param == K_DIFFUSION)
+      return false;
+    for (int m = 0; m < t.count; m++) {
+      for (int f = 0; f < t.monomials[m].count; f++) {
+        int s = t.monomials[m].factors[f].species;
+        if (s < 0 || s >= NUM_SPECIES)
+          return false;
+      }
+    }
+  }
+  return true;
+}
+static_assert(validNetwork(), "invalid reaction network");
+
+// Expansion of NETWORK into straight-line code. Every index below is a
+// template argument, so each term compiles to a handful of loads, multiplies
+// and one add into the target rate.
+template <typename T> struct Kernel {
+  template <size_t I, size_t M, size_t F>
+  static NETWORK_INLINE T factor(const T *x) {
+    constexpr Factor f = NETWORK[I].monomials[M].factors[F];
+    if constexpr (f.complement)
+      return T(1.0) - x[f.species];
+    else
+      return x[f.species];
+  }
+
+  template <size_t I, size_t M, size_t... F>
+  static NETWORK_INLINE T monomial(const T *x, std::index_sequence<F...>) {
+    (void)x; // unused for the empty product
+    return (T(1.0) * ... * factor<I, M, F>(x));
+  }
+
+  template <size_t I, size_t... M>
+  static NETWORK_INLINE T sum(const T *x, std::index_sequence<M...>) {
+    return (T(0.0) + ... +
+            monomial<I, M>(x, std::make_index_sequence<
+                                  NETWORK[I].monomials[M].count>()));
+  }
+
+  template <size_t I> static NETWORK_INLINE T coefficient(const T *k) {
+    constexpr Term t = NETWORK[I];
+    if constexpr (t.scale == 1.0)
+      return k[t.param];
+    else
+      return k[t.param] * T(t.scale);
+  }
+
+  template <size_t I>
+  static NETWORK_INLINE void term(const T *x, const T *k, T *dxdt) {
+    constexpr Term t = NETWORK[I];
+    T value = coefficient<I>(k) * sum<I>(x, std::make_index_sequence<t.count>());
+    if constexpr (t.sign > 0)
+      dxdt[t.target] = dxdt[t.target] + value;
+    else
+      dxdt[t.target] = dxdt[t.target] - value;
+  }
+
+  template <size_t... I>
+  static NETWORK_INLINE void rates(const T *x, const T *k, T *dxdt,
+                                   std::index_sequence<I...>) {
+    (term<I>(x, k, dxdt), ...);
+  }
+
+  // Only the terms Terms::index[J]
+  template <typename Terms, size_t... J>
+  static NETWORK_INLINE void ratesOf(const T *x, const T *k, T *dxdt,
+                                     std::index_sequence<J...>) {
+    (term<Terms::index[J]>(x, k, dxdt), ...);
+  }
+
+  // d(factor F)/dx times the remaining factors of monomial M
+  template <size_t I, size_t M, size_t F, size_t G>
+  static NETWORK_INLINE T cofactor(const T *x) {
+    if constexpr (G == F)
+      return T(1.0);
+    else
+      return factor<I, M, G>(x);
+  }
+
+  template <size_t I, size_t M, size_t F, size_t... G>
+  static NETWORK_INLINE T partial(const T *x, std::index_sequence<G...>) {
+    T rest = (T(1.0) * ... * cofactor<I, M, F, G>(x));
+    if constexpr (NETWORK[I].monomials[M].factors[F].complement)
+      return T(0.0) - rest;
+    else
+      return rest;
+  }
+
+  template <size_t I, size_t M, typename Emit, size_t... F>
+  static NETWORK_INLINE void jacobianMonomial(const T *x, T coef, Emit &emit,
+                                              std::index_sequence<F...>) {
+    (void)x; // unused for a term without factors
+    (void)coef;
+    using Factors =
+        std::make_index_sequence<NETWORK[I].monomials[M].count>;
+    (emit(NETWORK[I].target, NETWORK[I].monomials[M].factors[F].species,
+          coef * partial<I, M, F>(x, Factors())),
+     ...);
+  }
+
+  template <size_t I, typename Emit, size_t... M>
+  static NETWORK_INLINE void jacobianTerm(const T *x, const T *k, Emit &emit,
+                                          std::index_sequence<M...>) {
+    T coef = coefficient<I>(k);
+    if constexpr (NETWORK[I].sign < 0)
+      coef = T(0.0) - coef;
+    (jacobianMonomial<I, M>(
+         x, coef, emit,
+         std::make_index_sequence<NETWORK[I].monomials[M].count>()),
+     ...);
+  }
+
+  template <typename Emit, size_t... I>
+  static NETWORK_INLINE void jacobian(const T *x, const T *k, Emit &emit,
+                                      std::index_sequence<I...>) {
+    (jacobianTerm<I>(x, k, emit,
+                     std::make_index_sequence<NETWORK[I].count>()),
+     ...);
+  }
+
+  // A term is linear in its rate constant: d(term)/d(k) is the term with
+  // k = 1
+  template <size_t I, typename Emit>
+  static NETWORK_INLINE void paramTerm(const T *x, Emit &emit) {
+    constexpr Term t = NETWORK[I];
+    T value = T(t.scale) * sum<I>(x, std::make_index_sequence<t.count>());
+    if constexpr (t.sign < 0)
+      value = T(0.0) - value;
+    emit(t.target, t.param, value);
+  }
+
+  template <typename Emit, size_t... I>
+  static NETWORK_INLINE void paramPartials(const T *x, Emit &emit,
+                                           std::index_sequence<I...>) {
+    (paramTerm<I>(x, emit), ...);
+  }
+};
+
+// dx/dt of one cell. x and dxdt hold NUM_SPECIES values, k holds NUM_PARAMS.
+// Species without terms (inputs, TRPC) get a zero rate.
+template <typename T>
+inline void networkRates(const T *x, const T *k, T *dxdt) {
+  for (int s = 0; s < NUM_SPECIES; s++)
+    dxdt[s] = T(0.0);
+  Kernel<T>::rates(x, k, dxdt, std::make_index_sequence<NUM_TERMS>());
+}
+
+// Indices of the terms targeting species [First, First + Count), in table
+// order
+template <int First, int Count> struct TargetTerms {
+  static constexpr size_t count() {
+    size_t n = 0;
+    for (const Term &t : NETWORK)
+      n += t.target >= First && t.target < First + Count;
+    return n;
+  }
+
+  static constexpr std::array<size_t, count()> indices() {
+    std::array<size_t, count()> result{};
+    size_t n = 0;
+    for (size_t i = 0; i < NUM_TERMS; i++) {
+      if (NETWORK[i].target >= First && NETWORK[i].target < First + Count)
+        result[n++] = i;
+    }
+    return result;
+  }
+
+  static constexpr std::array<size_t, count()> index = indices();
+};
+
+// dx/dt of species [First, First + Count) only, identical to what
+// networkRates computes for them. The other rates are left untouched.
+template <int First, int Count, typename T>
+inline void networkRatesOf(const T *x, const T *k, T *dxdt) {
+  using Terms = TargetTerms<First, Count>;
+  for (int s = First; s < First + Count; s++)
+    dxdt[s] = T(0.0);
+  Kernel<T>::template ratesOf<Terms>(
+      x, k, dxdt, std::make_index_sequence<Terms::count()>());
+}
+
+// Call emit(row, col, value) for every nonzero partial derivative
+// d(dx_row/dt)/dx_col. A (row, col) pair may be emitted more than once; the
+// Jacobian entry is the sum of its contributions.
+template <typename T, typename Emit>
+inline void networkJacobianEntries(const T *x, const T *k, Emit &&emit) {
+  Kernel<T>::jacobian(x, k, emit, std::make_index_sequence<NUM_TERMS>());
+}
+
+// Call emit(row, param, value) for every term: its contribution to the
+// partial derivative d(dx_row/dt)/dk_param. A (row, param) pair may be
+// emitted more than once; the derivative is the sum of its contributions.
+template <typename T, typename Emit>
+inline void networkParamEntries(const T *x, Emit &&emit) {
+  Kernel<T>::paramPartials(x, emit, std::make_index_sequence<NUM_TERMS>());
+}
+
+// Dense row-major NUM_SPECIES x NUM_SPECIES Jacobian
+template <typename T>
+inline void networkJacobian(const T *x, const T *k, T *jac) {
+  for (int i = 0; i < NUM_SPECIES * NUM_SPECIES; i++)
+    jac[i] = T(0.0);
+  networkJacobianEntries(x, k, [jac](int row, int col, T value) {
+    jac[row * NUM_SPECIES + col] = jac[row * NUM_SPECIES + col] + value;
+  });
+}
+
+} // namespace net
+
+#endif // ECM_NETWORK_H
@@ -0,0 +1,283 @@
+#include "ecm_output.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#if defined(ECM_HAVE_ZLIB)
+#include <zlib.h>
+#endif
+
+#include "ecm.h"
+
+static const char FILE_MAGIC[8] = {'E', 'C', 'M', 'S', 'I', 'M', 'T', 'S'};
+static const char INDEX_MAGIC[8] = {'E', 'C', 'M', 'I', 'N', 'D', 'E', 'X'};
+static const uint32_t FILE_VERSION = 2;
+static const uint32_t CODEC_RAW = 0;
+static const uint32_t CODEC_ZLIB = 1;
+
+// Append the bytes of a value, little-endian like every supported target
+template <typename T>
+static void put(std::vector<unsigned char> &out, const T &value) {
+  const unsigned char *bytes = reinterpret_cast<const unsigned char *>(&value);
+  out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+bool FrameWriter::compressionAvailable() {
+#if defined(ECM_HAVE_ZLIB)
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool FrameWriter::open(const std::string &path, const Options &options) {
+  close();
+  error_.clear();
+  failed_ = false;
+  options_ = options;
+  rows_ = getGridRows();
+  cols_ = getGridCols();
+  members_ = std::max(1, getEnsembleSize());
+  if (rows_ == 0 || cols_ == 0) {
+    error_ = "no grid";
+    return false;
+  }
+  if (options_.species.empty() || options_.time_stride < 1 ||
+      options_.space_stride < 1 || options_.frames_per_chunk < 1 ||
+      options_.queue_chunks < 1) {
+    error_ = "bad output options";
+    return false;
+  }
+  for (int s : options_.species) {
+    if (!getSpeciesName(s)) {
+      error_ = "unknown species " + std::to_string(s);
+      return false;
+    }
+  }
+
+  const int stride = options_.space_stride;
+  out_rows_ = (rows_ + stride - 1) / stride;
+  const int cells = cols_ / members_;
+  out_cols_ = (cells + stride - 1) / stride * members_;
+  frame_values_ =
+      options_.species.size() * (size_t)out_rows_ * (size_t)out_cols_;
+  compressed_ = options_.compress && compressionAvailable();
+
+  file_ = fopen(path.c_str(), "wb");
+  if (!file_) {
+    error_ = path + ": cannot write";
+    return false;
+  }
+
+  std::vector<unsigned char> names;
+  for (int s : options_.species) {
+    const char *name = getSpeciesName(s);
+    names.insert(names.end(), name, name + strlen(name) + 1);
+  }
+  std::vector<unsigned char> header(FILE_MAGIC, FILE_MAGIC + 8);
+  put(header, FILE_VERSION);
+  put(header, compressed_ ? CODEC_ZLIB : CODEC_RAW);
+  put(header, (int32_t)rows_);
+  put(header, (int32_t)cols_);
+  put(header, (int32_t)members_);
+  put(header, (int32_t)stride);
+  put(header, (int32_t)out_rows_);
+  put(header, (int32_t)out_cols_);
+  put(header, (int32_t)options_.species.size());
+  put(header, (int32_t)options_.frames_per_chunk);
+  put(header, (uint32_t)names.size());
+  header.insert(header.end(), names.begin(), names.end());
+  if (fwrite(header.data(), 1, header.size(), file_) != header.size()) {
+    error_ = path + ": cannot write";
+    fclose(file_);
+    file_ = nullptr;
+    return false;
+  }
+
+  offset_ = header.size();
+  index_.clear();
+  frame_steps_.clear();
+  frame_times_.clear();
+  raw_bytes_ = stored_bytes_ = 0.0;
+  frames_ = 0;
+  stall_seconds_ = 0.0;
+  queue_.clear();
+  free_.clear();
+  closing_ = false;
+  current_ = Chunk();
+  current_.values.resize(options_.frames_per_chunk * frame_values_);
+  thread_ = std::thread(&FrameWriter::writer, this);
+  return true;
+}
+
+bool FrameWriter::capture(long long step, double time) {
+  if (!file_ || failed_)
+    return false;
+  if (step % options_.time_stride != 0)
+    return true;
+
+  float *out = current_.values.data() + current_.steps.size() * frame_values_;
+  const int count = (int)options_.species.size();
+  const int stride = options_.space_stride;
+  const int members = members_;
+  if (stride == 1) {
+    snapshotFieldsFloat(options_.species.data(), count, out);
+  } else {
+    for (int s : options_.species) {
+      const ECMScalar *values = getFieldView(s);
+      for (int row = 0; row < rows_; row += stride) {
+        const ECMScalar *line = values + (size_t)row * cols_;
+        // Every kept cell with all of its members
+        for (int col = 0; col < cols_; col += stride * members) {
+          for (int m = 0; m < members; m++)
+            *out++ = (float)line[col + m];
+        }
+      }
+    }
+  }
+  current_.steps.push_back(step);
+  current_.times.push_back(time);
+  frames_++;
+  if ((int)current_.steps.size() == options_.frames_per_chunk)
+    submit();
+  return !failed_;
+}
+
+// Hand the current chunk to the writer and start a new one, waiting while
+// the queue is full
+void FrameWriter::submit() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (queue_.size() >= (size_t)options_.queue_chunks) {
+    const auto start = std::chrono::steady_clock::now();
+    space_.wait(lock, [&] {
+      return queue_.size() < (size_t)options_.queue_chunks;
+    });
+    stall_seconds_ += std::chrono::duration<double>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+  }
+  queue_.push_back(std::move(current_));
+  ready_.notify_one();
+
+  if (free_.empty()) {
+    current_ = Chunk();
+  } else {
+    current_ = std::move(free_.back());
+    free_.pop_back();
+  }
+  current_.values.resize(options_.frames_per_chunk * frame_values_);
+  current_.steps.clear();
+  current_.times.clear();
+}
+
+void FrameWriter::writer() {
+  std::vector<unsigned char> packed;
+  for (;;) {
+    Chunk chunk;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      ready_.wait(lock, [&] { return !queue_.empty() || closing_; });
+      if (queue_.empty())
+        return;
+      chunk = std::move(queue_.front());
+      queue_.pop_front();
+      space_.notify_one();
+    }
+    // After a failure the queue is still drained so capture() never waits
+    if (!failed_ && !writeChunk(chunk, packed))
+      fail("cannot write a chunk");
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push_back(std::move(chunk));
+  }
+}
+
+// Write one chunk and add it to the index. Runs on the writer thread.
+bool FrameWriter::writeChunk(Chunk &chunk, std::vector<unsigned char> &packed) {
+  const size_t frames = chunk.steps.size();
+  const size_t count = frames * frame_values_;
+  const size_t raw = count * sizeof(float);
+  const unsigned char *data =
+      reinterpret_cast<const unsigned char *>(chunk.values.data());
+  size_t stored = raw;
+
+#if defined(ECM_HAVE_ZLIB)
+  if (compressed_) {
+    // Byte planes: the exponent bytes of neighboring values, which agree
+    // more often than not, end up next to each other
+    packed.resize(raw);
+    for (size_t i = 0; i < count; i++) {
+      for (size_t b = 0; b < sizeof(float); b++)
+        packed[b * count + i] = data[i * sizeof(float) + b];
+    }
+    uLongf size = compressBound((uLong)raw);
+    std::vector<unsigned char> deflated(size);
+    if (compress2(deflated.data(), &size, packed.data(), (uLong)raw, 1) !=
+        Z_OK)
+      return false;
+    packed.swap(deflated);
+    data = packed.data();
+    stored = size;
+  }
+#else
+  (void)packed;
+#endif
+
+  if (fwrite(data, 1, stored, file_) != stored)
+    return false;
+  IndexEntry entry = {offset_, stored, raw, (uint32_t)frame_steps_.size(),
+                      (uint32_t)frames};
+  index_.push_back(entry);
+  frame_steps_.insert(frame_steps_.end(), chunk.steps.begin(),
+                      chunk.steps.end());
+  frame_times_.insert(frame_times_.end(), chunk.times.begin(),
+                      chunk.times.end());
+  offset_ += stored;
+  raw_bytes_ += raw;
+  stored_bytes_ += stored;
+  return true;
+}
+
+void FrameWriter::fail(const std::string &message) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!failed_)
+    error_ = message;
+  failed_ = true;
+}
+
+bool FrameWriter::close() {
+  if (!file_)
+    return !failed_;
+  if (!current_.steps.empty())
+    submit();
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closing_ = true;
+  }
+  ready_.notify_one();
+  thread_.join();
+
+  std::vector<unsigned char> index;
+  for (const IndexEntry &entry : index_) {
+    put(index, entry.offset);
+    put(index, entry.stored);
+    put(index, entry.raw);
+    put(index, entry.first_frame);
+    put(index, entry.frames);
+  }
+  for (size_t f = 0; f < frame_steps_.size(); f++) {
+    put(index, (int64_t)frame_steps_[f]);
+    put(index, frame_times_[f]);
+  }
+  put(index, offset_);
+  put(index, (uint32_t)index_.size());
+  put(index, (uint32_t)frame_steps_.size());
+  index.insert(index.end(), INDEX_MAGIC, INDEX_MAGIC + 8);
+
+  if (!failed_ && fwrite(index.data(), 1, index.size(), file_) != index.size())
+    fail("cannot write the index");
+  if (fclose(file_) != 0)
+    fail("cannot close the file");
+  file_ = nullptr;
+  return !failed_;
+}
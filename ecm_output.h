@@ -0,0 +1,125 @@
+// Streaming time-series output for native batch runs.
+//
+// A FrameWriter records every time_stride-th step of selected species,
+// subsampled to every space_stride-th row and column of cells, as float32
+// frames in
+// a chunked binary file. capture() copies a frame out of the engine into a
+// chunk buffer and returns; full chunks go through a bounded queue to a
+// writer thread that compresses and writes them, so the stepping threads
+// never wait on the disk unless the queue is full (counted in
+// stallSeconds()).
+//
+// File layout, little-endian:
+//   header   "ECMSIMTS", u32 version, u32 codec (0 raw, 1 zlib with the
+//            bytes of each value shuffled into planes), i32 rows, i32 cols
+//            (grid values per row, members * cells), i32 members,
+//            i32 space_stride, i32 out_rows, i32 out_cols (values per
+//            frame row, members * kept cells), i32 num_species,
+//            i32 frames_per_chunk, u32 names_bytes, then the species
+//            names, each NUL-terminated. On an ensemble grid the members
+//            of each kept cell stay side by side, member m of kept cell c
+//            at column c * members + m.
+//   chunks   frames x species x out_rows x out_cols floats each, possibly
+//            compressed
+//   index    per chunk: u64 offset, u64 stored bytes, u64 raw bytes,
+//            u32 first frame, u32 frames; then per frame: i64 step,
+//            f64 time
+//   footer   u64 index offset, u32 chunks, u32 frames, "ECMINDEX"
+// A reader seeks to the 24-byte footer, reads the index and can then load
+// any chunk independently.
+#ifndef ECM_OUTPUT_H
+#define ECM_OUTPUT_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class FrameWriter {
+public:
+  struct Options {
+    std::vector<int> species; // Species indices to record
+    int time_stride = 1;      // Record steps that are multiples of this
+    int space_stride = 1;     // Keep every space_stride-th row and column
+                              // of cells
+    int frames_per_chunk = 16;
+    int queue_chunks = 4; // Full chunks waiting for the writer at most
+    bool compress = true; // zlib, if the build has it
+  };
+
+  FrameWriter() = default;
+  FrameWriter(const FrameWriter &) = delete;
+  FrameWriter &operator=(const FrameWriter &) = delete;
+  ~FrameWriter() { close(); }
+
+  // Create path for the current grid. False with the reason in error().
+  bool open(const std::string &path, const Options &options);
+
+  // Record the current state as step if step is a multiple of the time
+  // stride. False once writing has failed.
+  bool capture(long long step, double time);
+
+  // Write the pending frames and the index and close the file. False if
+  // anything failed to write.
+  bool close();
+
+  const std::string &error() const { return error_; }
+  long long frames() const { return frames_; }
+  double rawBytes() const { return raw_bytes_; }
+  double storedBytes() const { return stored_bytes_; }
+  double stallSeconds() const { return stall_seconds_; }
+
+  static bool compressionAvailable();
+
+private:
+  struct Chunk {
+    std::vector<float> values;
+    std::vector<long long> steps;
+    std::vector<double> times;
+  };
+  struct IndexEntry {
+    uint64_t offset, stored, raw;
+    uint32_t first_frame, frames;
+  };
+
+  void submit();
+  void writer();
+  bool writeChunk(Chunk &chunk, std::vector<unsigned char> &packed);
+  void fail(const std::string &message);
+
+  Options options_;
+  FILE *file_ = nullptr;
+  std::string error_;
+  int rows_ = 0, cols_ = 0, out_rows_ = 0, out_cols_ = 0;
+  int members_ = 1; // Ensemble members side by side in every cell
+  size_t frame_values_ = 0;
+  bool compressed_ = false;
+
+  Chunk current_;                 // Filled by capture()
+  std::deque<Chunk> queue_;       // Full chunks for the writer
+  std::vector<Chunk> free_;       // Written chunks to reuse
+  std::mutex mutex_;
+  std::condition_variable ready_; // Queue not empty, or closing
+  std::condition_variable space_; // Queue has room
+  std::thread thread_;
+  bool closing_ = false;
+  std::atomic<bool> failed_{false};
+
+  // Owned by the writer thread until it is joined
+  std::vector<IndexEntry> index_;
+  std::vector<long long> frame_steps_;
+  std::vector<double> frame_times_;
+  uint64_t offset_ = 0;
+  double raw_bytes_ = 0.0;
+  double stored_bytes_ = 0.0;
+
+  long long frames_ = 0;
+  double stall_seconds_ = 0.0;
+};
+
+#endif // ECM_OUTPUT_H
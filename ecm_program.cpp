@@ -0,0 +1,605 @@
+#include "ecm_program.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+
+#include "ecm_network.h"
+
+namespace {
+
+// Cells evaluated per instruction by the interpreter
+const int PROGRAM_BLOCK = 256;
+
+struct ParsedFactor {
+  int species;
+  bool complement;
+};
+
+// Empty factor list = the unit monomial "1"
+typedef std::vector<ParsedFactor> ParsedMonomial;
+
+struct ParsedTerm {
+  int target;
+  int sign;
+  int param;
+  double scale;
+  std::vector<ParsedMonomial> monomials;
+};
+
+bool parseNumber(const std::string &text, double &value) {
+  if (text.empty())
+    return false;
+  char *end = nullptr;
+  value = strtod(text.c_str(), &end);
+  return *end == '\0' && std::isfinite(value);
+}
+
+bool validName(const std::string &name) {
+  if (name.empty() || !(isalpha((unsigned char)name[0]) || name[0] == '_'))
+    return false;
+  for (char ch : name) {
+    if (!(isalnum((unsigned char)ch) || ch == '_'))
+      return false;
+  }
+  return true;
+}
+
+std::vector<std::string> split(const std::string &text, char separator) {
+  std::vector<std::string> parts;
+  size_t start = 0;
+  for (;;) {
+    size_t end = text.find(separator, start);
+    parts.push_back(text.substr(start, end - start));
+    if (end == std::string::npos)
+      return parts;
+    start = end + 1;
+  }
+}
+
+class SpecParser {
+public:
+  explicit SpecParser(NetworkProgram &program) : program_(program) {}
+
+  bool parseLine(const std::string &raw) {
+    std::string line = raw.substr(0, raw.find('#'));
+    std::istringstream in(line);
+    std::string keyword;
+    if (!(in >> keyword))
+      return true;
+
+    if (keyword == "param")
+      return parseParam(in);
+    if (keyword == "species")
+      return parseSpecies(in);
+
+    ParsedTerm term;
+    std::string target;
+    if (!(in >> target))
+      return fail("missing target species");
+    if (!lookupTarget(target, term.target))
+      return false;
+
+    std::string rest;
+    std::getline(in, rest);
+    term.sign = +1;
+    term.scale = 1.0;
+
+    if (keyword == "term") {
+      std::istringstream args(rest);
+      std::string sign, coef;
+      if (!(args >> sign >> coef))
+        return fail("expected: term TARGET +|- PARAM[*SCALE] SUM");
+      if (sign != "+" && sign != "-")
+        return fail("sign must be + or -, got '" + sign + "'");
+      term.sign = sign == "+" ? +1 : -1;
+      if (!parseCoefficient(coef, term))
+        return false;
+      std::getline(args, rest);
+      if (!parseSum(rest, term.monomials))
+        return false;
+    } else if (keyword == "input" || keyword == "feedback" ||
+               keyword == "receptor" || keyword == "activation" ||
+               keyword == "production") {
+      term.param = keyword == "input"      ? net::K_INPUT
+                   : keyword == "feedback" ? net::K_FEEDBACK
+                   : keyword == "receptor" ? net::K_RECEPTOR
+                   : keyword == "activation" ? net::K_ACTIVATION
+                                             : net::K_PRODUCTION;
+      if (!parseSum(rest, term.monomials))
+        return false;
+    } else if (keyword == "inhibition") {
+      std::istringstream args(rest);
+      std::string by, extra;
+      if (!(args >> by) || (args >> extra))
+        return fail("expected: inhibition TARGET SPECIES");
+      int species;
+      if (!lookupSpecies(by, species))
+        return false;
+      term.sign = -1;
+      term.param = net::K_INHIBITION;
+      term.monomials.push_back({{term.target, false}, {species, false}});
+    } else if (keyword == "basal" || keyword == "degradation" ||
+               keyword == "turnover") {
+      if (rest.find_first_not_of(" \t\r") != std::string::npos)
+        return fail("unexpected arguments after '" + keyword + " " + target +
+                    "'");
+      if (keyword == "basal") {
+        term.param = net::K_ACTIVATION;
+        term.monomials.push_back(ParsedMonomial());
+      } else {
+        term.sign = -1;
+        term.param = net::K_DEGRADATION;
+        term.scale = keyword == "turnover" ? 0.01 : 1.0;
+        term.monomials.push_back({{term.target, false}});
+      }
+    } else {
+      return fail("unknown keyword '" + keyword + "'");
+    }
+
+    terms.push_back(term);
+    return true;
+  }
+
+  std::vector<ParsedTerm> terms;
+
+private:
+  bool fail(const std::string &message) {
+    program_.error = message;
+    return false;
+  }
+
+  bool parseParam(std::istringstream &in) {
+    std::string name, value_text, extra;
+    double value;
+    if (!(in >> name >> value_text) || (in >> extra))
+      return fail("expected: param NAME VALUE");
+    if (!validName(name))
+      return fail("invalid parameter name '" + name + "'");
+    if (!parseNumber(value_text, value))
+      return fail("invalid value '" + value_text + "'");
+
+    int index = networkParamIndex(program_, name);
+    if (index >= 0) {
+      program_.param_defaults[index] = value;
+      return true;
+    }
+    program_.param_names.push_back(name);
+    program_.param_defaults.push_back(value);
+    return true;
+  }
+
+  bool parseSpecies(std::istringstream &in) {
+    std::string name, value_text, extra;
+    double initial = 0.0;
+    if (!(in >> name))
+      return fail("expected: species NAME [INITIAL]");
+    if (!validName(name))
+      return fail("invalid species name '" + name + "'");
+    if (networkSpeciesIndex(program_, name) >= 0)
+      return fail("species '" + name + "' already exists");
+    if (in >> value_text) {
+      if (!parseNumber(value_text, initial) || initial < 0.0 || initial > 1.0)
+        return fail("initial value must be in [0, 1]");
+      if (in >> extra)
+        return fail("expected: species NAME [INITIAL]");
+    }
+    program_.extra_species.push_back(name);
+    program_.extra_initial.push_back(initial);
+    return true;
+  }
+
+  bool lookupSpecies(const std::string &name, int &species) {
+    species = networkSpeciesIndex(program_, name);
+    if (species < 0)
+      return fail("unknown species '" + name + "'");
+    return true;
+  }
+
+  bool lookupTarget(const std::string &name, int &species) {
+    if (!lookupSpecies(name, species))
+      return false;
+    if (species >= sp::FIRST_INPUT &&
+        species < sp::FIRST_INPUT + sp::NUM_INPUTS)
+      return fail("input '" + name + "' cannot be a rate target");
+    return true;
+  }
+
+  // PARAM or PARAM*SCALE
+  bool parseCoefficient(const std::string &text, ParsedTerm &term) {
+    size_t star = text.find('*');
+    std::string name = text.substr(0, star);
+    term.param = networkParamIndex(program_, name);
+    if (term.param < 0)
+      return fail("unknown parameter '" + name + "'");
+    if (star != std::string::npos &&
+        !parseNumber(text.substr(star + 1), term.scale))
+      return fail("invalid scale in '" + text + "'");
+    return true;
+  }
+
+  // Monomials separated by '+', factors by '*'; "1-X" is a complement and
+  // "1" the unit monomial. Whitespace is ignored.
+  bool parseSum(const std::string &text, std::vector<ParsedMonomial> &sum) {
+    std::string compact;
+    for (char ch : text) {
+      if (!isspace((unsigned char)ch))
+        compact += ch;
+    }
+    if (compact.empty())
+      return fail("missing rate expression");
+
+    for (const std::string &monomial_text : split(compact, '+')) {
+      ParsedMonomial monomial;
+      if (monomial_text != "1") {
+        for (const std::string &factor_text : split(monomial_text, '*')) {
+          ParsedFactor factor;
+          factor.complement = factor_text.compare(0, 2, "1-") == 0;
+          std::string name =
+              factor.complement ? factor_text.substr(2) : factor_text;
+          if (name.empty())
+            return fail("empty factor in '" + monomial_text + "'");
+          if (!lookupSpecies(name, factor.species))
+            return false;
+          monomial.push_back(factor);
+        }
+      }
+      sum.push_back(monomial);
+    }
+    return true;
+  }
+
+  NetworkProgram &program_;
+};
+
+NetworkInstruction instruction(NetworkOp op, int reg = 0, int dst = 0,
+                               int src = 0, int coef = -1) {
+  NetworkInstruction in;
+  in.op = op;
+  in.reg = (uint8_t)reg;
+  in.dst = dst;
+  in.src = src;
+  in.coef = coef;
+  return in;
+}
+
+// Load a monomial into register reg
+void emitMonomial(std::vector<NetworkInstruction> &code,
+                  const ParsedMonomial &monomial, int reg) {
+  if (monomial.empty()) {
+    code.push_back(instruction(NetworkOp::ONE, reg));
+    return;
+  }
+  for (size_t f = 0; f < monomial.size(); f++) {
+    const ParsedFactor &factor = monomial[f];
+    NetworkOp op = f == 0 ? (factor.complement ? NetworkOp::LOAD_C
+                                               : NetworkOp::LOAD)
+                          : (factor.complement ? NetworkOp::MUL_C
+                                               : NetworkOp::MUL);
+    code.push_back(instruction(op, reg, 0, factor.species));
+  }
+}
+
+// Jacobian partials of one term: every factor of every monomial
+void emitPartials(NetworkProgram &program, const ParsedTerm &term, int coef) {
+  for (const ParsedMonomial &monomial : term.monomials) {
+    for (size_t f = 0; f < monomial.size(); f++) {
+      NetworkPartial partial;
+      partial.row = term.target;
+      partial.col = monomial[f].species;
+      partial.coef = coef;
+      partial.first = (int)program.partial_factors.size();
+      partial.count = (int)monomial.size() - 1;
+      partial.sign = monomial[f].complement ? -1.0 : 1.0;
+      for (size_t g = 0; g < monomial.size(); g++) {
+        if (g != f)
+          program.partial_factors.push_back(
+              {monomial[g].species, monomial[g].complement});
+      }
+      program.partials.push_back(partial);
+    }
+  }
+}
+
+// Instructions for one term. The evaluation order matches the compiled
+// kernel (coef * (m0 + m1 + ...), each monomial multiplied left to right),
+// so both paths produce identical results.
+void emitTerm(NetworkProgram &program, const ParsedTerm &term) {
+  NetworkCoefficient coefficient;
+  coefficient.param = term.param;
+  coefficient.sign = term.sign;
+  coefficient.scale = term.scale;
+  int coef = (int)program.coefs.size();
+  program.coefs.push_back(coefficient);
+  emitPartials(program, term, coef);
+
+  std::vector<NetworkInstruction> &code = program.code;
+  if (term.monomials.size() == 1 && term.monomials[0].size() <= 1) {
+    const ParsedMonomial &monomial = term.monomials[0];
+    if (monomial.empty()) {
+      code.push_back(instruction(NetworkOp::CONST, 0, term.target, 0, coef));
+    } else {
+      NetworkOp op = monomial[0].complement ? NetworkOp::AXPY_C
+                                            : NetworkOp::AXPY;
+      code.push_back(
+          instruction(op, 0, term.target, monomial[0].species, coef));
+    }
+    return;
+  }
+
+  emitMonomial(code, term.monomials[0], 0);
+  for (size_t m = 1; m < term.monomials.size(); m++) {
+    emitMonomial(code, term.monomials[m], 1);
+    code.push_back(instruction(NetworkOp::ADD));
+  }
+  code.push_back(instruction(NetworkOp::ACC, 0, term.target, 0, coef));
+}
+
+void resetProgram(NetworkProgram &program) {
+  program.code.clear();
+  program.coefs.clear();
+  program.partials.clear();
+  program.partial_factors.clear();
+  program.param_names.assign(net::PARAM_NAMES,
+                             net::PARAM_NAMES + net::NUM_PARAMS);
+  // Built-in parameters keep their current values unless the spec sets them
+  program.param_defaults.assign(net::NUM_PARAMS, NAN);
+  program.extra_species.clear();
+  program.extra_initial.clear();
+  program.error.clear();
+}
+
+std::string formatScale(double scale) {
+  char text[32];
+  snprintf(text, sizeof(text), "%.17g", scale);
+  return text;
+}
+
+std::string formatSum(const net::Term &t) {
+  std::string text;
+  for (int m = 0; m < t.count; m++) {
+    const net::Monomial &monomial = t.monomials[m];
+    if (m > 0)
+      text += " + ";
+    if (monomial.count == 0)
+      text += "1";
+    for (int f = 0; f < monomial.count; f++) {
+      if (f > 0)
+        text += "*";
+      if (monomial.factors[f].complement)
+        text += "1-";
+      text += SPECIES_NAMES[monomial.factors[f].species];
+    }
+  }
+  return text;
+}
+
+bool isSelf(const net::Term &t) {
+  return t.count == 1 && t.monomials[0].count == 1 &&
+         t.monomials[0].factors[0].species == t.target &&
+         !t.monomials[0].factors[0].complement;
+}
+
+// Shortest spec line that reproduces the term
+std::string formatTerm(const net::Term &t) {
+  const std::string target = SPECIES_NAMES[t.target];
+
+  if (t.sign > 0 && t.scale == 1.0) {
+    if (t.param == net::K_ACTIVATION && t.count == 1 &&
+        t.monomials[0].count == 0)
+      return "basal " + target;
+    switch (t.param) {
+    case net::K_INPUT:
+      return "input " + target + " " + formatSum(t);
+    case net::K_FEEDBACK:
+      return "feedback " + target + " " + formatSum(t);
+    case net::K_RECEPTOR:
+      return "receptor " + target + " " + formatSum(t);
+    case net::K_ACTIVATION:
+      return "activation " + target + " " + formatSum(t);
+    case net::K_PRODUCTION:
+      return "production " + target + " " + formatSum(t);
+    default:
+      break;
+    }
+  }
+  if (t.sign < 0 && t.param == net::K_DEGRADATION && isSelf(t)) {
+    if (t.scale == 1.0)
+      return "degradation " + target;
+    if (t.scale == 0.01)
+      return "turnover " + target;
+  }
+  if (t.sign < 0 && t.param == net::K_INHIBITION && t.scale == 1.0 &&
+      t.count == 1 && t.monomials[0].count == 2 &&
+      t.monomials[0].factors[0].species == t.target &&
+      !t.monomials[0].factors[0].complement &&
+      !t.monomials[0].factors[1].complement)
+    return "inhibition " + target + " " +
+           SPECIES_NAMES[t.monomials[0].factors[1].species];
+
+  std::string coef = net::PARAM_NAMES[t.param];
+  if (t.scale != 1.0)
+    coef += "*" + formatScale(t.scale);
+  return "term " + target + (t.sign > 0 ? " + " : " - ") + coef + " " +
+         formatSum(t);
+}
+
+} // namespace
+
+int networkSpeciesCount(const NetworkProgram &program) {
+  return sp::NUM_SPECIES + (int)program.extra_species.size();
+}
+
+int networkSpeciesIndex(const NetworkProgram &program,
+                        const std::string &name) {
+  int index = speciesIndex(name.c_str());
+  if (index >= 0)
+    return index;
+  for (size_t i = 0; i < program.extra_species.size(); i++) {
+    if (program.extra_species[i] == name)
+      return sp::NUM_SPECIES + (int)i;
+  }
+  return -1;
+}
+
+int networkParamIndex(const NetworkProgram &program, const std::string &name) {
+  for (size_t i = 0; i < program.param_names.size(); i++) {
+    if (program.param_names[i] == name)
+      return (int)i;
+  }
+  return -1;
+}
+
+int compileNetwork(const char *spec, NetworkProgram &program) {
+  resetProgram(program);
+  SpecParser parser(program);
+
+  std::istringstream in(spec ? spec : "");
+  std::string line;
+  int line_number = 0;
+  while (std::getline(in, line)) {
+    line_number++;
+    if (!parser.parseLine(line)) {
+      program.error = "line " + std::to_string(line_number) + ": " +
+                      program.error;
+      std::string error = program.error;
+      resetProgram(program);
+      program.error = error;
+      return line_number;
+    }
+  }
+
+  // Every rate starts at zero; species without terms (inputs) stay there
+  for (int s = 0; s < networkSpeciesCount(program); s++)
+    program.code.push_back(instruction(NetworkOp::ZERO, 0, s));
+  for (const ParsedTerm &term : parser.terms)
+    emitTerm(program, term);
+  return 0;
+}
+
+void resolveCoefficients(const NetworkProgram &program, const double *params,
+                         double *coefs) {
+  for (size_t i = 0; i < program.coefs.size(); i++) {
+    const NetworkCoefficient &c = program.coefs[i];
+    double k = params[c.param];
+    if (c.scale != 1.0)
+      k = k * c.scale;
+    coefs[i] = c.sign * k;
+  }
+}
+
+std::vector<NetworkInstruction> targetCode(const NetworkProgram &program,
+                                           int first, int count) {
+  // A term is a run of register instructions closed by the one instruction
+  // that writes its target
+  std::vector<NetworkInstruction> code;
+  size_t term_begin = 0;
+  for (size_t i = 0; i < program.code.size(); i++) {
+    const NetworkInstruction &in = program.code[i];
+    switch (in.op) {
+    case NetworkOp::ZERO:
+    case NetworkOp::CONST:
+    case NetworkOp::AXPY:
+    case NetworkOp::AXPY_C:
+    case NetworkOp::ACC:
+      if (in.dst >= first && in.dst < first + count)
+        code.insert(code.end(), program.code.begin() + term_begin,
+                    program.code.begin() + i + 1);
+      term_begin = i + 1;
+      break;
+    default:
+      break;
+    }
+  }
+  return code;
+}
+
+void networkProgramJacobian(const NetworkProgram &program, const double *coefs,
+                            const double *x, const int *slots,
+                            double *values) {
+  for (size_t i = 0; i < program.partials.size(); i++) {
+    const NetworkPartial &partial = program.partials[i];
+    double value = coefs[partial.coef] * partial.sign;
+    for (int f = partial.first; f < partial.first + partial.count; f++) {
+      const NetworkFactor &factor = program.partial_factors[f];
+      value *= factor.complement ? 1.0 - x[factor.species] : x[factor.species];
+    }
+    values[slots[i]] += value;
+  }
+}
+
+template <typename T, typename In>
+void runNetworkProgram(const NetworkProgram &program, const double *coefs,
+                       const In *const *fields, T *rates, size_t stride,
+                       int begin, int end) {
+  T registers[2][PROGRAM_BLOCK];
+  const T one = 1.0;
+
+  for (int block = begin; block < end; block += PROGRAM_BLOCK) {
+    const int n = std::min(PROGRAM_BLOCK, end - block);
+
+    for (const NetworkInstruction &in : program.code) {
+      const In *x = fields[in.src] + block;
+      T *r = rates + in.dst * stride + (block - begin);
+      T *reg = registers[in.reg];
+      T *sum = registers[0];
+      const T *monomial = registers[1];
+      const T coef = in.coef >= 0 ? coefs[in.coef] : 0.0;
+
+      switch (in.op) {
+      case NetworkOp::ZERO:
+        for (int i = 0; i < n; i++) r[i] = 0.0;
+        break;
+      case NetworkOp::CONST:
+        for (int i = 0; i < n; i++) r[i] = r[i] + coef;
+        break;
+      case NetworkOp::AXPY:
+        for (int i = 0; i < n; i++) r[i] = r[i] + coef * (T)x[i];
+        break;
+      case NetworkOp::AXPY_C:
+        for (int i = 0; i < n; i++) r[i] = r[i] + coef * (one - x[i]);
+        break;
+      case NetworkOp::ONE:
+        for (int i = 0; i < n; i++) reg[i] = one;
+        break;
+      case NetworkOp::LOAD:
+        for (int i = 0; i < n; i++) reg[i] = x[i];
+        break;
+      case NetworkOp::LOAD_C:
+        for (int i = 0; i < n; i++) reg[i] = one - x[i];
+        break;
+      case NetworkOp::MUL:
+        for (int i = 0; i < n; i++) reg[i] = reg[i] * (T)x[i];
+        break;
+      case NetworkOp::MUL_C:
+        for (int i = 0; i < n; i++) reg[i] = reg[i] * (one - x[i]);
+        break;
+      case NetworkOp::ADD:
+        for (int i = 0; i < n; i++) sum[i] = sum[i] + monomial[i];
+        break;
+      case NetworkOp::ACC:
+        for (int i = 0; i < n; i++) r[i] = r[i] + coef * sum[i];
+        break;
+      }
+    }
+  }
+}
+
+template void runNetworkProgram(const NetworkProgram &, const double *,
+                                const double *const *, double *, size_t, int,
+                                int);
+template void runNetworkProgram(const NetworkProgram &, const double *,
+                                const float *const *, double *, size_t, int,
+                                int);
+template void runNetworkProgram(const NetworkProgram &, const double *,
+                                const float *const *, float *, size_t, int,
+                                int);
+
+std::string builtinNetworkSpec() {
+  std::string spec = "# Built-in cardiac fibroblast network\n";
+  for (const net::Term &t : net::NETWORK)
+    spec += formatTerm(t) + "\n";
+  return spec;
+}
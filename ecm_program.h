@@ -0,0 +1,144 @@
+// Reaction networks loaded at runtime.
+//
+// A network spec is a plain-text reaction list using the same term
+// vocabulary as NETWORK in ecm_network.h, one term per line:
+//
+//   # comment
+//   param k_custom 0.3            # declare (or override) a parameter
+//   species Foo 0.5               # extra intracellular species, initial 0.5
+//   activation NOX AT1R + TGFB1R  # + k_activation * (AT1R + TGFB1R)
+//   activation PKC DAG*mTORC2 + syndecan4
+//   inhibition AC AT1R            # - k_inhibition * AC * AT1R
+//   degradation AC                # - k_degradation * AC
+//   basal mTORC2                  # + k_activation
+//   input / feedback / receptor / production TARGET SOURCE
+//   turnover proCI_ecm            # - k_degradation * 0.01 * proCI_ecm
+//   term AGT + k_custom*2 1-AT1R*1-JNK*p38 + 1
+//
+// Sums join monomials with "+", monomials join factors with "*", "1-X" is
+// the complement of X and "1" the unit monomial. Inputs cannot be targets.
+//
+// The spec is compiled once into a flat, index-based instruction stream.
+// runNetworkProgram() interprets it one instruction at a time over a block
+// of cells, so dispatch cost is amortized over the block and every
+// instruction is a unit-stride loop over species fields.
+#ifndef ECM_PROGRAM_H
+#define ECM_PROGRAM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+enum class NetworkOp : uint8_t {
+  ZERO,    // rate[dst] = 0
+  CONST,   // rate[dst] += coef
+  AXPY,    // rate[dst] += coef * x[src]
+  AXPY_C,  // rate[dst] += coef * (1 - x[src])
+  ONE,     // reg = 1
+  LOAD,    // reg = x[src]
+  LOAD_C,  // reg = 1 - x[src]
+  MUL,     // reg *= x[src]
+  MUL_C,   // reg *= 1 - x[src]
+  ADD,     // sum += monomial
+  ACC      // rate[dst] += coef * sum
+};
+
+struct NetworkInstruction {
+  NetworkOp op;
+  uint8_t reg;     // Register written by ONE/LOAD/MUL: 0 = sum, 1 = monomial
+  int32_t dst;     // Target species
+  int32_t src;     // Source species
+  int32_t coef;    // Index into NetworkProgram::coefs, -1 if unused
+};
+
+// One contribution to the Jacobian: d(rate[row])/d(x[col]) gets
+// coefs[coef] * sign * the product of the other factors of a monomial,
+// partial_factors[first, first + count). sign is -1 when x[col] enters the
+// monomial as a complement 1 - x[col].
+struct NetworkPartial {
+  int32_t row;
+  int32_t col;
+  int32_t coef;
+  int32_t first;
+  int32_t count;
+  double sign;
+};
+
+struct NetworkFactor {
+  int32_t species;
+  bool complement;
+};
+
+// Coefficient sign * scale * params[param], resolved before each run so
+// parameter changes take effect without recompiling
+struct NetworkCoefficient {
+  int param;
+  double sign;
+  double scale;
+};
+
+struct NetworkProgram {
+  std::vector<NetworkInstruction> code;
+  std::vector<NetworkCoefficient> coefs;
+
+  // Analytic Jacobian, one partial per factor of every monomial
+  std::vector<NetworkPartial> partials;
+  std::vector<NetworkFactor> partial_factors;
+
+  // Parameters: the built-in rate constants (net::PARAM_NAMES) followed by
+  // the parameters declared in the spec
+  std::vector<std::string> param_names;
+  std::vector<double> param_defaults;
+
+  // Species declared in the spec, appended after sp::NUM_SPECIES
+  std::vector<std::string> extra_species;
+  std::vector<double> extra_initial;
+
+  std::string error; // Message for the last failed compile
+};
+
+// Parse and compile a network spec. Returns 0 on success, otherwise the
+// 1-based line number of the first error (program.error describes it).
+int compileNetwork(const char *spec, NetworkProgram &program);
+
+// Total species in the program's state vector
+int networkSpeciesCount(const NetworkProgram &program);
+
+// Index of a built-in or declared species, -1 if unknown
+int networkSpeciesIndex(const NetworkProgram &program, const std::string &name);
+
+// Index of a parameter, -1 if unknown
+int networkParamIndex(const NetworkProgram &program, const std::string &name);
+
+// Evaluate rates for cells [begin, end). Species s of cell c is read from
+// fields[s][c] and its rate written to rates[s * stride + c - begin].
+// coefs must hold program.coefs.size() values from resolveCoefficients().
+// Rates are computed in T (double or float) from fields stored as In
+// (double or float, at most as wide as T).
+template <typename T, typename In>
+void runNetworkProgram(const NetworkProgram &program, const double *coefs,
+                       const In *const *fields, T *rates, size_t stride,
+                       int begin, int end);
+
+void resolveCoefficients(const NetworkProgram &program, const double *params,
+                         double *coefs);
+
+// The instructions of program that compute the rates of species
+// [first, first + count), in program order. Run in place of program.code
+// they produce those rates exactly as the full program does and leave the
+// others untouched.
+std::vector<NetworkInstruction> targetCode(const NetworkProgram &program,
+                                           int first, int count);
+
+// Jacobian of one cell with species values x: partial i is added to
+// values[slots[i]], so partials sharing an entry accumulate. values must be
+// zeroed by the caller.
+void networkProgramJacobian(const NetworkProgram &program, const double *coefs,
+                            const double *x, const int *slots,
+                            double *values);
+
+// The built-in NETWORK written out as a spec, as a starting point for edits
+std::string builtinNetworkSpec();
+
+#endif // ECM_PROGRAM_H
@@ -0,0 +1,197 @@
+// SIMD lane types for evaluating the network over several cells at once.
+//
+// Lanes holds one double per cell for LANES consecutive cells and supports
+// the arithmetic the generated kernels in ecm_network.h need (+, -, * and
+// construction from a scalar), so net::networkRates<Lanes> evaluates LANES
+// cells per instruction. Each lane goes through exactly the same IEEE
+// operations as the scalar kernel, so results are bit-identical.
+// FloatLanes is the same for float, with twice the lanes per register;
+// LanesOf<T> picks the lane type of a scalar type. min(a, b) is b < a ? b : a
+// and max(a, b) is a < b ? b : a, per lane, as for the scalar comparisons
+// they replace (a NaN in b yields a).
+//
+// The widest instruction set enabled at compile time is used:
+//   -mavx512f  8 lanes, 16 float (AVX-512)
+//   -mavx2     4 lanes,  8 float (AVX/AVX2)
+//   -msimd128  2 lanes,  4 float (WebAssembly SIMD)
+//   otherwise  1 lane           (plain double or float)
+#ifndef ECM_SIMD_H
+#define ECM_SIMD_H
+
+#if defined(__AVX512F__)
+#include <immintrin.h>
+#define ECM_SIMD_AVX512 1
+#elif defined(__AVX__)
+#include <immintrin.h>
+#define ECM_SIMD_AVX 1
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#define ECM_SIMD_WASM 1
+#endif
+
+namespace simd {
+
+#if defined(ECM_SIMD_AVX512)
+
+constexpr int LANES = 8;
+constexpr const char *NAME = "avx512";
+
+struct Lanes {
+  __m512d v;
+  Lanes() = default;
+  explicit Lanes(double d) : v(_mm512_set1_pd(d)) {}
+  explicit Lanes(__m512d d) : v(d) {}
+  static Lanes load(const double *p) { return Lanes(_mm512_loadu_pd(p)); }
+  void store(double *p) const { _mm512_storeu_pd(p, v); }
+};
+
+inline Lanes operator+(Lanes a, Lanes b) { return Lanes(_mm512_add_pd(a.v, b.v)); }
+inline Lanes operator-(Lanes a, Lanes b) { return Lanes(_mm512_sub_pd(a.v, b.v)); }
+inline Lanes operator*(Lanes a, Lanes b) { return Lanes(_mm512_mul_pd(a.v, b.v)); }
+inline Lanes min(Lanes a, Lanes b) { return Lanes(_mm512_min_pd(b.v, a.v)); }
+inline Lanes max(Lanes a, Lanes b) { return Lanes(_mm512_max_pd(b.v, a.v)); }
+
+constexpr int FLOAT_LANES = 16;
+
+struct FloatLanes {
+  __m512 v;
+  FloatLanes() = default;
+  explicit FloatLanes(float f) : v(_mm512_set1_ps(f)) {}
+  explicit FloatLanes(__m512 f) : v(f) {}
+  static FloatLanes load(const float *p) { return FloatLanes(_mm512_loadu_ps(p)); }
+  void store(float *p) const { _mm512_storeu_ps(p, v); }
+};
+
+inline FloatLanes operator+(FloatLanes a, FloatLanes b) { return FloatLanes(_mm512_add_ps(a.v, b.v)); }
+inline FloatLanes operator-(FloatLanes a, FloatLanes b) { return FloatLanes(_mm512_sub_ps(a.v, b.v)); }
+inline FloatLanes operator*(FloatLanes a, FloatLanes b) { return FloatLanes(_mm512_mul_ps(a.v, b.v)); }
+inline FloatLanes min(FloatLanes a, FloatLanes b) { return FloatLanes(_mm512_min_ps(b.v, a.v)); }
+inline FloatLanes max(FloatLanes a, FloatLanes b) { return FloatLanes(_mm512_max_ps(b.v, a.v)); }
+
+#elif defined(ECM_SIMD_AVX)
+
+constexpr int LANES = 4;
+constexpr const char *NAME = "avx2";
+
+struct Lanes {
+  __m256d v;
+  Lanes() = default;
+  explicit Lanes(double d) : v(_mm256_set1_pd(d)) {}
+  explicit Lanes(__m256d d) : v(d) {}
+  static Lanes load(const double *p) { return Lanes(_mm256_loadu_pd(p)); }
+  void store(double *p) const { _mm256_storeu_pd(p, v); }
+};
+
+inline Lanes operator+(Lanes a, Lanes b) { return Lanes(_mm256_add_pd(a.v, b.v)); }
+inline Lanes operator-(Lanes a, Lanes b) { return Lanes(_mm256_sub_pd(a.v, b.v)); }
+inline Lanes operator*(Lanes a, Lanes b) { return Lanes(_mm256_mul_pd(a.v, b.v)); }
+inline Lanes min(Lanes a, Lanes b) { return Lanes(_mm256_min_pd(b.v, a.v)); }
+inline Lanes max(Lanes a, Lanes b) { return Lanes(_mm256_max_pd(b.v, a.v)); }
+
+constexpr int FLOAT_LANES = 8;
+
+struct FloatLanes {
+  __m256 v;
+  FloatLanes() = default;
+  explicit FloatLanes(float f) : v(_mm256_set1_ps(f)) {}
+  explicit FloatLanes(__m256 f) : v(f) {}
+  static FloatLanes load(const float *p) { return FloatLanes(_mm256_loadu_ps(p)); }
+  void store(float *p) const { _mm256_storeu_ps(p, v); }
+};
+
+inline FloatLanes operator+(FloatLanes a, FloatLanes b) { return FloatLanes(_mm256_add_ps(a.v, b.v)); }
+inline FloatLanes operator-(FloatLanes a, FloatLanes b) { return FloatLanes(_mm256_sub_ps(a.v, b.v)); }
+inline FloatLanes operator*(FloatLanes a, FloatLanes b) { return FloatLanes(_mm256_mul_ps(a.v, b.v)); }
+inline FloatLanes min(FloatLanes a, FloatLanes b) { return FloatLanes(_mm256_min_ps(b.v, a.v)); }
+inline FloatLanes max(FloatLanes a, FloatLanes b) { return FloatLanes(_mm256_max_ps(b.v, a.v)); }
+
+#elif defined(ECM_SIMD_WASM)
+
+constexpr int LANES = 2;
+constexpr const char *NAME = "simd128";
+
+struct Lanes {
+  v128_t v;
+  Lanes() = default;
+  explicit Lanes(double d) : v(wasm_f64x2_splat(d)) {}
+  explicit Lanes(v128_t d) : v(d) {}
+  static Lanes load(const double *p) { return Lanes(wasm_v128_load(p)); }
+  void store(double *p) const { wasm_v128_store(p, v); }
+};
+
+inline Lanes operator+(Lanes a, Lanes b) { return Lanes(wasm_f64x2_add(a.v, b.v)); }
+inline Lanes operator-(Lanes a, Lanes b) { return Lanes(wasm_f64x2_sub(a.v, b.v)); }
+inline Lanes operator*(Lanes a, Lanes b) { return Lanes(wasm_f64x2_mul(a.v, b.v)); }
+inline Lanes min(Lanes a, Lanes b) { return Lanes(wasm_f64x2_pmin(a.v, b.v)); }
+inline Lanes max(Lanes a, Lanes b) { return Lanes(wasm_f64x2_pmax(a.v, b.v)); }
+
+constexpr int FLOAT_LANES = 4;
+
+struct FloatLanes {
+  v128_t v;
+  FloatLanes() = default;
+  explicit FloatLanes(float f) : v(wasm_f32x4_splat(f)) {}
+  explicit FloatLanes(v128_t f) : v(f) {}
+  static FloatLanes load(const float *p) { return FloatLanes(wasm_v128_load(p)); }
+  void store(float *p) const { wasm_v128_store(p, v); }
+};
+
+inline FloatLanes operator+(FloatLanes a, FloatLanes b) { return FloatLanes(wasm_f32x4_add(a.v, b.v)); }
+inline FloatLanes operator-(FloatLanes a, FloatLanes b) { return FloatLanes(wasm_f32x4_sub(a.v, b.v)); }
+inline FloatLanes operator*(FloatLanes a, FloatLanes b) { return FloatLanes(wasm_f32x4_mul(a.v, b.v)); }
+inline FloatLanes min(FloatLanes a, FloatLanes b) { return FloatLanes(wasm_f32x4_pmin(a.v, b.v)); }
+inline FloatLanes max(FloatLanes a, FloatLanes b) { return FloatLanes(wasm_f32x4_pmax(a.v, b.v)); }
+
+#else
+
+constexpr int LANES = 1;
+constexpr const char *NAME = "scalar";
+
+struct Lanes {
+  double v;
+  Lanes() = default;
+  explicit Lanes(double d) : v(d) {}
+  static Lanes load(const double *p) { return Lanes(*p); }
+  void store(double *p) const { *p = v; }
+};
+
+inline Lanes operator+(Lanes a, Lanes b) { return Lanes(a.v + b.v); }
+inline Lanes operator-(Lanes a, Lanes b) { return Lanes(a.v - b.v); }
+inline Lanes operator*(Lanes a, Lanes b) { return Lanes(a.v * b.v); }
+inline Lanes min(Lanes a, Lanes b) { return b.v < a.v ? b : a; }
+inline Lanes max(Lanes a, Lanes b) { return a.v < b.v ? b : a; }
+
+constexpr int FLOAT_LANES = 1;
+
+struct FloatLanes {
+  float v;
+  FloatLanes() = default;
+  explicit FloatLanes(float f) : v(f) {}
+  static FloatLanes load(const float *p) { return FloatLanes(*p); }
+  void store(float *p) const { *p = v; }
+};
+
+inline FloatLanes operator+(FloatLanes a, FloatLanes b) { return FloatLanes(a.v + b.v); }
+inline FloatLanes operator-(FloatLanes a, FloatLanes b) { return FloatLanes(a.v - b.v); }
+inline FloatLanes operator*(FloatLanes a, FloatLanes b) { return FloatLanes(a.v * b.v); }
+inline FloatLanes min(FloatLanes a, FloatLanes b) { return b.v < a.v ? b : a; }
+inline FloatLanes max(FloatLanes a, FloatLanes b) { return a.v < b.v ? b : a; }
+
+#endif
+
+// Lane type and lane count of a scalar type
+template <typename T> struct LanesOf;
+
+template <> struct LanesOf<double> {
+  typedef Lanes type;
+  static constexpr int width = LANES;
+};
+
+template <> struct LanesOf<float> {
+  typedef FloatLanes type;
+  static constexpr int width = FLOAT_LANES;
+};
+
+} // namespace simd
+
+#endif // ECM_SIMD_H
@@ -0,0 +1,81 @@
+#include "ecm_threads.h"
+
+#include <algorithm>
+
+// Upper bound on explicit thread counts
+const int MAX_THREADS = 256;
+
+int ThreadPool::hardwareThreads() {
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+  return 1;
+#else
+  return std::max(1u, std::thread::hardware_concurrency());
+#endif
+}
+
+void ThreadPool::resize(int threads) {
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+  threads = 1;
+#endif
+  if (threads <= 0)
+    threads = hardwareThreads();
+  threads = std::min(threads, MAX_THREADS);
+  if (threads == size())
+    return;
+
+  // Stop the current workers, then start the new set
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  start_.notify_all();
+  for (std::thread &t : workers_)
+    t.join();
+  workers_.clear();
+
+  stop_ = false;
+  generation_ = 0;
+  for (int t = 1; t < threads; t++)
+    workers_.emplace_back(&ThreadPool::worker, this, t);
+}
+
+void ThreadPool::runJob(Call call, void *context) {
+  if (workers_.empty()) {
+    call(context, 0);
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    call_ = call;
+    context_ = context;
+    pending_ = (int)workers_.size();
+    generation_++;
+  }
+  start_.notify_all();
+
+  call(context, 0);
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_.wait(lock, [this] { return pending_ == 0; });
+}
+
+void ThreadPool::worker(int thread) {
+  unsigned seen = 0;
+  for (;;) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    start_.wait(lock, [&] { return stop_ || generation_ != seen; });
+    if (stop_)
+      return;
+    seen = generation_;
+    Call call = call_;
+    void *context = context_;
+    lock.unlock();
+
+    call(context, thread);
+
+    lock.lock();
+    if (--pending_ == 0)
+      done_.notify_one();
+  }
+}
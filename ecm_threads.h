@@ -0,0 +1,69 @@
+// Persistent worker pool for the per-step grid passes.
+//
+// The calling thread takes part in every job as thread 0, so a pool of N
+// threads owns N - 1 workers. run() returns once every thread has finished,
+// which is the barrier between simulation phases. Builds without thread
+// support (Emscripten without -pthread) always run on the calling thread.
+#ifndef ECM_THREADS_H
+#define ECM_THREADS_H
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+class ThreadPool {
+public:
+  ThreadPool() = default;
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+  ~ThreadPool() { resize(1); }
+
+  // Total thread count including the caller. threads <= 0 selects every
+  // hardware thread. Builds without thread support stay at 1.
+  void resize(int threads);
+  int size() const { return (int)workers_.size() + 1; }
+
+  // Call job(thread) once on every thread, thread in [0, size())
+  template <typename Job> void run(Job &&job) {
+    runJob(&invoke<Job>, &job);
+  }
+
+  // Split rows [0, count) into size() contiguous blocks and call
+  // job(begin, end, thread) for every non-empty block
+  template <typename Job> void runRows(int count, Job &&job) {
+    const int threads = size();
+    run([&](int thread) {
+      int begin = (int)((long long)count * thread / threads);
+      int end = (int)((long long)count * (thread + 1) / threads);
+      if (begin < end)
+        job(begin, end, thread);
+    });
+  }
+
+  static int hardwareThreads();
+
+private:
+  typedef void (*Call)(void *context, int thread);
+
+  template <typename Job> static void invoke(void *context, int thread) {
+    (*static_cast<typename std::remove_reference<Job>::type *>(context))(
+        thread);
+  }
+
+  void runJob(Call call, void *context);
+  void worker(int thread);
+
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable start_;
+  std::condition_variable done_;
+  Call call_ = nullptr;
+  void *context_ = nullptr;
+  unsigned generation_ = 0;
+  int pending_ = 0;
+  bool stop_ = false;
+};
+
+#endif // ECM_THREADS_H
@@ -0,0 +1,102 @@
+#include "ecm_tridiagonal.h"
+
+#include <algorithm>
+
+// Systems corrected per pass in solve()
+const int SOLVE_BLOCK = 64;
+
+// Forward elimination and back substitution with the modified (non-cyclic)
+// matrix: diagonal d_i from inverse, off-diagonals -c
+template <typename T>
+static void sweep(const double *inverse, const double *upper, double c, int n,
+                  T *x, size_t stride, int width) {
+  for (int w = 0; w < width; w++)
+    x[w] *= inverse[0];
+  for (int i = 1; i < n; i++) {
+    T *row = x + i * stride;
+    const T *prev = row - stride;
+    for (int w = 0; w < width; w++)
+      row[w] = (row[w] + c * prev[w]) * inverse[i];
+  }
+  for (int i = n - 2; i >= 0; i--) {
+    T *row = x + i * stride;
+    const T *next = row + stride;
+    for (int w = 0; w < width; w++)
+      row[w] -= upper[i] * next[w];
+  }
+}
+
+void CyclicTridiagonal::prepare(int n, double c) {
+  n_ = n;
+  c_ = c;
+  if (n < 3)
+    return; // Solved directly
+
+  // Sherman-Morrison split A = B + u v^T with u = (gamma, 0, ..., 0, -c)
+  // and v = (1, 0, ..., 0, -c / gamma), gamma = -(1 + 2c)
+  const double b = 1.0 + 2.0 * c;
+  const double gamma = -b;
+  corner_ = -c / gamma;
+
+  inverse_.resize(n);
+  upper_.resize(n);
+  for (int i = 0; i < n; i++) {
+    double d = b;
+    if (i == 0)
+      d = b - gamma;
+    else if (i == n - 1)
+      d = b - c * c / gamma;
+    if (i > 0)
+      d += c * upper_[i - 1];
+    inverse_[i] = 1.0 / d;
+    upper_[i] = -c * inverse_[i];
+  }
+
+  // z = B^-1 u, scaled by 1 / (1 + v.z)
+  z_.assign(n, 0.0);
+  z_[0] = gamma;
+  z_[n - 1] = -c;
+  sweep(inverse_.data(), upper_.data(), c, n, z_.data(), 1, 1);
+  const double scale = 1.0 / (1.0 + z_[0] + corner_ * z_[n - 1]);
+  for (double &z : z_)
+    z *= scale;
+}
+
+template <typename T>
+void CyclicTridiagonal::solve(T *x, size_t stride, int width) const {
+  if (n_ == 1)
+    return; // Both neighbors are the element itself: T = 0
+
+  if (n_ == 2) {
+    // Both neighbors are the other element
+    const double b = 1.0 + 2.0 * c_;
+    const double inv_det = 1.0 / (1.0 + 4.0 * c_);
+    T *x1 = x + stride;
+    for (int w = 0; w < width; w++) {
+      const double r0 = x[w];
+      const double r1 = x1[w];
+      x[w] = (b * r0 + 2.0 * c_ * r1) * inv_det;
+      x1[w] = (b * r1 + 2.0 * c_ * r0) * inv_det;
+    }
+    return;
+  }
+
+  sweep(inverse_.data(), upper_.data(), c_, n_, x, stride, width);
+
+  // x -= (v.y) z for each system
+  const T *last = x + (n_ - 1) * stride;
+  for (int w0 = 0; w0 < width; w0 += SOLVE_BLOCK) {
+    const int count = std::min(SOLVE_BLOCK, width - w0);
+    double f[SOLVE_BLOCK];
+    for (int w = 0; w < count; w++)
+      f[w] = x[w0 + w] + corner_ * last[w0 + w];
+    for (int i = 0; i < n_; i++) {
+      T *row = x + i * stride + w0;
+      for (int w = 0; w < count; w++)
+        row[w] -= f[w] * z_[i];
+    }
+  }
+}
+
+template void CyclicTridiagonal::solve(double *, size_t, int) const;
+template void CyclicTridiagonal::solve(float *, size_t, int) const;
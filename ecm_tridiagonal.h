@@ -0,0 +1,38 @@
+// Periodic tridiagonal solves for implicit diffusion.
+//
+// CyclicTridiagonal solves (I - c T) x = r, where T is the periodic second
+// difference (T x)_i = x_{i-1} - 2 x_i + x_{i+1} with indices taken modulo
+// n. The matrix is the tridiagonal 1 + 2c / -c plus the two corner entries
+// from the wrap-around, so it is solved with the Thomas algorithm on a
+// modified tridiagonal matrix and one Sherman-Morrison correction.
+//
+// The factorization depends only on n and c; prepare() computes it once and
+// solve() then applies it to any number of independent systems laid out side
+// by side, so a block of grid columns is solved one row at a time with
+// unit-stride inner loops.
+#ifndef ECM_TRIDIAGONAL_H
+#define ECM_TRIDIAGONAL_H
+
+#include <cstddef>
+#include <vector>
+
+class CyclicTridiagonal {
+public:
+  // Factor the system of size n >= 1 with coupling c >= 0
+  void prepare(int n, double c);
+
+  // Solve width systems in place. Element i of system w is
+  // x[i * stride + w] and holds r_i on entry and x_i on return. T is double
+  // or float; the arithmetic is in double either way.
+  template <typename T> void solve(T *x, size_t stride, int width) const;
+
+private:
+  int n_ = 0;
+  double c_ = 0.0;
+  double corner_ = 0.0;           // Weight of x_{n-1} in the correction
+  std::vector<double> inverse_;   // Inverse pivots of the modified matrix
+  std::vector<double> upper_;     // Eliminated upper diagonal
+  std::vector<double> z_;         // Scaled Sherman-Morrison vector
+};
+
+#endif // ECM_TRIDIAGONAL_H
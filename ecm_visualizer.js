@@ -7,6 +7,10 @@ class ECMVisualizer {
         this.currentTime = 0.0; // ADDED: Missing property initialization
         this.dataBuffer = null;
         this.timeStep = 0.1; // Default time step for ODE integration
+        this.maxStepsPerFrame = 100000; // Cap on the steps of one animation frame; the frame budget ends the batch first
+        this.frameBudget = 12; // Milliseconds of each frame the steps may use
+        this.profiling = false; // Show the engine's phase profile
+        this.profileShown = 0; // performance.now() of the last profile update
         
         // For visualization range (needed for text display)
         this.minValue = 0.1; // ADDED: Default values
@@ -383,9 +387,75 @@ class ECMVisualizer {
         controls.appendChild(stopButton);
         controls.appendChild(stepButton);
         controls.appendChild(resetButton);
+        
+        // Phase profile toggle and readout
+        const profileLabel = document.createElement('label');
+        profileLabel.style.marginLeft = '10px';
+        const profileToggle = document.createElement('input');
+        profileToggle.type = 'checkbox';
+        profileToggle.id = 'profile-toggle';
+        profileToggle.addEventListener('change', (e) => this.setProfiling(e.target.checked));
+        profileLabel.appendChild(profileToggle);
+        profileLabel.appendChild(document.createTextNode(' Profile'));
+        controls.appendChild(profileLabel);
+        
+        const profileInfo = document.createElement('div');
+        profileInfo.id = 'profile-info';
+        profileInfo.style.fontFamily = 'monospace';
+        profileInfo.style.whiteSpace = 'pre';
+        profileInfo.style.display = 'none';
+        controls.appendChild(profileInfo);
         document.body.appendChild(controls);
     }
     
+    // True if the loaded module exports the named function. A module built
+    // before an export was added (see compile.sh) lacks it, and the callers
+    // fall back to the older exports.
+    hasExport(name) {
+        return !!this.wasm && typeof this.wasm[name] === 'function';
+    }
+    
+    // Turn the engine's phase profile and its readout on or off
+    setProfiling(enabled) {
+        const info = document.getElementById('profile-info');
+        if (enabled && this.wasm && !this.hasExport('_getProfile')) {
+            this.profiling = false;
+            info.style.display = 'block';
+            info.textContent = 'Profiling needs a module rebuilt with compile.sh';
+            return;
+        }
+        this.profiling = enabled;
+        info.style.display = enabled ? 'block' : 'none';
+        if (this.hasExport('_setProfiling')) {
+            this.wasm._resetProfile();
+            this.wasm._setProfiling(enabled ? 1 : 0);
+        }
+        this.profileShown = 0;
+    }
+    
+    // Show steps/sec and the per-phase breakdown of the last step, at most
+    // twice a second
+    updateProfileInfo() {
+        const now = performance.now();
+        if (!this.profiling || now - this.profileShown < 500) return;
+        this.profileShown = now;
+        
+        // getProfile(): 5 phases x [total ns, last-step ns, calls, bytes allocated, cells]
+        const ptr = this.wasm._getProfile() >>> 0; // wasm pointers come back signed
+        const p = new Float64Array(this.wasm.HEAPF64.buffer, ptr, 25);
+        const names = ['Reaction', 'Feedback diffusion', 'ECM diffusion', 'Readback', 'Step'];
+        const step = 4 * 5;
+        const stepsPerSec = p[step] > 0 ? p[step + 2] / (p[step] * 1e-9) : 0;
+        const lines = [`Steps/sec: ${stepsPerSec.toFixed(1)}`];
+        names.forEach((name, i) => {
+            const row = i * 5;
+            const ms = p[row + 1] * 1e-6;
+            const share = p[step + 1] > 0 && i < 3 ? ` (${(100 * p[row + 1] / p[step + 1]).toFixed(0)}%)` : '';
+            lines.push(`${name.padEnd(20)} ${ms.toFixed(2).padStart(8)} ms${share}`);
+        });
+        document.getElementById('profile-info').textContent = lines.join('\n');
+    }
+    
     // Initialize line plot canvas
     initLinePlot() {
         const container = document.createElement('div');
@@ -627,16 +697,7 @@ class ECMVisualizer {
             if (this.wasm) {
                 try {
                     // Get data based on molecule type (ECM or feedback)
-                    let dataPtr;
-                    let isFeedback = false;
-                    
-                    if (this.currentMoleculeIndex >= 100) {
-                        const adjustedIndex = this.currentMoleculeIndex - 100;
-                        dataPtr = this.wasm._getFeedbackData(adjustedIndex);
-                        isFeedback = true;
-                    } else {
-                        dataPtr = this.wasm._getECMData(this.currentMoleculeIndex);
-                    }
+                    const { data, stride, isFeedback } = this.currentField();
                     
                     // Apply log scaling for better visualization
                     const logMin = this.minValue > 0 ? Math.log10(this.minValue) : -3;
@@ -646,7 +707,7 @@ class ECMVisualizer {
                     // Draw heatmap cells directly to temp canvas
                     for (let i = 0; i < gridSize; i++) {
                         for (let j = 0; j < gridSize; j++) {
-                            let value = this.wasm._readDataValue(dataPtr, i, j);
+                            let value = data[i * stride + j];
                             
                             // Apply log scaling for better visualization of small values
                             if (value > 0) {
@@ -676,9 +737,6 @@ class ECMVisualizer {
                         }
                     }
                     
-                    // Free the data memory
-                    this.wasm._freeData(dataPtr);
-                    
                 } catch (error) {
                     console.error("Error generating heatmap for SVG:", error);
                 }
@@ -1120,16 +1178,7 @@ class ECMVisualizer {
         
         try {
             // Get data based on molecule type (ECM or feedback)
-            let dataPtr;
-            let isFeedback = false;
-            
-            if (this.currentMoleculeIndex >= 100) {
-                const adjustedIndex = this.currentMoleculeIndex - 100;
-                dataPtr = this.wasm._getFeedbackData(adjustedIndex);
-                isFeedback = true;
-            } else {
-                dataPtr = this.wasm._getECMData(this.currentMoleculeIndex);
-            }
+            const { data, stride } = this.currentField();
             
             // Track min/max values
             this.minValue = 1.0;
@@ -1137,7 +1186,7 @@ class ECMVisualizer {
             
             for (let i = 0; i < this.gridSize; i++) {
                 for (let j = 0; j < this.gridSize; j++) {
-                    const value = this.wasm._readDataValue(dataPtr, i, j);
+                    const value = data[i * stride + j];
                     if (value > 0) {
                         this.minValue = Math.min(this.minValue, value);
                         this.maxValue = Math.max(this.maxValue, value);
@@ -1149,9 +1198,6 @@ class ECMVisualizer {
             if (this.maxValue <= 0) this.maxValue = 0.01;
             if (this.minValue >= this.maxValue) this.minValue = 0;
             
-            // Free the data memory
-            this.wasm._freeData(dataPtr);
-            
         } catch (error) {
             console.error("Error updating min/max values:", error);
         }
@@ -1273,18 +1319,8 @@ class ECMVisualizer {
                 label.style.marginRight = '10px';
                 
                 // Get current value
-                let dataPtr;
-                let isFeedback = false;
-                if (this.currentMoleculeIndex >= 100) {
-                    const adjustedIndex = this.currentMoleculeIndex - 100;
-                    dataPtr = this.wasm._getFeedbackData(adjustedIndex);
-                    isFeedback = true;
-                } else {
-                    dataPtr = this.wasm._getECMData(this.currentMoleculeIndex);
-                }
-                
-                const currentValue = this.wasm._readDataValue(dataPtr, cell.row, cell.col);
-                this.wasm._freeData(dataPtr);
+                const { data, stride, isFeedback } = this.currentField();
+                const currentValue = data[cell.row * stride + cell.col];
                 
                 // Value input
                 const valueInput = document.createElement('input');
@@ -1445,6 +1481,9 @@ class ECMVisualizer {
             
             // Initialize the grid
             this.wasm._initializeGrid();
+            if (this.hasExport('_setTimeBudget')) {
+                this.wasm._setTimeBudget(this.frameBudget);
+            }
             
             // Set initial rate constants
             this.updateRateConstants();
@@ -1498,16 +1537,30 @@ class ECMVisualizer {
         this.simulationRunning = false;
     }
     
-    stepSimulation() {
+    // Advance up to steps steps (one for the Step button), stopping early once
+    // the frame budget set with _setTimeBudget is spent
+    stepSimulation(steps = 1) {
         if (this.wasm) {
             try {
                 // Apply input concentrations to selected cells before each step
                 this.applyInputToSelectedCells();
                 
-                this.wasm._simulateStep(this.timeStep);
-                this.iteration++;
+                // As many steps as fit in the frame budget, at most steps
+                if (this.hasExport('_simulateSteps')) {
+                    this.iteration += this.wasm._simulateSteps(steps, this.timeStep);
+                } else {
+                    // Older module: one call per step, against the same budget
+                    const start = performance.now();
+                    let taken = 0;
+                    do {
+                        this.wasm._simulateStep(this.timeStep);
+                        taken++;
+                    } while (taken < steps && performance.now() - start < this.frameBudget);
+                    this.iteration += taken;
+                }
                 this.currentTime = this.iteration * this.timeStep; // Update current time
                 this.updateVisualization();
+                this.updateProfileInfo();
                 this.updateTrackedCellsUI(); // Update input values to reflect simulation changes
             } catch (error) {
                 console.error("Error during simulation step:", error);
@@ -1567,29 +1620,54 @@ class ECMVisualizer {
     simulationLoop() {
         if (!this.simulationRunning) return;
         
-        // Apply input values before each step to ensure continuous feeding
-        this.stepSimulation();
+        // Apply input values before each batch to ensure continuous feeding,
+        // then run steps until the frame budget is spent
+        this.stepSimulation(this.maxStepsPerFrame);
         requestAnimationFrame(() => this.simulationLoop());
     }
     
+    // Values of the displayed molecule as a Float64Array (Float32Array for a
+    // float32 build) over the engine's own field, row-major with stride
+    // values per row. No copy is made; the view is only valid until the
+    // next step, so fetch it again each time. A module without the view
+    // exports gets a copy read value by value instead.
+    currentField() {
+        const isFeedback = this.currentMoleculeIndex >= 100;
+        if (!this.hasExport('_getECMView')) {
+            const ptr = (isFeedback
+                ? this.wasm._getFeedbackData(this.currentMoleculeIndex - 100)
+                : this.wasm._getECMData(this.currentMoleculeIndex)) >>> 0;
+            const stride = this.gridSize;
+            const data = new Float64Array(this.gridSize * stride);
+            if (ptr) {
+                for (let i = 0; i < this.gridSize; i++) {
+                    for (let j = 0; j < this.gridSize; j++) {
+                        data[i * stride + j] = this.wasm._readDataValue(ptr, i, j);
+                    }
+                }
+                this.wasm._freeData(ptr);
+            }
+            return { data, stride, isFeedback };
+        }
+        // Pointers above 2 GB come back from wasm as negative i32 values
+        const ptr = (isFeedback
+            ? this.wasm._getFeedbackView(this.currentMoleculeIndex - 100)
+            : this.wasm._getECMView(this.currentMoleculeIndex)) >>> 0;
+        const stride = this.wasm._getFieldStride();
+        const length = this.wasm._getGridRows() * stride;
+        const data = this.wasm._getFieldBytes() === 4
+            ? new Float32Array(this.wasm.HEAPF32.buffer, ptr, length)
+            : new Float64Array(this.wasm.HEAPF64.buffer, ptr, length);
+        return { data, stride, isFeedback };
+    }
+    
     updateVisualization() {
         if (!this.wasm) return;
         
         try {
             // Get data based on molecule type (ECM or feedback)
-            let dataPtr;
-            let isFeedback = false;
-            
-            // Check if it's a feedback molecule (using indexes 100+ for feedback)
-            if (this.currentMoleculeIndex >= 100) {
-                // For feedback molecules, adjust index
-                const adjustedIndex = this.currentMoleculeIndex - 100;
-                dataPtr = this.wasm._getFeedbackData(adjustedIndex);
-                isFeedback = true;
-            } else {
-                // For ECM molecules
-                dataPtr = this.wasm._getECMData(this.currentMoleculeIndex);
-            }
+            const field = this.currentField();
+            const { data, stride, isFeedback } = field;
             
             // Create scaled canvas for display
             const scale = this.canvas.width / this.gridSize;
@@ -1602,7 +1680,7 @@ class ECMVisualizer {
             // First pass: find min/max values
             for (let i = 0; i < this.gridSize; i++) {
                 for (let j = 0; j < this.gridSize; j++) {
-                    const value = this.wasm._readDataValue(dataPtr, i, j);
+                    const value = data[i * stride + j];
                     if (value > 0) {
                         this.minValue = Math.min(this.minValue, value);
                         this.maxValue = Math.max(this.maxValue, value);
@@ -1622,7 +1700,7 @@ class ECMVisualizer {
             // Second pass: draw with enhanced contrast
             for (let i = 0; i < this.gridSize; i++) {
                 for (let j = 0; j < this.gridSize; j++) {
-                    let value = this.wasm._readDataValue(dataPtr, i, j);
+                    let value = data[i * stride + j];
                     
                     // Apply log scaling for better visualization of small values
                     if (value > 0) {
@@ -1706,17 +1784,14 @@ class ECMVisualizer {
             this.ctx.fillText(`Tracked cells (plot): ${this.trackedCells.length}`, 15, 90);
             
             // Update line plots for tracked cells
-            this.updateLinePlots(dataPtr, isFeedback);
-            
-            // Free the data memory
-            this.wasm._freeData(dataPtr);
+            this.updateLinePlots(field);
             
         } catch (error) {
             console.error("Error updating visualization:", error);
         }
     }
     
-    updateLinePlots(dataPtr, isFeedback) {
+    updateLinePlots({ data, stride, isFeedback }) {
         if (!this.wasm || this.trackedCells.length === 0) return;
         
         // Clear line plot canvas
@@ -1725,7 +1800,7 @@ class ECMVisualizer {
         // Get current values for tracked cells and update concentration data
         this.trackedCells.forEach(cell => {
             const key = `${cell.row},${cell.col}`;
-            const value = this.wasm._readDataValue(dataPtr, cell.row, cell.col);
+            const value = data[cell.row * stride + cell.col];
             
             if (!this.concentrationData[key]) {
                 this.concentrationData[key] = [];
@@ -1,2 +1,16 @@
 #!/bin/bash
-python3 -m http.server 8000
\ No newline at end of file
+# Serve the app on port 8000. The cross-origin isolation headers enable
+# SharedArrayBuffer, which the multithreaded build (ecm_threads.js) needs.
+python3 - <<'PY'
+from http.server import SimpleHTTPRequestHandler, ThreadingHTTPServer
+
+
+class IsolatedHandler(SimpleHTTPRequestHandler):
+    def end_headers(self):
+        self.send_header("Cross-Origin-Opener-Policy", "same-origin")
+        self.send_header("Cross-Origin-Embedder-Policy", "require-corp")
+        super().end_headers()
+
+
+ThreadingHTTPServer(("", 8000), IsolatedHandler).serve_forever()
+PY